@@ -0,0 +1,412 @@
+/*
+ * Microbenchmarks of mb's own hot paths and the maximum request rate of a single worker thread
+ * against a loopback responder (make bench).  The numbers tell whether mb rather than the
+ * server under test limits a run; compare them between builds to catch regressions.
+ */
+#define _GNU_SOURCE		/* accept4(), CPU_SET() */
+#include <errno.h>		/* errno */
+#include <fcntl.h>		/* open() */
+#include <inttypes.h>		/* PRIu64 */
+#include <netinet/in.h>		/* struct sockaddr_in */
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <sched.h>		/* sched_setaffinity() */
+#include <signal.h>		/* kill() */
+#include <stdio.h>		/* printf() */
+#include <stdlib.h>		/* malloc(), mkstemp() */
+#include <string.h>		/* strlen(), strerror() */
+#include <sys/socket.h>		/* socketpair(), accept4() */
+#include <sys/wait.h>		/* waitpid() */
+#include <time.h>		/* clock_gettime() */
+#include <unistd.h>		/* fork(), execv() */
+
+#include "../json/json.h"
+#include "../src/mb.h"		/* cfg, stats */
+#include "../src/mcg.h"		/* mcg64_seed(), mcg64cpy() */
+#include "../src/merr.h"
+#include "../src/net.h"		/* request_def, connection, socket_listen() */
+#include "../src/stats.h"	/* write_stats_line(), STATS_BUF_LEN */
+#include "../src/tmpl.h"	/* tmpl_conn_init(), tmpl_render() */
+#include "bench.h"
+
+/* a typical response: HTML page with Content-Length, see main() */
+static const char response_headers[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Server: nginx/1.25.3\r\n"
+  "Date: Tue, 01 Oct 2024 12:00:00 GMT\r\n"
+  "Content-Type: text/html\r\n"
+  "Content-Length: %zu\r\n"
+  "Last-Modified: Tue, 24 Oct 2023 13:46:47 GMT\r\n"
+  "Connection: keep-alive\r\n"
+  "ETag: \"6537cac7-267\"\r\n"
+  "Accept-Ranges: bytes\r\n"
+  "\r\n"
+  "%s";
+static const char response_page[] =
+  "<!DOCTYPE html>\n<html>\n<head>\n<title>Welcome to nginx!</title>\n<style>\nhtml { color-scheme: light dark; }\n"
+  "body { width: 35em; margin: 0 auto;\nfont-family: Tahoma, Verdana, Arial, sans-serif; }\n</style>\n</head>\n<body>\n"
+  "<h1>Welcome to nginx!</h1>\n<p>If you see this page, the nginx web server is successfully installed and\n"
+  "working. Further configuration is required.</p>\n\n<p>For online documentation and support please refer to\n"
+  "<a href=\"http://nginx.org/\">nginx.org</a>.<br/>\nCommercial support is available at\n"
+  "<a href=\"http://nginx.com/\">nginx.com</a>.</p>\n\n<p><em>Thank you for using nginx.</em></p>\n</body>\n</html>\n";
+
+/* the headers of a GET request with one header of the request file, as http_headers_create() builds them */
+static const char bench_headers[] =
+  "GET /index.html HTTP/1.1\r\n"
+  "Host: www.example.com\r\n"
+  "Accept: */*\r\n";
+
+/* a chunked response: four 128 byte chunks */
+#define CHUNK_128 "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef" \
+                  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+static const char response_chunked[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Server: nginx/1.25.3\r\n"
+  "Date: Tue, 01 Oct 2024 12:00:00 GMT\r\n"
+  "Content-Type: application/json\r\n"
+  "Transfer-Encoding: chunked\r\n"
+  "Connection: keep-alive\r\n"
+  "\r\n"
+  "80\r\n" CHUNK_128 "\r\n"
+  "80\r\n" CHUNK_128 "\r\n"
+  "80\r\n" CHUNK_128 "\r\n"
+  "80\r\n" CHUNK_128 "\r\n"
+  "0\r\n\r\n";
+
+static uint64_t messages;		/* responses parsed */
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Time fn on arg in rounds of twice the operations until a round takes at least BENCH_NS. */
+static void bench_run(const char *name, bench_fn *fn, void *arg) {
+  uint64_t n, start, ns;
+
+  for (n = BENCH_OPS_MIN; ; n *= 2) {
+    start = now_ns();
+    fn(arg, n);
+    if ((ns = now_ns() - start) >= BENCH_NS) break;
+  }
+
+  printf("%-40s %12"PRIu64" ops %12.1f ns/op\n", name, n, (double)ns / n);
+}
+
+static int parser_message_complete(http_parser *p) {
+  messages++;
+  return 0;
+}
+
+static int parser_body(http_parser *p, const char *at, size_t len) {
+  return 0;
+}
+
+/* arg: a keep-alive response, parsed over and over by one parser */
+static void bench_parser(void *arg, uint64_t n) {
+  static http_parser_settings settings = {
+    .on_body = parser_body,
+    .on_message_complete = parser_message_complete
+  };
+  const char *data = arg;
+  size_t len = strlen(data);
+  http_parser parser;
+
+  http_parser_init(&parser, HTTP_RESPONSE);
+  while (n--) {
+    if (http_parser_execute(&parser, &settings, data, len) != len)
+      die(EXIT_FAILURE, "http_parser_execute(): %s\n", http_errno_description(HTTP_PARSER_ERRNO(&parser)));
+  }
+}
+
+/* arg: connection to record responses of; the response stats go to /dev/null */
+static void bench_stats_line(void *arg, uint64_t n) {
+  connection *c = arg;
+
+  while (n--) write_stats_line(stats.fd, c, NULL);
+}
+
+static void bench_mcg64cpy(void *arg, uint64_t n) {
+  static __uint128_t state;
+  char *buf = arg;
+
+  if (!state) mcg64_seed(&state);
+  while (n--) mcg64cpy(&state, buf, BENCH_BUF_LEN);
+}
+
+/* arg: request definition to build a request of from bench_headers */
+static void bench_http_request_create(void *arg, uint64_t n) {
+  const request_def *d = arg;
+  char *request;
+  size_t len;
+
+  while (n--) {
+    http_request_create(d, bench_headers, &request, &len);
+    free(request);
+  }
+}
+
+/* arg: request definition to build the requests of */
+static void bench_requests_create(void *arg, uint64_t n) {
+  request_def *d = arg;
+
+  while (n--) {
+    request_def_requests_create(d);
+    free(d->request); d->request = NULL;
+    free(d->request_cclose); d->request_cclose = NULL;
+  }
+}
+
+/* arg: connection of a request definition with a template */
+static void bench_tmpl_render(void *arg, uint64_t n) {
+  connection *c = arg;
+
+  while (n--) {
+    tmpl_render(c);
+    c->cstats.reqs_total++;
+  }
+}
+
+static int timer_fired(aeEventLoop *loop, long long id, void *data) {
+  return AE_NOMORE;
+}
+
+static void file_ready(aeEventLoop *loop, int fd, void *data, int mask) {
+}
+
+/* arg: event loop with BENCH_TIMERS pending time events; create and delete another one */
+static void bench_ae_timer(void *arg, uint64_t n) {
+  aeEventLoop *loop = arg;
+
+  while (n--) aeDeleteTimeEvent(loop, aeCreateTimeEvent(loop, 1000, timer_fired, NULL, NULL));
+}
+
+/* create a time event that is due right away and let the event loop fire it */
+static void bench_ae_timer_fire(void *arg, uint64_t n) {
+  aeEventLoop *loop = arg;
+
+  while (n--) {
+    aeCreateTimeEvent(loop, 0, timer_fired, NULL, NULL);
+    aeProcessEvents(loop, AE_TIME_EVENTS | AE_DONT_WAIT);
+  }
+}
+
+/* register and unregister a socket for writability, as every request on a connection does */
+static void bench_ae_file(void *arg, uint64_t n) {
+  aeEventLoop *loop = arg;
+  int fd = aeGetSetSize(loop) - 1;
+
+  while (n--) {
+    aeCreateFileEvent(loop, fd, AE_WRITABLE, file_ready, NULL);
+    aeDeleteFileEvent(loop, fd, AE_WRITABLE);
+  }
+}
+
+/* wait for and dispatch an event of a writable socket */
+static void bench_ae_dispatch(void *arg, uint64_t n) {
+  aeEventLoop *loop = arg;
+
+  while (n--) aeProcessEvents(loop, AE_FILE_EVENTS | AE_DONT_WAIT);
+}
+
+/* Responder: answer every request (up to the empty line) read with BENCH_RESPONSE. */
+static void responder_read(aeEventLoop *loop, int fd, void *data, int mask) {
+  static const char eoh[] = "\r\n\r\n";
+  static char buf[RECVBUF];
+  int *state = data;
+  ssize_t len, i;
+
+  if ((len = read(fd, buf, sizeof(buf))) <= 0) {
+    if (len < 0 && errno == EAGAIN) return;
+    aeDeleteFileEvent(loop, fd, AE_READABLE);
+    close(fd);
+    return;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (buf[i] == eoh[state[fd]]) state[fd]++;
+    else state[fd] = (buf[i] == '\r');
+    if (state[fd] == sizeof(eoh) - 1) {
+      state[fd] = 0;
+      if (send(fd, BENCH_RESPONSE, sizeof(BENCH_RESPONSE) - 1, MSG_NOSIGNAL) < 0 && errno != EAGAIN) break;
+    }
+  }
+}
+
+static void responder_accept(aeEventLoop *loop, int lfd, void *data, int mask) {
+  int fd, on = 1;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    if (fd >= aeGetSetSize(loop)) {
+      close(fd);
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ((int *)data)[fd] = 0;
+    aeCreateFileEventOrDie(loop, fd, AE_READABLE, responder_read, data);
+  }
+}
+
+static void responder_run(int lfd) {
+  aeEventLoop *loop = aeCreateEventLoop(BENCH_RPS_CLIENTS + MB_FD_START + 16);
+  int *state;
+
+  if (!loop || (state = calloc(aeGetSetSize(loop), sizeof(*state))) == NULL)
+    die(EXIT_FAILURE, "cannot create the responder event loop\n");
+  fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+  aeCreateFileEventOrDie(loop, lfd, AE_READABLE, responder_accept, state);
+  aeMain(loop);
+  exit(EXIT_SUCCESS);
+}
+
+/* Start mb to run BENCH_RPS_SECS on a single thread against the responder; return its rate. */
+static void bench_rps(const char *mb) {
+  char req_file[] = "/tmp/mb-bench-req-XXXXXX", out_file[] = "/tmp/mb-bench-out-XXXXXX", *json;
+  struct sockaddr_in sin;
+  socklen_t sin_len = sizeof(sin);
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  pid_t responder, client;
+  json_value *v, *rps = NULL, *errors = NULL;
+  size_t json_len;
+  int lfd, fd, status, i;
+  FILE *f;
+
+  if ((lfd = socket_listen("127.0.0.1:0", false)) < 0 || getsockname(lfd, (struct sockaddr *)&sin, &sin_len))
+    die(EXIT_FAILURE, "cannot start the loopback responder\n");
+
+  if ((responder = fork()) < 0) die(EXIT_FAILURE, "fork(): %s (%d)\n", strerror(errno), errno);
+  if (!responder) {
+    if (cpus > 1) {
+      /* keep the responder off the CPU of the mb thread */
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(1, &set);
+      sched_setaffinity(0, sizeof(set), &set);
+    }
+    responder_run(lfd);
+  }
+  close(lfd);
+
+  if ((fd = mkstemp(req_file)) < 0 || (f = fdopen(fd, "w")) == NULL)
+    die(EXIT_FAILURE, "cannot create a request file: %s (%d)\n", strerror(errno), errno);
+  fprintf(f, "[{\"host\":\"127.0.0.1\",\"port\":%d,\"path\":\"/\",\"clients\":%d}]\n", ntohs(sin.sin_port), BENCH_RPS_CLIENTS);
+  fclose(f);
+  if ((fd = mkstemp(out_file)) < 0)
+    die(EXIT_FAILURE, "cannot create a results file: %s (%d)\n", strerror(errno), errno);
+  close(fd);
+
+  if ((client = fork()) < 0) die(EXIT_FAILURE, "fork(): %s (%d)\n", strerror(errno), errno);
+  if (!client) {
+    char *argv[] = { (char *)mb, "-q", "-t", "1", "-d", BENCH_RPS_SECS, "-i", req_file, "-j", out_file, "-C", "0", NULL };
+
+    if (cpus <= 1) argv[10] = NULL;	/* nothing to pin to */
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0) dup2(fd, STDOUT_FILENO);
+    execv(mb, argv);
+    die(EXIT_FAILURE, "cannot run %s: %s (%d)\n", mb, strerror(errno), errno);
+  }
+  waitpid(client, &status, 0);
+  kill(responder, SIGTERM);
+  waitpid(responder, NULL, 0);
+  unlink(req_file);
+
+  json = (WIFEXITED(status) && !WEXITSTATUS(status))? requests_load(out_file, &json_len): NULL;
+  unlink(out_file);
+  if (!json || (v = json_parse(json, json_len)) == NULL)
+    die(EXIT_FAILURE, "%s did not finish its run against the responder\n", mb);
+  for (i = 0; i < v->u.object.length; i++) {
+    if (!strcmp(v->u.object.values[i].name, "rps")) rps = v->u.object.values[i].value;
+    if (!strcmp(v->u.object.values[i].name, "errors")) errors = v->u.object.values[i].value;
+  }
+  if (!rps || rps->type != json_double)
+    die(EXIT_FAILURE, "no request rate in the results of %s\n", mb);
+
+  printf("%-40s %12.0f req/s (%d clients, %ld CPU(s)%s)\n", "max RPS per core (loopback responder)",
+    rps->u.dbl, BENCH_RPS_CLIENTS, cpus, cpus > 1? "": ", shared with the responder");
+  for (i = 0; errors && i < errors->u.object.length; i++)
+    if (errors->u.object.values[i].value->u.integer)
+      warning("%"PRId64" %s errors during the RPS run\n", (int64_t)errors->u.object.values[i].value->u.integer,
+        errors->u.object.values[i].name);
+
+  json_value_free(v);
+  requests_unload(json, json_len);
+}
+
+int main(int argc, char **argv) {
+  const char *mb = argc > 1? argv[1]: "./" PGNAME;
+  request_def d, dt;
+  key_value headers[] = { { "Accept-Encoding", "gzip, deflate" }, { "Cache-Control", "no-cache" }, { NULL, NULL } };
+  thread t = { 0 };
+  connection c = { 0 }, ct = { 0 };
+  aeEventLoop *loop;
+  char *buf, response_length[sizeof(response_headers) + sizeof(response_page) + 16];
+  int sv[2], i;
+
+  printf(PGNAME " %s microbenchmarks\n", MB_VERSION);
+
+  /* HTTP response parsing */
+  snprintf(response_length, sizeof(response_length), response_headers, sizeof(response_page) - 1, response_page);
+  bench_run("http_parser_execute() Content-Length", bench_parser, response_length);
+  bench_run("http_parser_execute() chunked", bench_parser, (void *)response_chunked);
+
+  /* response stats lines */
+  request_def_init(&d);
+  d.host = "www.example.com";
+  d.path = "/index.html";
+  d.port = 80;
+  d.headers = headers;
+  t.stats_buf = malloc(STATS_BUF_LEN);
+  c.t = &t;
+  c.def = &d;
+  c.fd = 42;
+  c.status = 200;
+  c.written = 120;
+  c.read = 850;
+  c.cstats.start = c.cstats.established = time_us();
+  c.cstats.reqs = 2;
+  if (!t.stats_buf || (stats.fd = fopen("/dev/null", "w")) == NULL)
+    die(EXIT_FAILURE, "cannot set up the response stats benchmark\n");
+  cfg.output_format = output_csv;
+  bench_run("write_stats_line() CSV", bench_stats_line, &c);
+  cfg.output_format = output_binary;
+  bench_run("write_stats_line() binary", bench_stats_line, &c);
+  fclose(stats.fd);
+  stats.fd = NULL;
+  free(t.stats_buf);
+
+  /* PRNG request bodies */
+  if ((buf = malloc(BENCH_BUF_LEN)) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory\n");
+  bench_run("mcg64cpy() 16kiB", bench_mcg64cpy, buf);
+  free(buf);
+
+  /* requests */
+  bench_run("http_request_create()", bench_http_request_create, &d);
+  bench_run("request_def_requests_create()", bench_requests_create, &d);
+  dt = d;
+  dt.path = "/item/{{rand:1-1000000}}?s={{seq}}";
+  request_def_requests_create(&dt);
+  ct.def = &dt;
+  tmpl_conn_init(&ct);
+  bench_run("tmpl_render()", bench_tmpl_render, &ct);
+  tmpl_def_free(&dt);
+  free(ct.tmpl_buf);
+  free(dt.request);
+  free(dt.request_cclose);
+
+  /* event loop */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) || (loop = aeCreateEventLoop(sv[1] + 1)) == NULL)
+    die(EXIT_FAILURE, "cannot set up the event loop benchmarks\n");
+  for (i = 0; i < BENCH_TIMERS; i++) aeCreateTimeEvent(loop, 1000000, timer_fired, NULL, NULL);
+  bench_run("aeCreate/DeleteTimeEvent()", bench_ae_timer, loop);
+  bench_run("aeProcessEvents() timer", bench_ae_timer_fire, loop);
+  bench_run("aeCreate/DeleteFileEvent()", bench_ae_file, loop);
+  aeCreateFileEvent(loop, sv[1], AE_WRITABLE, file_ready, NULL);
+  bench_run("aeProcessEvents() writable socket", bench_ae_dispatch, loop);
+  aeDeleteEventLoop(loop);
+  close(sv[0]);
+  close(sv[1]);
+
+  /* everything together */
+  bench_rps(mb);
+
+  return 0;
+}
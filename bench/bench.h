@@ -0,0 +1,17 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>			/* uint64_t */
+
+#define BENCH_NS		200000000	/* run every microbenchmark for at least this long [ns] */
+#define BENCH_OPS_MIN		64		/* operations of the first timed round of a microbenchmark */
+#define BENCH_BUF_LEN		16384		/* bytes of PRNG data generated per mcg64cpy() operation */
+#define BENCH_TIMERS		64		/* time events live at once in the timer churn benchmark */
+#define BENCH_RPS_SECS		"5"		/* duration of the RPS run against the loopback responder [s] */
+#define BENCH_RPS_CLIENTS	64		/* keep-alive connections of the RPS run */
+#define BENCH_RESPONSE		"HTTP/1.1 200 OK\r\nServer: bench\r\nContent-Length: 2\r\n\r\nok"
+
+/* a microbenchmark: perform n operations on arg */
+typedef void bench_fn(void *arg, uint64_t n);
+
+#endif /* BENCH_H */
@@ -46,6 +46,9 @@
 
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
+#ifdef HAVE_IO_URING
+#include "ae_io_uring.c"
+#else
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
@@ -59,6 +62,7 @@
         #endif
     #endif
 #endif
+#endif
 
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
@@ -70,11 +74,16 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
-    eventLoop->timeEventNextId = 0;
+    eventLoop->timeEvents = NULL;
+    eventLoop->timeEventsSize = 0;
+    eventLoop->timeEventFree = -1;
+    eventLoop->timeHeap = NULL;
+    eventLoop->timeHeapLen = 0;
+    eventLoop->timeEventPass = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    eventLoop->stats = NULL;
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
@@ -125,6 +134,8 @@ void aeDeleteEventLoop(aeEventLoop *eventLoop) {
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+    zfree(eventLoop->timeEvents);
+    zfree(eventLoop->timeHeap);
     zfree(eventLoop);
 }
 
@@ -186,59 +197,152 @@ static void aeGetTime(long *seconds, long *milliseconds)
     *milliseconds = tv.tv_usec/1000;
 }
 
-static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms) {
-    long cur_sec, cur_ms, when_sec, when_ms;
+/* Monotonic time in microseconds, for measuring the waits only. */
+static long long aeGetMonotonicUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+#define aeStatAdd(eventLoop, counter, n) \
+    __atomic_store_n(&(eventLoop)->stats->counter, (eventLoop)->stats->counter + (n), __ATOMIC_RELAXED)
+
+static long long aeGetTimeMs(void) {
+    long sec, ms;
+
+    aeGetTime(&sec, &ms);
+    return (long long)sec*1000 + ms;
+}
+
+/* Time events are kept in a binary min-heap of slot indexes ordered by
+ * their expiry time, so that creating, deleting and expiring an event is
+ * O(log(N)) and finding the nearest timer is O(1). */
+static inline int aeTimeHeapLess(aeEventLoop *eventLoop, int a, int b) {
+    return eventLoop->timeEvents[eventLoop->timeHeap[a]].when <
+           eventLoop->timeEvents[eventLoop->timeHeap[b]].when;
+}
+
+static inline void aeTimeHeapSwap(aeEventLoop *eventLoop, int a, int b) {
+    int *heap = eventLoop->timeHeap;
+    int tmp = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    eventLoop->timeEvents[heap[a]].heapIndex = a;
+    eventLoop->timeEvents[heap[b]].heapIndex = b;
+}
+
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int i) {
+    while (i > 0 && aeTimeHeapLess(eventLoop, i, (i-1)/2)) {
+        aeTimeHeapSwap(eventLoop, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int i) {
+    int len = eventLoop->timeHeapLen;
+
+    while (1) {
+        int l = 2*i+1, r = l+1, min = i;
+
+        if (l < len && aeTimeHeapLess(eventLoop, l, min)) min = l;
+        if (r < len && aeTimeHeapLess(eventLoop, r, min)) min = r;
+        if (min == i) return;
+        aeTimeHeapSwap(eventLoop, i, min);
+        i = min;
+    }
+}
 
-    aeGetTime(&cur_sec, &cur_ms);
-    when_sec = cur_sec + milliseconds/1000;
-    when_ms = cur_ms + milliseconds%1000;
-    if (when_ms >= 1000) {
-        when_sec ++;
-        when_ms -= 1000;
+/* Restore the heap property after the expiry time of the event at heap
+ * position i changed. */
+static void aeTimeHeapFix(aeEventLoop *eventLoop, int i) {
+    if (i > 0 && aeTimeHeapLess(eventLoop, i, (i-1)/2))
+        aeTimeHeapUp(eventLoop, i);
+    else
+        aeTimeHeapDown(eventLoop, i);
+}
+
+static int aeTimeEventsGrow(aeEventLoop *eventLoop) {
+    int size = eventLoop->timeEventsSize ? eventLoop->timeEventsSize*2 : 64;
+    aeTimeEvent *slots;
+    int *heap, i;
+
+    if (size > AE_TIME_SLOT_MASK+1) return AE_ERR;
+    if ((slots = zrealloc(eventLoop->timeEvents, sizeof(aeTimeEvent)*size)) == NULL)
+        return AE_ERR;
+    eventLoop->timeEvents = slots;
+    if ((heap = zrealloc(eventLoop->timeHeap, sizeof(int)*size)) == NULL)
+        return AE_ERR;
+    eventLoop->timeHeap = heap;
+
+    for (i = eventLoop->timeEventsSize; i < size; i++) {
+        slots[i].id = i;
+        slots[i].heapIndex = -1;
+        slots[i].nextFree = (i+1 < size) ? i+1 : eventLoop->timeEventFree;
     }
-    *sec = when_sec;
-    *ms = when_ms;
+    eventLoop->timeEventFree = eventLoop->timeEventsSize;
+    eventLoop->timeEventsSize = size;
+    return AE_OK;
+}
+
+/* Return the scheduled time event with the given id or NULL. */
+static aeTimeEvent *aeTimeEventGet(aeEventLoop *eventLoop, long long id) {
+    long long slot = id & AE_TIME_SLOT_MASK;
+    aeTimeEvent *te;
+
+    if (id < 0 || slot >= eventLoop->timeEventsSize) return NULL;
+    te = &eventLoop->timeEvents[slot];
+    if (te->id != id || te->heapIndex == -1) return NULL;
+    return te;
 }
 
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
-    long long id = eventLoop->timeEventNextId++;
     aeTimeEvent *te;
+    int slot;
 
-    te = zmalloc(sizeof(*te));
-    if (te == NULL) return AE_ERR;
-    te->id = id;
-    aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
+    if (eventLoop->timeEventFree == -1 && aeTimeEventsGrow(eventLoop) == AE_ERR)
+        return AE_ERR;
+    slot = eventLoop->timeEventFree;
+    te = &eventLoop->timeEvents[slot];
+    eventLoop->timeEventFree = te->nextFree;
+
+    /* next generation of this slot */
+    te->id = (((te->id >> AE_TIME_SLOT_BITS) + 1) << AE_TIME_SLOT_BITS) | slot;
+    te->when = aeGetTimeMs() + milliseconds;
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
-    return id;
+    te->pass = eventLoop->timeEventPass;
+    te->heapIndex = eventLoop->timeHeapLen;
+    eventLoop->timeHeap[eventLoop->timeHeapLen++] = slot;
+    aeTimeHeapUp(eventLoop, te->heapIndex);
+    return te->id;
 }
 
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
-
-    te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            return AE_OK;
-        }
-        prev = te;
-        te = te->next;
+    aeTimeEvent *te = aeTimeEventGet(eventLoop, id);
+    int i, last, slot;
+
+    if (te == NULL) return AE_ERR; /* NO event with the specified ID found */
+
+    slot = id & AE_TIME_SLOT_MASK;
+    i = te->heapIndex;
+    last = --eventLoop->timeHeapLen;
+    if (i != last) {
+        aeTimeHeapSwap(eventLoop, i, last);
+        aeTimeHeapFix(eventLoop, i);
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    te->heapIndex = -1;
+    te->nextFree = eventLoop->timeEventFree;
+    eventLoop->timeEventFree = slot;
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    return AE_OK;
 }
 
 /* Search the first timer to fire.
@@ -246,33 +350,18 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * This is O(1), the nearest timer is the top of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeHeapLen == 0) return NULL;
+    return &eventLoop->timeEvents[eventLoop->timeHeap[0]];
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te;
-    long long maxId;
+    int processed = 0, i;
     time_t now = time(NULL);
+    unsigned long pass = ++eventLoop->timeEventPass;
 
     /* If the system clock is moved to the future, and then set back to the
      * right value, time events may be delayed in a random way. Often this
@@ -281,56 +370,40 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * Here we try to detect system clock skews, and force all the time
      * events to be processed ASAP when this happens: the idea is that
      * processing events earlier is less dangerous than delaying them
-     * indefinitely, and practice suggests it is. */
+     * indefinitely, and practice suggests it is.  Equal keys keep the
+     * heap property. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+        for (i = 0; i < eventLoop->timeHeapLen; i++)
+            eventLoop->timeEvents[eventLoop->timeHeap[i]].when = 0;
     }
     eventLoop->lastTime = now;
 
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
+    while (eventLoop->timeHeapLen) {
+        aeTimeEvent *te = &eventLoop->timeEvents[eventLoop->timeHeap[0]];
+        long long id, now_ms = aeGetTimeMs();
+        int retval;
 
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
+        /* Don't process events registered or rescheduled by event handlers
+         * of this pass in order to don't loop forever; they are the nearest
+         * timers and will be handled by the next pass ASAP. */
+        if (te->when > now_ms || te->pass == pass) break;
+
+        id = te->id;
+        if (eventLoop->stats) {
+            aeStatAdd(eventLoop, timers, 1);
+            if (now_ms - te->when >= AE_LATE_MS) aeStatAdd(eventLoop, timers_late, 1);
         }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            /* After an event is processed our time event list may
-             * no longer be the same, so we restart from head.
-             * Still we make sure to don't process events registered
-             * by event handlers itself in order to don't loop forever.
-             * To do so we saved the max ID we want to handle.
-             *
-             * FUTURE OPTIMIZATIONS:
-             * Note that this is NOT great algorithmically. Redis uses
-             * a single time event so it's not a problem but the right
-             * way to do this is to add the new elements on head, and
-             * to flag deleted elements in a special way for later
-             * deletion (putting references to the nodes to delete into
-             * another linked list). */
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                aeDeleteTimeEvent(eventLoop, id);
-            }
-            te = eventLoop->timeEventHead;
+        retval = te->timeProc(eventLoop, id, te->clientData);
+        processed++;
+        /* The handler may have created or deleted time events, the slots
+         * may have moved: look the event up again. */
+        if ((te = aeTimeEventGet(eventLoop, id)) == NULL) continue;
+        if (retval != AE_NOMORE) {
+            te->when = aeGetTimeMs() + retval;
+            te->pass = pass;
+            aeTimeHeapFix(eventLoop, te->heapIndex);
         } else {
-            te = te->next;
+            aeDeleteTimeEvent(eventLoop, id);
         }
     }
     return processed;
@@ -369,21 +442,14 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         if (flags & AE_TIME_EVENTS && !(flags & AE_DONT_WAIT))
             shortest = aeSearchNearestTimer(eventLoop);
         if (shortest) {
-            long now_sec, now_ms;
-
             /* Calculate the time missing for the nearest
              * timer to fire. */
-            aeGetTime(&now_sec, &now_ms);
+            long long ms = shortest->when - aeGetTimeMs();
+
+            if (ms < 0) ms = 0;
             tvp = &tv;
-            tvp->tv_sec = shortest->when_sec - now_sec;
-            if (shortest->when_ms < now_ms) {
-                tvp->tv_usec = ((shortest->when_ms+1000) - now_ms)*1000;
-                tvp->tv_sec --;
-            } else {
-                tvp->tv_usec = (shortest->when_ms - now_ms)*1000;
-            }
-            if (tvp->tv_sec < 0) tvp->tv_sec = 0;
-            if (tvp->tv_usec < 0) tvp->tv_usec = 0;
+            tvp->tv_sec = ms/1000;
+            tvp->tv_usec = (ms%1000)*1000;
         } else {
             /* If we have to check for events but need to return
              * ASAP because of AE_DONT_WAIT we need to set the timeout
@@ -397,7 +463,16 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
         }
 
-        numevents = aeApiPoll(eventLoop, tvp);
+        if (eventLoop->stats) {
+            long long start = aeGetMonotonicUs();
+
+            numevents = aeApiPoll(eventLoop, tvp);
+            aeStatAdd(eventLoop, wait_us, aeGetMonotonicUs() - start);
+            aeStatAdd(eventLoop, polls, 1);
+            if (numevents > 0) aeStatAdd(eventLoop, events, numevents);
+        } else {
+            numevents = aeApiPoll(eventLoop, tvp);
+        }
         for (j = 0; j < numevents; j++) {
             aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
             int mask = eventLoop->fired[j].mask;
@@ -463,3 +538,7 @@ char *aeGetApiName(void) {
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+void aeSetStats(aeEventLoop *eventLoop, aeStats *stats) {
+    eventLoop->stats = stats;
+}
@@ -47,6 +47,14 @@
 
 #define AE_NOMORE -1
 
+/* Time event ids are (generation << AE_TIME_SLOT_BITS) | slot, so that ids of
+ * deleted events never match a reused slot. */
+#define AE_TIME_SLOT_BITS 24
+#define AE_TIME_SLOT_MASK ((1LL<<AE_TIME_SLOT_BITS)-1)
+
+/* A time event fired this many milliseconds or more after it was due is late. */
+#define AE_LATE_MS 2
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -69,12 +77,13 @@ typedef struct aeFileEvent {
 /* Time event structure */
 typedef struct aeTimeEvent {
     long long id; /* time event identifier. */
-    long when_sec; /* seconds */
-    long when_ms; /* milliseconds */
+    long long when; /* milliseconds since the Epoch */
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int heapIndex; /* position in the timer heap, -1 if the slot is unused */
+    int nextFree; /* next unused slot if this one is unused */
+    unsigned long pass; /* processTimeEvents() pass that (re)scheduled the event */
 } aeTimeEvent;
 
 /* A fired event */
@@ -83,18 +92,34 @@ typedef struct aeFiredEvent {
     int mask;
 } aeFiredEvent;
 
+/* Counters of an event loop, kept by aeProcessEvents() once set by
+ * aeSetStats().  They are written with relaxed atomic stores, so that other
+ * threads can read them while the loop runs. */
+typedef struct aeStats {
+    unsigned long long polls;       /* calls of the multiplexing layer: wakeups */
+    unsigned long long events;      /* file events returned by them */
+    unsigned long long wait_us;     /* time spent waiting in them [us] */
+    unsigned long long timers;      /* time events fired */
+    unsigned long long timers_late; /* time events fired AE_LATE_MS or more after they were due */
+} aeStats;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
     int maxfd;   /* highest file descriptor currently registered */
     int setsize; /* max number of file descriptors tracked */
-    long long timeEventNextId;
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent *timeEvents; /* Time event slots, indexed by the id's slot */
+    int timeEventsSize; /* number of allocated time event slots */
+    int timeEventFree; /* first unused time event slot, -1 if none */
+    int *timeHeap; /* min-heap of time event slots ordered by when */
+    int timeHeapLen; /* number of scheduled time events */
+    unsigned long timeEventPass; /* number of processTimeEvents() passes */
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
+    aeStats *stats; /* counters to keep, NULL: none */
 } aeEventLoop;
 
 /* Prototypes */
@@ -114,6 +139,7 @@ int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetStats(aeEventLoop *eventLoop, aeStats *stats);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
@@ -0,0 +1,299 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Only readiness is reported, so that the file event handlers keep doing their
+ * own reads and writes.  Every registered fd has a one-shot IORING_OP_POLL_ADD
+ * armed with its current mask.  The kernel checks readiness when a poll is
+ * armed, so re-arming a poll after it fired gives the level-triggered semantics
+ * of the other modules (multishot polls are edge-triggered).
+ *
+ * aeApiAddEvent()/aeApiDelEvent() do not enter the kernel: poll removals are
+ * queued on the submission ring and the fds whose poll needs (re-)arming are put
+ * on a dirty list.  aeApiPoll() arms the dirty fds and submits the whole batch
+ * with the same io_uring_enter(2) call that waits for the completions, i.e. a
+ * single syscall per event loop iteration instead of one epoll_ctl(2) per mask
+ * change.
+ *
+ * Requires Linux 5.11+ (IORING_FEAT_EXT_ARG).  Enabled by building with
+ * IO_URING=y, see the top-level Makefile.
+ */
+
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define AE_URING_ENTRIES 4096           /* submission queue entries */
+#define AE_URING_IGNORE  UINT64_MAX     /* user_data of requests whose completion is ignored */
+
+typedef struct aeApiFdState {
+    uint32_t seq;       /* generation of the last poll request armed for the fd */
+    int armed;          /* mask of the armed poll request, AE_NONE if none */
+    int dirty;          /* the fd is on the dirty list */
+} aeApiFdState;
+
+typedef struct aeApiState {
+    int ringfd;
+    /* submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_tail_local;     /* tail including the not yet published entries */
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    /* completion queue */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* fds */
+    aeApiFdState *fds;
+    int *dirty;                 /* fds that may need their poll (re-)armed */
+    int dirtylen;
+    int setsize;
+} aeApiState;
+
+static int aeUringEnter(aeApiState *state, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    unsigned to_submit;
+
+    __atomic_store_n(state->sq_tail, state->sq_tail_local, __ATOMIC_RELEASE);
+    to_submit = state->sq_tail_local - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+
+    return syscall(__NR_io_uring_enter, state->ringfd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Return a zeroed SQE, submitting the queued ones first if the queue is full; NULL on failure. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (state->sq_tail_local - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE) >= state->sq_entries) {
+        if (aeUringEnter(state, 0, 0, NULL, 0) == -1) return NULL;
+        if (state->sq_tail_local - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE) >= state->sq_entries)
+            return NULL;
+    }
+
+    idx = state->sq_tail_local & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    state->sq_tail_local++;
+
+    return sqe;
+}
+
+static void aeUringPollRemove(aeApiState *state, int fd) {
+    aeApiFdState *fs = &state->fds[fd];
+    struct io_uring_sqe *sqe;
+
+    if (fs->armed == AE_NONE) return;
+    fs->armed = AE_NONE;
+
+    /* If we cannot queue the removal, the completion is still ignored (stale seq). */
+    if ((sqe = aeUringGetSqe(state)) == NULL) return;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((uint64_t)fs->seq << 32) | (uint32_t)fd;
+    sqe->user_data = AE_URING_IGNORE;
+}
+
+static int aeUringPollAdd(aeApiState *state, int fd, int mask) {
+    aeApiFdState *fs = &state->fds[fd];
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = aeUringGetSqe(state)) == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+    sqe->user_data = ((uint64_t)++fs->seq << 32) | (uint32_t)fd;
+    fs->armed = mask;
+
+    return 0;
+}
+
+static void aeUringMarkDirty(aeApiState *state, int fd) {
+    if (state->fds[fd].dirty) return;
+    state->fds[fd].dirty = 1;
+    state->dirty[state->dirtylen++] = fd;
+}
+
+static void aeUringUnmap(aeApiState *state) {
+    if (state->sqes && state->sqes != MAP_FAILED) munmap(state->sqes, state->sqes_size);
+    if (state->cq_ring && state->cq_ring != MAP_FAILED) munmap(state->cq_ring, state->cq_ring_size);
+    if (state->sq_ring && state->sq_ring != MAP_FAILED) munmap(state->sq_ring, state->sq_ring_size);
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+    struct io_uring_params p;
+
+    if (!state) return -1;
+    memset(state, 0, sizeof(*state));
+    state->fds = zmalloc(sizeof(aeApiFdState)*eventLoop->setsize);
+    state->dirty = zmalloc(sizeof(int)*eventLoop->setsize);
+    if (!state->fds || !state->dirty) goto err;
+    memset(state->fds, 0, sizeof(aeApiFdState)*eventLoop->setsize);
+    state->setsize = eventLoop->setsize;
+
+    memset(&p, 0, sizeof(p));
+    state->ringfd = syscall(__NR_io_uring_setup, AE_URING_ENTRIES, &p);
+    if (state->ringfd == -1) goto err;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) goto err_close;
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if (state->sq_ring == MAP_FAILED || state->cq_ring == MAP_FAILED || state->sqes == MAP_FAILED)
+        goto err_unmap;
+
+    state->sq_head = (unsigned *)((char *)state->sq_ring + p.sq_off.head);
+    state->sq_tail = (unsigned *)((char *)state->sq_ring + p.sq_off.tail);
+    state->sq_mask = (unsigned *)((char *)state->sq_ring + p.sq_off.ring_mask);
+    state->sq_array = (unsigned *)((char *)state->sq_ring + p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+    state->sq_tail_local = *state->sq_tail;
+    state->cq_head = (unsigned *)((char *)state->cq_ring + p.cq_off.head);
+    state->cq_tail = (unsigned *)((char *)state->cq_ring + p.cq_off.tail);
+    state->cq_mask = (unsigned *)((char *)state->cq_ring + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)((char *)state->cq_ring + p.cq_off.cqes);
+
+    eventLoop->apidata = state;
+    return 0;
+
+err_unmap:
+    aeUringUnmap(state);
+err_close:
+    close(state->ringfd);
+err:
+    zfree(state->dirty);
+    zfree(state->fds);
+    zfree(state);
+    return -1;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    state->fds = zrealloc(state->fds, sizeof(aeApiFdState)*setsize);
+    state->dirty = zrealloc(state->dirty, sizeof(int)*setsize);
+    if (setsize > state->setsize)
+        memset(state->fds+state->setsize, 0, sizeof(aeApiFdState)*(setsize-state->setsize));
+
+    /* ae.c only shrinks below the highest registered fd + 1 */
+    for (j = 0; j < state->dirtylen; ) {
+        if (state->dirty[j] >= setsize) state->dirty[j] = state->dirty[--state->dirtylen];
+        else j++;
+    }
+    state->setsize = setsize;
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    aeUringUnmap(state);
+    close(state->ringfd);
+    zfree(state->dirty);
+    zfree(state->fds);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    if (state->fds[fd].armed != mask) aeUringPollRemove(state, fd);
+    aeUringMarkDirty(state, fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if (state->fds[fd].armed != mask) aeUringPollRemove(state, fd);
+    if (mask != AE_NONE) aeUringMarkDirty(state, fd);
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned head, tail, wait_nr = 1;
+    int j, numevents = 0;
+
+    /* arm the polls of the fds whose mask changed or whose poll fired */
+    for (j = 0; j < state->dirtylen; j++) {
+        int fd = state->dirty[j];
+        int mask = eventLoop->events[fd].mask;
+
+        if (mask != AE_NONE && state->fds[fd].armed == AE_NONE && aeUringPollAdd(state, fd, mask) == -1)
+            break;  /* out of SQEs even after submitting, retry the rest the next time round */
+        state->fds[fd].dirty = 0;
+    }
+    memmove(state->dirty, state->dirty+j, sizeof(int)*(state->dirtylen-j));
+    state->dirtylen -= j;
+
+    memset(&arg, 0, sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) wait_nr = 0;
+    }
+    if (*state->cq_head != __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)) wait_nr = 0;
+
+    /* ETIME and EINTR are expected, any completions are reaped regardless */
+    aeUringEnter(state, wait_nr, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && numevents < eventLoop->setsize; head++) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        int fd = (int)(uint32_t)cqe->user_data;
+        int armed, mask = 0;
+
+        if (cqe->user_data == AE_URING_IGNORE) continue;
+        if (fd >= state->setsize || state->fds[fd].armed == AE_NONE ||
+            state->fds[fd].seq != (uint32_t)(cqe->user_data >> 32))
+            continue;   /* removed or re-armed since */
+
+        armed = state->fds[fd].armed;
+        state->fds[fd].armed = AE_NONE;
+        aeUringMarkDirty(state, fd);
+
+        if (cqe->res < 0) {
+            /* e.g. EBADF, let the handlers find out */
+            mask = armed;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & (POLLERR|POLLHUP)) mask |= AE_WRITABLE|AE_READABLE;
+            mask &= armed;
+        }
+        if (mask == AE_NONE) continue;
+
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
@@ -39,6 +39,11 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring is opt-in (Linux 5.11+), build with -DHAVE_IO_URING */
+#if defined(HAVE_IO_URING) && !defined(__linux__)
+#undef HAVE_IO_URING
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
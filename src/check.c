@@ -0,0 +1,94 @@
+/*
+ * Response checks ("check" of a request definition).  The body of the sampled 2xx responses is
+ * checked for its length, a substring or a regular expression in its first bytes and its CRC-32C
+ * as it is parsed (on_body), without keeping more than the first "window" bytes of it.  The
+ * responses not sampled only cost a branch; failures are counted as "check" errors.
+ */
+#define _GNU_SOURCE		/* memmem() */
+#include <stdlib.h>		/* malloc(), free() */
+#include <string.h>		/* memcpy(), memmem() */
+
+#include "check.h"
+#include "crc32c.h"		/* crc32c() */
+#include "merr.h"
+#include "stats.h"		/* MIN() */
+
+/* Prepare the checks of request definition d */
+void check_def_init(request_def *d) {
+  char err[BUFSIZ];
+  int rc;
+
+  if (!d->check.enable) return;
+
+  if (d->check.regex_src && (rc = regcomp(&d->check.regex, d->check.regex_src, REG_EXTENDED | REG_NOSUB))) {
+    regerror(rc, &d->check.regex, err, sizeof(err));
+    die(EXIT_FAILURE, "invalid check.regex `%s': %s\n", d->check.regex_src, err);
+  }
+  if (d->check.crc) crc32c_init();
+}
+
+void check_def_free(request_def *d) {
+  if (d->check.regex_src) {
+    if (d->check.enable) regfree(&d->check.regex);
+    free(d->check.regex_src);
+  }
+  free(d->check.contains);
+}
+
+/* Allocate the buffer of connection c for the start of the bodies if its checks search them */
+void check_conn_init(connection *c) {
+  const request_def *d = c->def;
+
+  if (!d->check.enable || (!d->check.contains && !d->check.regex_src)) return;
+
+  if ((c->check.head = malloc(d->check.window)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for response checks\n");
+}
+
+int check_message_begin(http_parser *parser) {
+  connection *c = parser->data;
+
+  if (!c->def->check.enable) return 0;
+
+  c->check.on = c->check.n++ % c->def->check.sample == 0;
+  c->check.len = 0;
+  c->check.crc = 0;
+  c->check.head_len = 0;
+
+  return 0;
+}
+
+int check_body(http_parser *parser, const char *at, size_t len) {
+  connection *c = parser->data;
+  const request_def *d = c->def;
+  size_t n;
+
+  if (!c->check.on) return 0;
+
+  c->check.len += len;
+  if (d->check.crc) c->check.crc = crc32c(c->check.crc, at, len);
+  if (c->check.head && c->check.head_len < d->check.window) {
+    n = MIN(len, d->check.window - c->check.head_len);
+    memcpy(c->check.head + c->check.head_len, at, n);
+    c->check.head_len += n;
+  }
+
+  return 0;
+}
+
+/* Return whether the complete response of connection c passed the checks, true if it was not checked */
+bool check_response(connection *c) {
+  const request_def *d = c->def;
+  regmatch_t m = { .rm_so = 0, .rm_eo = c->check.head_len };
+
+  if (!c->check.on || c->status / 100 != 2) return true;
+  c->check.on = false;
+
+  if (d->check.length >= 0 && c->check.len != (uint64_t)d->check.length) return false;
+  if (d->check.crc && c->check.crc != d->check.crc32c) return false;
+  if (d->check.contains && !memmem(c->check.head, c->check.head_len, d->check.contains, strlen(d->check.contains)))
+    return false;
+  if (d->check.regex_src && regexec(&d->check.regex, c->check.head, 1, &m, REG_STARTEND)) return false;
+
+  return true;
+}
@@ -0,0 +1,20 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdbool.h>			/* bool */
+
+#include "../nginx/http_parser.h"	/* http_parser */
+#include "net.h"			/* request_def, connection */
+
+#define CHECK_WINDOW		4096		/* default number of bytes at the start of a body searched by "contains"/"regex" */
+#define CHECK_WINDOW_MAX	(1UL<<20)	/* maximum of "window" */
+
+/* Module functions */
+extern void check_def_init(request_def *);
+extern void check_def_free(request_def *);
+extern void check_conn_init(connection *);
+extern int check_message_begin(http_parser *);
+extern int check_body(http_parser *, const char *, size_t);
+extern bool check_response(connection *);
+
+#endif /* CHECK_H */
@@ -0,0 +1,104 @@
+/*
+ * Connect scheduler.  With --connect-rate, every worker thread paces its new connections, the
+ * initial connects as well as the reconnects, through a token bucket filled at its share of the
+ * rate.  A connection finding no token joins the thread's FIFO of waiting connections; a time
+ * event releases them as tokens become available.  With --connect-ramp, the rate rises from zero
+ * to its full value over the ramp time since the start of the test, linearly or in equal steps.
+ */
+#include <errno.h>		/* errno */
+#include <math.h>		/* floor() */
+#include <string.h>		/* strerror() */
+
+#include "cps.h"
+#include "mb.h"			/* cfg, stats, time_us() */
+#include "merr.h"
+
+/* Return the fraction of the full connect rate in force at time now [us]. */
+static inline double cps_ramp(uint64_t now) {
+  double e;
+
+  if (!cfg.connect_ramp || now >= stats.start + cfg.connect_ramp) return 1;
+
+  e = (double)(now > stats.start? now - stats.start: 0) / cfg.connect_ramp;
+  return cfg.connect_steps? floor(e * cfg.connect_steps + 1) / cfg.connect_steps: e;
+}
+
+/* Add the tokens earned since the last refill of thread t; return the current rate [connections/us]. */
+static double cps_refill(thread *t, uint64_t now) {
+  double rate = t->cps.rate * cps_ramp(now), burst;
+
+  if (now > t->cps.last) {
+    t->cps.tokens += t->cps.rate * cps_ramp(t->cps.last + (now - t->cps.last) / 2) * (now - t->cps.last);
+    t->cps.last = now;
+  }
+  if (!t->cps.head) {
+    /* an idle bucket fills up to a burst; connections still waiting are owed what they missed */
+    burst = rate * CPS_BURST_US;
+    if (burst < 1) burst = 1;
+    if (t->cps.tokens > burst) t->cps.tokens = burst;
+  }
+
+  return rate;
+}
+
+/* Time event: connect the waiting connections of thread data we have tokens for. */
+static int cps_release(aeEventLoop *loop, long long id, void *data) {
+  thread *t = data;
+  connection *c;
+  double rate = cps_refill(t, time_us()), wait;
+
+  while ((c = t->cps.head) && t->cps.tokens >= 1) {
+    t->cps.tokens -= 1;
+    if ((t->cps.head = c->cps_next) == NULL) t->cps.tail = NULL;
+    c->cps_next = NULL;
+    socket_connect_now(c);
+  }
+
+  if (!t->cps.head) {
+    t->cps.timer_id = 0;
+    return AE_NOMORE;
+  }
+
+  /* until the next token */
+  wait = rate > 0? (1 - t->cps.tokens) / rate / 1000: CPS_WAIT_MAX_MS;
+  return wait < 1? 1: wait > CPS_WAIT_MAX_MS? CPS_WAIT_MAX_MS: (int)wait;
+}
+
+/* Set up the connect scheduler of thread t; its share of the rate is an equal one. */
+void cps_thread_init(thread *t) {
+  t->cps.rate = cfg.connect_rate / cfg.threads / 1000000;
+  t->cps.tokens = cfg.connect_ramp? 0: 1;	/* without a ramp, the first connect goes right away */
+  t->cps.last = time_us();
+  t->cps.head = t->cps.tail = NULL;
+  t->cps.timer_id = 0;
+}
+
+/* Return true if connection c may connect now, otherwise queue it until a token is available. */
+bool cps_admit(connection *c) {
+  thread *t = c->t;
+
+  if (!cfg.connect_rate) return true;
+
+  /* first come, first served */
+  if (!t->cps.head) {
+    cps_refill(t, time_us());
+    if (t->cps.tokens >= 1) {
+      t->cps.tokens -= 1;
+      return true;
+    }
+  }
+
+  c->cps_next = NULL;
+  if (t->cps.tail) t->cps.tail->cps_next = c;
+  else t->cps.head = c;
+  t->cps.tail = c;
+
+  if (!t->cps.timer_id) {
+    t->cps.timer_id = aeCreateTimeEvent(t->loop, 1, cps_release, t, NULL);
+    if (t->cps.timer_id == AE_ERR) {
+      die(EXIT_FAILURE, "cannot create time event (connect rate): %s (%d)\n", strerror(errno), errno);
+    }
+  }
+
+  return false;
+}
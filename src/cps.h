@@ -0,0 +1,15 @@
+#ifndef CPS_H
+#define CPS_H
+
+#include <stdbool.h>			/* bool */
+
+#include "net.h"			/* thread, connection */
+
+#define CPS_BURST_US		10000		/* size of the token bucket: connects allowed in this many [us] at the current rate */
+#define CPS_WAIT_MAX_MS		10		/* longest wait [ms] before the rate is looked at again (ramps) */
+
+/* Module functions */
+extern void cps_thread_init(thread *);
+extern bool cps_admit(connection *);
+
+#endif /* CPS_H */
@@ -0,0 +1,73 @@
+/*
+ * CRC-32C (Castagnoli), computed incrementally: crc32c(crc32c(0, a, n), b, m) is the checksum of
+ * a followed by b.  The SSE4.2 crc32 instruction is used where available, a slicing-by-8 table
+ * otherwise.  crc32c_init() must be called before any other thread uses crc32c().
+ */
+#include <string.h>		/* memcpy() */
+
+#include "crc32c.h"
+
+static uint32_t table[8][256];
+static uint32_t (*crc32c_fn)(uint32_t, const unsigned char *, size_t);
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+  uint64_t w;
+
+  for (; len && ((uintptr_t)p & 7); len--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    w ^= crc;		/* little-endian */
+    crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^ table[5][(w >> 16) & 0xff] ^
+          table[4][(w >> 24) & 0xff] ^ table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+          table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+  }
+  for (; len; len--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+  uint64_t c = crc, w;
+
+  for (; len && ((uintptr_t)p & 7); len--)
+    c = __builtin_ia32_crc32qi(c, *p++);
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    c = __builtin_ia32_crc32di(c, w);
+  }
+  for (; len; len--)
+    c = __builtin_ia32_crc32qi(c, *p++);
+
+  return c;
+}
+#endif
+
+void crc32c_init() {
+  uint32_t crc;
+  int i, j;
+
+  if (crc32c_fn) return;
+
+  for (i = 0; i < 256; i++) {
+    for (crc = i, j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (crc & 1? CRC32C_POLY: 0);
+    table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      table[j][i] = table[0][table[j - 1][i] & 0xff] ^ (table[j - 1][i] >> 8);
+
+  crc32c_fn = crc32c_sw;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) crc32c_fn = crc32c_hw;
+#endif
+}
+
+/* Return the CRC-32C of the len bytes at buf following data of the CRC-32C crc (0 initially) */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+  return ~crc32c_fn(~crc, buf, len);
+}
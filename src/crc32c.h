@@ -0,0 +1,13 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>		/* uint32_t */
+
+#define CRC32C_POLY		0x82f63b78	/* Castagnoli polynomial, reversed */
+
+/* Module functions */
+extern void crc32c_init();
+extern uint32_t crc32c(uint32_t, const void *, size_t);
+
+#endif /* CRC32C_H */
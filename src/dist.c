@@ -0,0 +1,564 @@
+/*
+ * Distributed mode: a coordinator (--agents) sends the input request file and the test
+ * parameters to the agents (--agent), synchronizes their clocks, starts them all at once and
+ * merges their results into one report.  An agent only runs the tests of coordinators that
+ * share its secret (--secret).
+ *
+ * Messages are a 4-byte tag, a little-endian 32-bit payload length and the payload:
+ *   coordinator -> agent: "AUTH" (secret), "JOB " (test run), "PING" (clock sample), "STRT" (start time)
+ *   agent -> coordinator: "REDY" (set up), "TIME" (clock sample), "SUMM" (results)
+ */
+#include <errno.h>		/* errno */
+#include <inttypes.h>		/* PRIu64 */
+#include <netdb.h>		/* getaddrinfo() */
+#include <netinet/in.h>		/* IPPROTO_TCP */
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <stdio.h>		/* fopen(), fread() */
+#include <stdlib.h>		/* malloc(), free() */
+#include <string.h>		/* memcpy(), strerror() */
+#include <sys/socket.h>		/* socket(), send(), recv() */
+#include <sys/wait.h>		/* waitpid() */
+#include <time.h>		/* nanosleep() */
+#include <unistd.h>		/* fork(), close() */
+
+#include "dist.h"
+#include "merr.h"
+#include "net.h"		/* header_field() */
+#include "stats.h"		/* put_le64(), get_le64(), MIN/MAX() */
+
+#define DIST_HDR_LEN	8
+#define DIST_JOB_LEN	(DIST_MAGIC_LEN + 8 + 8 + 1 + 1 + 4 + 4 + 8)
+#define DIST_HIST_LEN	(3 * 8 + 4 + HIST_BUCKETS * (4 + 8))
+#define DIST_SELF_LEN	(13 * 8 + 2 * 4)
+#define DIST_SUMM_LEN	(10 * 8 + 3 * DIST_HIST_LEN + DIST_SELF_LEN)
+
+/* an agent as seen by the coordinator */
+typedef struct {
+  char *name;			/* host:port */
+  int fd;			/* connection to the agent */
+  int64_t offset;		/* agent's clock - our clock [us] */
+  uint64_t rtt;			/* round-trip time of the clock sample offset is based on [us] */
+  bool done;			/* results received */
+  summary s;			/* results of the agent */
+} dist_peer;
+
+static char *dist_key;		/* the shared secret (see dist_secret_read()) */
+static size_t dist_key_len;
+
+/* Read the shared secret of the coordinator and the agents from cfg.secret, trailing newlines stripped */
+static void dist_secret_read() {
+  FILE *fd;
+
+  if ((dist_key = malloc(DIST_SECRET_MAX + 1)) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory for the secret\n");
+  if ((fd = fopen(cfg.secret, "r")) == NULL)
+    die(EXIT_FAILURE, "cannot open secret file `%s': %s (%d)\n", cfg.secret, strerror(errno), errno);
+  dist_key_len = fread(dist_key, 1, DIST_SECRET_MAX + 1, fd);
+  fclose(fd);
+  while (dist_key_len && (dist_key[dist_key_len - 1] == '\n' || dist_key[dist_key_len - 1] == '\r')) dist_key_len--;
+  if (!dist_key_len || dist_key_len > DIST_SECRET_MAX)
+    die(EXIT_FAILURE, "secret file `%s': 1 to %d bytes expected\n", cfg.secret, DIST_SECRET_MAX);
+}
+
+/* Compare secret of len bytes to ours in constant time */
+static bool dist_secret_ok(const char *secret, size_t len) {
+  unsigned char diff = len != dist_key_len;
+  size_t i;
+
+  for (i = 0; i < len && i < dist_key_len; i++) diff |= secret[i] ^ dist_key[i];
+
+  return !diff;
+}
+
+static int dist_write(int fd, const char *buf, size_t len) {
+  ssize_t n;
+
+  while (len) {
+    if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int dist_read(int fd, char *buf, size_t len) {
+  ssize_t n;
+
+  while (len) {
+    if ((n = recv(fd, buf, len, 0)) <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      if (n == 0) errno = ECONNRESET;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int dist_send(int fd, const char *tag, const char *buf, size_t len) {
+  char hdr[DIST_HDR_LEN];
+
+  memcpy(hdr, tag, 4);
+  put_le32(hdr + 4, len);
+
+  return (dist_write(fd, hdr, DIST_HDR_LEN) || (len && dist_write(fd, buf, len)))? -1: 0;
+}
+
+/* Receive a message; its tag is stored in tag[4] and its newly allocated payload (if any) in *buf */
+static int dist_recv(int fd, char *tag, char **buf, size_t *len) {
+  char hdr[DIST_HDR_LEN];
+
+  *buf = NULL;
+  if (dist_read(fd, hdr, DIST_HDR_LEN)) return -1;
+  memcpy(tag, hdr, 4);
+  if ((*len = get_le32(hdr + 4)) > DIST_MSG_MAX) {
+    errno = EPROTO;
+    return -1;
+  }
+  if (!*len) return 0;
+
+  if ((*buf = malloc(*len + 1)) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory for a message\n");
+  if (dist_read(fd, *buf, *len)) {
+    free(*buf); *buf = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static char *dist_hist_put(char *p, const hist *h) {
+  char *n_ptr;
+  uint32_t i, n = 0;
+
+  p = put_le64(p, h->count);
+  p = put_le64(p, h->min);
+  p = put_le64(p, h->max);
+  n_ptr = p; p += 4;
+  /* only the buckets in use */
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if (!h->counts[i]) continue;
+    p = put_le32(p, i);
+    p = put_le64(p, h->counts[i]);
+    n++;
+  }
+  put_le32(n_ptr, n);
+
+  return p;
+}
+
+static const char *dist_hist_get(const char *p, const char *end, hist *h) {
+  uint32_t i, n;
+
+  hist_init(h);
+  if (end - p < 3 * 8 + 4) return NULL;
+  h->count = get_le64(p);
+  h->min = get_le64(p + 8);
+  h->max = get_le64(p + 16);
+  n = get_le32(p + 24);
+  p += 3 * 8 + 4;
+  if (n > HIST_BUCKETS || end - p < (ptrdiff_t)n * 12) return NULL;
+  for (; n; n--, p += 12) {
+    if ((i = get_le32(p)) >= HIST_BUCKETS) return NULL;
+    h->counts[i] = get_le64(p + 4);
+  }
+
+  return p;
+}
+
+static size_t dist_summary_put(char *buf, const summary *s) {
+  char *p = buf;
+
+  p = put_le64(p, s->duration);
+  p = put_le64(p, s->reqs);
+  p = put_le64(p, s->sent);
+  p = put_le64(p, s->recv);
+  p = put_le64(p, s->err_conn);
+  p = put_le64(p, s->err_status);
+  p = put_le64(p, s->err_parser);
+  p = put_le64(p, s->err_check);
+  p = put_le64(p, s->tls_full);
+  p = put_le64(p, s->tls_resumed);
+  p = dist_hist_put(p, &s->latency);
+  p = dist_hist_put(p, &s->tls_handshake);
+  p = dist_hist_put(p, &s->kernel_latency);
+  p = put_le64(p, s->self.loop.polls);
+  p = put_le64(p, s->self.loop.events);
+  p = put_le64(p, s->self.loop.wait_us);
+  p = put_le64(p, s->self.loop.timers);
+  p = put_le64(p, s->self.loop.timers_late);
+  p = put_le64(p, s->self.reads);
+  p = put_le64(p, s->self.reads_eagain);
+  p = put_le64(p, s->self.writes);
+  p = put_le64(p, s->self.writes_eagain);
+  p = put_le64(p, s->self.lag_n);
+  p = put_le64(p, s->self.lag_sum);
+  p = put_le64(p, s->self.lag_max);
+  p = put_le64(p, s->self_loop_us);
+  p = put_le32(p, s->self_busy_max * 1000);	/* [%] to 3 decimals */
+  p = put_le32(p, s->self_busy_thread);
+
+  return p - buf;
+}
+
+static int dist_summary_get(const char *p, size_t len, summary *s) {
+  const char *end = p + len;
+
+  if (len < 10 * 8) return -1;
+  s->duration = get_le64(p);
+  s->reqs = get_le64(p + 8);
+  s->sent = get_le64(p + 16);
+  s->recv = get_le64(p + 24);
+  s->err_conn = get_le64(p + 32);
+  s->err_status = get_le64(p + 40);
+  s->err_parser = get_le64(p + 48);
+  s->err_check = get_le64(p + 56);
+  s->tls_full = get_le64(p + 64);
+  s->tls_resumed = get_le64(p + 72);
+  p += 10 * 8;
+  if ((p = dist_hist_get(p, end, &s->latency)) == NULL || (p = dist_hist_get(p, end, &s->tls_handshake)) == NULL ||
+      (p = dist_hist_get(p, end, &s->kernel_latency)) == NULL)
+    return -1;
+  if (end - p < DIST_SELF_LEN) return -1;
+  s->self.loop.polls = get_le64(p);
+  s->self.loop.events = get_le64(p + 8);
+  s->self.loop.wait_us = get_le64(p + 16);
+  s->self.loop.timers = get_le64(p + 24);
+  s->self.loop.timers_late = get_le64(p + 32);
+  s->self.reads = get_le64(p + 40);
+  s->self.reads_eagain = get_le64(p + 48);
+  s->self.writes = get_le64(p + 56);
+  s->self.writes_eagain = get_le64(p + 64);
+  s->self.lag_n = get_le64(p + 72);
+  s->self.lag_sum = get_le64(p + 80);
+  s->self.lag_max = get_le64(p + 88);
+  s->self_loop_us = get_le64(p + 96);
+  s->self_busy_max = get_le32(p + 104) / 1000.0;
+  s->self_busy_thread = get_le32(p + 108);
+
+  return 0;
+}
+
+static void summary_merge(summary *dst, const summary *src) {
+  /* the agents run concurrently */
+  dst->duration = MAX(dst->duration, src->duration);
+  dst->reqs += src->reqs;
+  dst->sent += src->sent;
+  dst->recv += src->recv;
+  dst->err_conn += src->err_conn;
+  dst->err_status += src->err_status;
+  dst->err_parser += src->err_parser;
+  dst->err_check += src->err_check;
+  dst->tls_full += src->tls_full;
+  dst->tls_resumed += src->tls_resumed;
+  hist_merge(&dst->latency, &src->latency);
+  hist_merge(&dst->tls_handshake, &src->tls_handshake);
+  hist_merge(&dst->kernel_latency, &src->kernel_latency);
+  dst->self.loop.polls += src->self.loop.polls;
+  dst->self.loop.events += src->self.loop.events;
+  dst->self.loop.wait_us += src->self.loop.wait_us;
+  dst->self.loop.timers += src->self.loop.timers;
+  dst->self.loop.timers_late += src->self.loop.timers_late;
+  dst->self.reads += src->self.reads;
+  dst->self.reads_eagain += src->self.reads_eagain;
+  dst->self.writes += src->self.writes;
+  dst->self.writes_eagain += src->self.writes_eagain;
+  dst->self.lag_n += src->self.lag_n;
+  dst->self.lag_sum += src->self.lag_sum;
+  dst->self.lag_max = MAX(dst->self.lag_max, src->self.lag_max);
+  dst->self_loop_us += src->self_loop_us;
+  if (src->self_busy_max > dst->self_busy_max) {
+    /* the busiest thread of any agent */
+    dst->self_busy_max = src->self_busy_max;
+    dst->self_busy_thread = src->self_busy_thread;
+  }
+}
+
+/* The connection to the coordinator failed: no results to report, just give up */
+static void dist_agent_die(const char *what) {
+  int err = errno;
+
+  close(cfg.agent_fd);
+  cfg.agent_fd = -1;
+  die(EXIT_FAILURE, "agent: %s: %s (%d)\n", what, strerror(err), err);
+}
+
+/* Receive a test run from the coordinator on cfg.agent_fd; return the input request file data */
+static char *dist_agent_job(size_t *len) {
+  char tag[4], *buf;
+  size_t n;
+
+  /* nothing of a coordinator without our secret is looked at */
+  if (dist_recv(cfg.agent_fd, tag, &buf, &n)) dist_agent_die("cannot receive the secret");
+  if (memcmp(tag, "AUTH", 4) || !dist_secret_ok(buf, n)) {
+    errno = EACCES;
+    dist_agent_die("not a coordinator sharing our secret");
+  }
+  free(buf);
+
+  if (dist_recv(cfg.agent_fd, tag, &buf, &n)) dist_agent_die("cannot receive the test run");
+  if (memcmp(tag, "JOB ", 4) || n < DIST_JOB_LEN || memcmp(buf, DIST_MAGIC, DIST_MAGIC_LEN)) {
+    errno = EPROTO;
+    dist_agent_die("not a test run of a compatible coordinator");
+  }
+
+  cfg.duration = get_le64(buf + DIST_MAGIC_LEN);
+  cfg.ramp_up = get_le64(buf + DIST_MAGIC_LEN + 8);
+  cfg.cookies = buf[DIST_MAGIC_LEN + 16];
+  cfg.ssl_version = buf[DIST_MAGIC_LEN + 17];
+  cfg.shard_id = get_le32(buf + DIST_MAGIC_LEN + 18);
+  cfg.shards = get_le32(buf + DIST_MAGIC_LEN + 22);
+  cfg.dns_ttl = get_le64(buf + DIST_MAGIC_LEN + 26);
+  if (!cfg.duration || cfg.ramp_up >= cfg.duration || (cfg.shards && cfg.shard_id >= cfg.shards)) {
+    errno = EINVAL;
+    dist_agent_die("invalid test run");
+  }
+  if (cfg.cookies) parser_settings.on_header_field = header_field;
+
+  *len = n - DIST_JOB_LEN;
+  memmove(buf, buf + DIST_JOB_LEN, *len);
+
+  return buf;
+}
+
+/*
+ * Accept test runs from coordinators on listen_on ([host:]port), one at a time, forever.  Every
+ * run forks a child; only the child returns, with the coordinator's test parameters in cfg and
+ * the input request file data of *len bytes.
+ */
+char *dist_agent(const char *listen_on, size_t *len) {
+  struct sockaddr_storage peer;
+  socklen_t peer_len;
+  char peer_host[NI_MAXHOST];
+  int lfd, fd, status, on = 1;
+  pid_t pid;
+
+  dist_secret_read();
+  /* loopback unless told otherwise, the test runs of a coordinator are arbitrary traffic */
+  if ((lfd = socket_listen(listen_on, false)) < 0)
+    die(EXIT_FAILURE, "agent: cannot listen on %s\n", listen_on);
+  info("agent: waiting for test runs on %s\n", listen_on);
+
+  for (;;) {
+    peer_len = sizeof(peer);
+    if ((fd = accept(lfd, (struct sockaddr *)&peer, &peer_len)) < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      die(EXIT_FAILURE, "agent: accept(): %s (%d)\n", strerror(errno), errno);
+    }
+    if (getnameinfo((struct sockaddr *)&peer, peer_len, peer_host, sizeof(peer_host), NULL, 0, NI_NUMERICHOST))
+      strcpy(peer_host, "?");
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if ((pid = fork()) == 0) {
+      close(lfd);
+      cfg.agent_fd = fd;
+      return dist_agent_job(len);
+    }
+    close(fd);
+    if (pid < 0) {
+      error("agent: fork(): %s (%d)\n", strerror(errno), errno);
+      continue;
+    }
+
+    /* one test run at a time, they would skew each other's results */
+    info("agent: test run from %s\n", peer_host);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+      warning("agent: test run from %s failed\n", peer_host);
+  }
+}
+
+/* Tell the coordinator we are set up, answer its clock samples and sleep until the start time it sends */
+void dist_agent_start() {
+  char tag[4], *buf, now_le[8];
+  size_t n;
+  uint64_t start = 0, now;
+  struct timespec ts;
+
+  if (dist_send(cfg.agent_fd, "REDY", NULL, 0)) dist_agent_die("cannot report being ready");
+
+  while (!start) {
+    if (dist_recv(cfg.agent_fd, tag, &buf, &n)) dist_agent_die("cannot receive the start time");
+    if (!memcmp(tag, "PING", 4)) {
+      put_le64(now_le, time_us());
+      if (dist_send(cfg.agent_fd, "TIME", now_le, 8)) dist_agent_die("cannot send a clock sample");
+    } else if (!memcmp(tag, "STRT", 4) && n == 8) {
+      start = get_le64(buf);
+    } else {
+      errno = EPROTO;
+      dist_agent_die("unexpected message");
+    }
+    free(buf);
+  }
+
+  if ((now = time_us()) < start) {
+    ts.tv_sec = (start - now) / 1000000;
+    ts.tv_nsec = (start - now) % 1000000 * 1000;
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+  } else {
+    warning("agent: start time passed %"PRIu64"us ago\n", now - start);
+  }
+}
+
+/* Send the results of the test run to the coordinator */
+void dist_agent_report(const summary *s) {
+  char *buf;
+
+  if ((buf = malloc(DIST_SUMM_LEN)) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory for the results\n");
+  if (dist_send(cfg.agent_fd, "SUMM", buf, dist_summary_put(buf, s)))
+    error("agent: cannot send the results: %s (%d)\n", strerror(errno), errno);
+  free(buf);
+  close(cfg.agent_fd);
+  cfg.agent_fd = -1;
+}
+
+static int dist_connect(const char *name) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addr, *a;
+  char *host, *port;
+  int fd = -1, r, on = 1;
+
+  addr_parse(name, &host, &port);
+  if (!host || (r = getaddrinfo(host, port, &hints, &addr)))
+    die(EXIT_FAILURE, "cannot resolve agent %s: %s\n", name, host? gai_strerror(r): "host:port expected");
+  for (a = addr; a; a = a->ai_next) {
+    if ((fd = socket(a->ai_family, SOCK_STREAM, 0)) < 0) continue;
+    if (!connect(fd, a->ai_addr, a->ai_addrlen)) break;
+    close(fd); fd = -1;
+  }
+  if (fd < 0) die(EXIT_FAILURE, "cannot connect to agent %s: %s (%d)\n", name, strerror(errno), errno);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  freeaddrinfo(addr);
+  free(host); free(port);
+
+  return fd;
+}
+
+/* Estimate the clock offset of agent p from the clock sample with the lowest round-trip time */
+static int dist_clock_sync(dist_peer *p) {
+  char tag[4], *buf;
+  size_t n;
+  uint64_t t1, t3, agent;
+  int i;
+
+  p->rtt = UINT64_MAX;
+  for (i = 0; i < DIST_SYNC_PINGS; i++) {
+    t1 = time_us();
+    if (dist_send(p->fd, "PING", NULL, 0) || dist_recv(p->fd, tag, &buf, &n)) return -1;
+    t3 = time_us();
+    if (memcmp(tag, "TIME", 4) || n != 8) {
+      free(buf);
+      errno = EPROTO;
+      return -1;
+    }
+    agent = get_le64(buf);
+    free(buf);
+    if (t3 - t1 < p->rtt) {
+      /* the agent took its sample half-way through the round trip */
+      p->rtt = t3 - t1;
+      p->offset = (int64_t)(agent - (t1 + p->rtt / 2));
+    }
+  }
+
+  return 0;
+}
+
+/* Run the test of input request file file_req on the agents of the comma-separated list agents */
+void dist_coordinator(const char *agents, const char *file_req) {
+  dist_peer *peers = NULL;
+  summary total;
+  char *list, *name, *save, *json, *job, tag[4], *buf, start_le[8];
+  size_t json_len, n;
+  uint64_t start;
+  struct timeval tv = { .tv_sec = cfg.duration + DIST_TIMEOUT };
+  int i, peers_n = 0, done = 0;
+
+  if ((list = strdup(agents)) == NULL) die(EXIT_FAILURE, "strdup(): cannot allocate memory\n");
+  for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+    if ((peers = realloc(peers, (peers_n + 1) * sizeof(dist_peer))) == NULL)
+      die(EXIT_FAILURE, "realloc(): cannot allocate memory for agents\n");
+    memset(&peers[peers_n], 0, sizeof(dist_peer));
+    peers[peers_n].name = name;
+    peers[peers_n++].fd = -1;
+  }
+  if (!peers_n) die(EXIT_FAILURE, "agents: no agents specified\n");
+
+  dist_secret_read();
+
+  /* the agents set up the whole test run (parse the request file, resolve the targets, fill the random bodies) before the synchronized start */
+  json = requests_load(file_req, &json_len);
+  if ((job = malloc(DIST_JOB_LEN + json_len)) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory for the test run\n");
+  memcpy(job, DIST_MAGIC, DIST_MAGIC_LEN);
+  put_le64(job + DIST_MAGIC_LEN, cfg.duration);
+  put_le64(job + DIST_MAGIC_LEN + 8, cfg.ramp_up);
+  job[DIST_MAGIC_LEN + 16] = cfg.cookies;
+  job[DIST_MAGIC_LEN + 17] = cfg.ssl_version;
+  put_le32(job + DIST_MAGIC_LEN + 22, cfg.shard? peers_n: 0);
+  put_le64(job + DIST_MAGIC_LEN + 26, cfg.dns_ttl);
+  memcpy(job + DIST_JOB_LEN, json, json_len);
+  for (i = 0; i < peers_n; i++) {
+    peers[i].fd = dist_connect(peers[i].name);
+    put_le32(job + DIST_MAGIC_LEN + 18, i);
+    if (dist_send(peers[i].fd, "AUTH", dist_key, dist_key_len) ||
+        dist_send(peers[i].fd, "JOB ", job, DIST_JOB_LEN + json_len))
+      die(EXIT_FAILURE, "cannot send the test run to agent %s: %s (%d)\n", peers[i].name, strerror(errno), errno);
+  }
+  free(job);
+  requests_unload(json, json_len);
+
+  for (i = 0; i < peers_n; i++) {
+    if (dist_recv(peers[i].fd, tag, &buf, &n) || memcmp(tag, "REDY", 4))
+      die(EXIT_FAILURE, "agent %s failed to set up the test run\n", peers[i].name);
+    free(buf);
+  }
+
+  for (i = 0; i < peers_n; i++)
+    if (dist_clock_sync(&peers[i]))
+      die(EXIT_FAILURE, "cannot synchronize the clock of agent %s: %s (%d)\n", peers[i].name, strerror(errno), errno);
+
+  start = time_us() + DIST_START_LEAD;
+  for (i = 0; i < peers_n; i++) {
+    put_le64(start_le, start + peers[i].offset);
+    if (dist_send(peers[i].fd, "STRT", start_le, 8))
+      die(EXIT_FAILURE, "cannot start agent %s: %s (%d)\n", peers[i].name, strerror(errno), errno);
+    setsockopt(peers[i].fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  info("started %d agents\n", peers_n);
+
+  memset(&total, 0, sizeof(total));
+  hist_init(&total.latency);
+  hist_init(&total.tls_handshake);
+  hist_init(&total.kernel_latency);
+  for (i = 0; i < peers_n; i++) {
+    dist_peer *p = &peers[i];
+
+    if (dist_recv(p->fd, tag, &buf, &n) || memcmp(tag, "SUMM", 4) || dist_summary_get(buf, n, &p->s)) {
+      error("no results from agent %s\n", p->name);
+    } else {
+      p->done = true;
+      done++;
+      summary_merge(&total, &p->s);
+      fprintf(stdout, "Agent %s: hits %"PRIu64", %0.2Lf/s, errors %"PRIu64", clock offset %"PRId64"us (RTT %"PRIu64"us)\n",
+        p->name, p->s.reqs, (long double)p->s.reqs*1000000/MAX(p->s.duration, 1),
+        p->s.err_conn + p->s.err_status + p->s.err_parser + p->s.err_check, p->offset, p->rtt);
+    }
+    free(buf);
+    close(p->fd);
+  }
+
+  fprintf(stdout, "Agents: %d/%d\n", done, peers_n);
+  if (done) {
+    summary_print(&total);
+    kernel_latency_print(&total);
+    self_print(&total);
+  }
+
+  free(peers);
+  free(list);
+  free(dist_key);
+  if (done < peers_n) exit(EXIT_FAILURE);
+}
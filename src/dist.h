@@ -0,0 +1,22 @@
+#ifndef DIST_H
+#define DIST_H
+
+#include <stddef.h>		/* size_t */
+
+#include "mb.h"			/* summary */
+
+#define DIST_MAGIC		"MBDIST03"	/* protocol magic and version, the first bytes of a test run */
+#define DIST_MAGIC_LEN		8
+#define DIST_MSG_MAX		(1UL<<26)	/* maximum message payload: 64MB */
+#define DIST_SYNC_PINGS		8		/* clock offset samples per agent, the one with the lowest RTT is used */
+#define DIST_START_LEAD		500000		/* [us] from the clock synchronization to the start of the test */
+#define DIST_SECRET_MAX		1024		/* maximum length of the shared secret of the coordinator and the agents */
+#define DIST_TIMEOUT		60		/* [s] to wait for the results of an agent beyond the test duration */
+
+/* Module functions */
+extern char *dist_agent(const char *, size_t *);
+extern void dist_agent_start();
+extern void dist_agent_report(const summary *);
+extern void dist_coordinator(const char *, const char *);
+
+#endif /* DIST_H */
@@ -0,0 +1,315 @@
+/*
+ * Name resolution of the target hosts.  The request definitions are resolved by a pool of
+ * threads at start-up rather than one after another.  With --dns-ttl, a helper thread then
+ * re-resolves them periodically and publishes any changed result as a new addr_list the
+ * worker threads pick up on their next (re)connect; they spread their connections across all
+ * its addresses.  The source addresses of every distinct host_from are expanded once into an
+ * addr_list too, shared by the request definitions.  getaddrinfo() does not tell the TTLs of
+ * the records, the refresh interval is given instead.
+ */
+#include <arpa/inet.h>		/* inet_pton(), htonl() */
+#include <errno.h>		/* errno */
+#include <netdb.h>		/* getaddrinfo() */
+#include <pthread.h>		/* pthread_create() */
+#include <stdlib.h>		/* malloc(), free() */
+#include <string.h>		/* memcmp(), strerror(), strtok_r() */
+#include <unistd.h>		/* usleep() */
+
+#include "dns.h"
+#include "mb.h"			/* time_us(), WATCHDOG_MS */
+#include "merr.h"
+
+static struct {
+  request_def *defs;		/* request definitions to resolve */
+  int n;
+  int next;			/* next request definition to resolve at start-up */
+  uint64_t ttl;			/* re-resolve interval [us] */
+  pthread_t thread;		/* re-resolving thread */
+  int stop;			/* set by dns_refresh_stop() */
+} dns;
+
+/* the source addresses of a host_from, see addr_list_source() */
+typedef struct dns_source {
+  struct dns_source *next;
+  char *host_from;
+  addr_list *l;
+} dns_source;
+
+static dns_source *dns_sources;		/* the host_froms expanded so far */
+static pthread_mutex_t dns_sources_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return a new address list of the stream sockets in ai, NULL if there are none. */
+static addr_list *addr_list_new(const struct addrinfo *ai) {
+  const struct addrinfo *a;
+  addr_list *l;
+  int n = 0;
+
+  for (a = ai; a; a = a->ai_next)
+    if (a->ai_socktype == SOCK_STREAM && a->ai_addrlen <= sizeof(struct sockaddr_storage)) n++;
+  if (!n) return NULL;
+
+  if ((l = calloc(1, sizeof(*l) + n * sizeof(l->a[0]))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for addresses\n");
+  for (a = ai; a; a = a->ai_next) {
+    if (a->ai_socktype != SOCK_STREAM || a->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+    memcpy(&l->a[l->n].sa, a->ai_addr, a->ai_addrlen);
+    l->a[l->n++].len = a->ai_addrlen;
+  }
+
+  return l;
+}
+
+/* Append the address sa of length len to the address list l and return the list. */
+static addr_list *addr_list_push(addr_list *l, const struct sockaddr *sa, socklen_t len) {
+  int n = l? l->n: 0;
+
+  if (n >= DNS_SOURCES_MAX)
+    die(EXIT_FAILURE, "more than %d source addresses\n", DNS_SOURCES_MAX);
+  if ((n & (n - 1)) == 0) {
+    /* grown in powers of two */
+    if ((l = realloc(l, sizeof(*l) + (n? 2 * n: 1) * sizeof(l->a[0]))) == NULL)
+      die(EXIT_FAILURE, "realloc(): cannot allocate memory for addresses\n");
+    if (!n) memset(l, 0, sizeof(*l));
+  }
+  memset(&l->a[n].sa, 0, sizeof(l->a[n].sa));
+  memcpy(&l->a[n].sa, sa, len);
+  l->a[n].len = len;
+  l->n = n + 1;
+
+  return l;
+}
+
+/* Append all the addresses of the CIDR block s, e.g. 10.0.0.0/24 or fd00::/112, to l; return the list. */
+static addr_list *addr_list_cidr(addr_list *l, const char *s) {
+  char addr[INET6_ADDRSTRLEN], *end;
+  const char *slash = strchr(s, '/');
+  long prefix = strtol(slash + 1, &end, 10);
+  uint64_t i, n;
+
+  if ((size_t)(slash - s) >= sizeof(addr) || end == slash + 1 || *end) goto err;
+  memcpy(addr, s, slash - s);
+  addr[slash - s] = '\0';
+
+  if (strchr(addr, ':')) {
+    struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6 };
+    __uint128_t base = 0, host;
+    int b;
+
+    if (inet_pton(AF_INET6, addr, &sin6.sin6_addr) != 1 || prefix < 0 || prefix > 128) goto err;
+    if (128 - prefix > 16) goto many;
+    for (b = 0; b < 16; b++) base = base << 8 | sin6.sin6_addr.s6_addr[b];
+    n = 1UL << (128 - prefix);
+    base &= ~(__uint128_t)(n - 1);
+    for (i = 0; i < n; i++) {
+      for (host = base + i, b = 15; b >= 0; b--, host >>= 8) sin6.sin6_addr.s6_addr[b] = host & 0xff;
+      l = addr_list_push(l, (struct sockaddr *)&sin6, sizeof(sin6));
+    }
+  } else {
+    struct sockaddr_in sin = { .sin_family = AF_INET };
+    uint32_t base;
+
+    if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1 || prefix < 0 || prefix > 32) goto err;
+    if (32 - prefix > 16) goto many;
+    n = 1UL << (32 - prefix);
+    base = ntohl(sin.sin_addr.s_addr) & ~(uint32_t)(n - 1);
+    for (i = 0; i < n; i++) {
+      sin.sin_addr.s_addr = htonl(base + i);
+      l = addr_list_push(l, (struct sockaddr *)&sin, sizeof(sin));
+    }
+  }
+
+  return l;
+
+err:
+  die(EXIT_FAILURE, "invalid source CIDR block: %s\n", s);
+many:
+  die(EXIT_FAILURE, "source CIDR block %s has more than %d addresses\n", s, DNS_SOURCES_MAX);
+  return NULL;
+}
+
+/* Return the new source addresses of host_from: comma-separated hosts, IP addresses or CIDR blocks. */
+static addr_list *addr_list_source_new(const char *host_from) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *ai, *a;
+  addr_list *l = NULL;
+  char *hosts = strdup(host_from), *host, *save;
+  int rc;
+
+  if (!hosts) die(EXIT_FAILURE, "strdup(): cannot allocate memory for source addresses\n");
+  for (host = strtok_r(hosts, ", ", &save); host; host = strtok_r(NULL, ", ", &save)) {
+    if (strchr(host, '/')) {
+      l = addr_list_cidr(l, host);
+      continue;
+    }
+    if ((rc = getaddrinfo(host, NULL, &hints, &ai)))
+      die(EXIT_FAILURE, "cannot resolve: %s: %s\n", host, gai_strerror(rc));
+    for (a = ai; a; a = a->ai_next)
+      if (a->ai_addrlen <= sizeof(struct sockaddr_storage)) l = addr_list_push(l, a->ai_addr, a->ai_addrlen);
+    freeaddrinfo(ai);
+  }
+  free(hosts);
+  if (!l) die(EXIT_FAILURE, "no source addresses in %s\n", host_from);
+
+  return l;
+}
+
+/*
+ * Return the source addresses of host_from, expanded only once for all the request definitions
+ * sharing it: a CIDR block of DNS_SOURCES_MAX addresses takes megabytes.
+ */
+static addr_list *addr_list_source(const char *host_from) {
+  dns_source *src;
+  addr_list *l;
+
+  /* the other resolving threads wait rather than expand the same host_from again */
+  pthread_mutex_lock(&dns_sources_lock);
+  for (src = dns_sources; src && strcmp(src->host_from, host_from); src = src->next);
+  if (!src) {
+    if ((src = malloc(sizeof(*src))) == NULL || (src->host_from = strdup(host_from)) == NULL)
+      die(EXIT_FAILURE, "malloc(): cannot allocate memory for source addresses\n");
+    src->l = addr_list_source_new(host_from);
+    src->next = dns_sources;
+    dns_sources = src;
+  }
+  l = src->l;
+  pthread_mutex_unlock(&dns_sources_lock);
+
+  return l;
+}
+
+/* Free the source addresses of all the request definitions */
+void dns_sources_free() {
+  dns_source *src;
+
+  while ((src = dns_sources)) {
+    dns_sources = src->next;
+    free(src->host_from);
+    free(src->l);
+    free(src);
+  }
+}
+
+/* Whether address i of l1 is in l2 */
+static bool addr_list_has(const addr_list *l1, int i, const addr_list *l2) {
+  int j;
+
+  for (j = 0; j < l2->n; j++)
+    if (l1->a[i].len == l2->a[j].len && !memcmp(&l1->a[i].sa, &l2->a[j].sa, l1->a[i].len)) return true;
+
+  return false;
+}
+
+/*
+ * Whether l1 and l2 hold the same addresses, in any order: round-robin DNS rotates the records
+ * of every answer.  The lists are short, pairwise comparison does.
+ */
+static bool addr_list_equal(const addr_list *l1, const addr_list *l2) {
+  int i;
+
+  if (l1->n != l2->n) return false;
+  for (i = 0; i < l1->n; i++)
+    if (!addr_list_has(l1, i, l2) || !addr_list_has(l2, i, l1)) return false;
+
+  return true;
+}
+
+static void *dns_resolve_thread(void *arg) {
+  request_def *d;
+  int i;
+
+  override_ns(false);		/* the resolver state is per thread */
+
+  while ((i = __atomic_fetch_add(&dns.next, 1, __ATOMIC_RELAXED)) < dns.n) {
+    d = &dns.defs[i];
+
+    /* translating addresses comes at a cost, cache the structures */
+    if (host_resolve(d->host, d->port, &d->addr_to) < 0)
+      die(EXIT_FAILURE, "cannot resolve: %s:%d\n", d->host, d->port);
+    if ((d->addrs = addr_list_new(d->addr_to)) == NULL)
+      die(EXIT_FAILURE, "cannot resolve: %s:%d: no stream addresses\n", d->host, d->port);
+
+    /* resolve the source addresses if any */
+    if (d->host_from) d->addr_from = addr_list_source(d->host_from);
+  }
+
+  return NULL;
+}
+
+/* Resolve the target (and source) hosts of the n request definitions defs; die on failure. */
+void dns_resolve(request_def *defs, int n) {
+  pthread_t tids[DNS_THREADS];
+  int i, threads = n < DNS_THREADS? n: DNS_THREADS;
+
+  dns.defs = defs;
+  dns.n = n;
+  dns.next = 0;
+
+  /* this thread resolves as well, also whatever the threads it fails to start would have */
+  for (i = 1; i < threads; i++)
+    if (pthread_create(&tids[i], NULL, dns_resolve_thread, NULL)) break;
+  threads = i;
+  dns_resolve_thread(NULL);
+  for (i = 1; i < threads; i++) pthread_join(tids[i], NULL);
+}
+
+/* Re-resolve the target host of d and publish the result if it changed. */
+static void dns_refresh(request_def *d) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *ai;
+  addr_list *l, *cur = d->addrs;		/* only this thread writes d->addrs */
+  char port[6];
+  int rc;
+
+  snprintf(port, sizeof(port), "%d", d->port);
+  if ((rc = getaddrinfo(d->host, port, &hints, &ai))) {
+    warning("unable to re-resolve %s:%s: %s, keeping %d address(es)\n", d->host, port, gai_strerror(rc), cur->n);
+    return;
+  }
+  l = addr_list_new(ai);
+  freeaddrinfo(ai);
+  if (!l || addr_list_equal(l, cur)) {
+    free(l);
+    return;
+  }
+
+  /* connections might still be reading the old list, keep it until the request definition is freed */
+  l->retired = cur;
+  __atomic_store_n(&d->addrs, l, __ATOMIC_RELEASE);
+  info("%s:%s now resolves to %d address(es)\n", d->host, port, l->n);
+}
+
+static void *dns_refresh_thread(void *arg) {
+  uint64_t next = time_us() + dns.ttl, now;
+  int i;
+
+  override_ns(false);
+
+  while (!__atomic_load_n(&dns.stop, __ATOMIC_RELAXED)) {
+    if ((now = time_us()) < next) {
+      /* wake up regularly to notice the end of the test */
+      usleep(next - now < WATCHDOG_MS * 1000? next - now: WATCHDOG_MS * 1000);
+      continue;
+    }
+    for (i = 0; i < dns.n && !__atomic_load_n(&dns.stop, __ATOMIC_RELAXED); i++)
+      dns_refresh(&dns.defs[i]);
+    next = time_us() + dns.ttl;
+  }
+
+  return NULL;
+}
+
+/* Re-resolve the target hosts of the n request definitions defs every ttl [us] in the background. */
+void dns_refresh_start(request_def *defs, int n, uint64_t ttl) {
+  dns.defs = defs;
+  dns.n = n;
+  dns.ttl = ttl;
+  dns.stop = 0;
+
+  if ((errno = pthread_create(&dns.thread, NULL, dns_refresh_thread, NULL)))
+    die(EXIT_FAILURE, "unable to create the resolver thread: %s (%d)\n", strerror(errno), errno);
+}
+
+void dns_refresh_stop() {
+  __atomic_store_n(&dns.stop, 1, __ATOMIC_RELAXED);
+  pthread_join(dns.thread, NULL);
+}
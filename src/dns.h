@@ -0,0 +1,17 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdint.h>			/* uint64_t */
+
+#include "net.h"			/* request_def, addr_list */
+
+#define DNS_THREADS		16		/* maximum number of threads resolving the request definitions at start-up */
+#define DNS_SOURCES_MAX		65536		/* maximum number of source addresses of a request definition (CIDR blocks) */
+
+/* Module functions */
+extern void dns_resolve(request_def *, int);
+extern void dns_refresh_start(request_def *, int, uint64_t);
+extern void dns_refresh_stop();
+extern void dns_sources_free();
+
+#endif /* DNS_H */
@@ -0,0 +1,887 @@
+/*
+ * A minimal HTTP/2 (RFC 7540) client: requests on up to "streams" concurrent streams per
+ * connection, HPACK (RFC 7541) header blocks pre-encoded once per request definition and a
+ * response decoder that only looks for :status.  We advertise a zero-sized dynamic table so the
+ * responses do not need one and leave Huffman coding to the peer.
+ */
+#include <ctype.h>		/* tolower() */
+#include <errno.h>		/* errno */
+#include <netdb.h>		/* NI_MAXHOST */
+#include <stdlib.h>		/* malloc(), realloc(), free() */
+#include <string.h>		/* memcpy(), strlen() */
+
+#include "h2.h"
+#include "mb.h"
+#include "merr.h"
+#include "net.h"
+#ifdef HAVE_SSL
+#include "ssl.h"
+#endif
+#include "stats.h"		/* MIN/MAX(), write_stats_line() */
+
+#define H2_PREFACE	"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FIELDS_MAX	64		/* maximum number of request header fields */
+
+/* frame types */
+#define H2_DATA		0x0
+#define H2_HEADERS	0x1
+#define H2_PRIORITY	0x2
+#define H2_RST_STREAM	0x3
+#define H2_SETTINGS	0x4
+#define H2_PUSH_PROMISE	0x5
+#define H2_PING		0x6
+#define H2_GOAWAY	0x7
+#define H2_WINDOW_UPDATE	0x8
+#define H2_CONTINUATION	0x9
+
+/* frame flags */
+#define H2_END_STREAM	0x1
+#define H2_ACK		0x1
+#define H2_END_HEADERS	0x4
+#define H2_PADDED	0x8
+#define H2_PRIO		0x20
+
+/* settings */
+#define H2_SETTINGS_HEADER_TABLE_SIZE		0x1
+#define H2_SETTINGS_ENABLE_PUSH			0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS	0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE		0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE		0x5
+
+/* HPACK static table (RFC 7541, Appendix A); entry i is at index i + 1 */
+static const char *hpack_static[][2] = {
+  {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+  {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+  {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+  {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+  {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+  {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+  {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+  {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+  {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+  {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+  {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+  {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+  {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+  {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+  {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+  {"www-authenticate", ""},
+};
+#define HPACK_STATIC_N	(sizeof(hpack_static) / sizeof(hpack_static[0]))
+#define HPACK_STATUS	8	/* index of the first ":status" entry */
+
+/* connection-specific header fields not allowed in HTTP/2 (RFC 7540, 8.1.2.2), or replaced by pseudo-headers */
+static const char *h2_hdrs_skip[] = {
+  "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "host", "te", NULL
+};
+
+static void h2_buf_reserve(h2_buf *b, size_t n) {
+  if (b->len + n <= b->cap) return;
+
+  b->cap = MAX(b->cap * 2, b->len + n);
+  if ((b->p = realloc(b->p, b->cap)) == NULL)
+    die(EXIT_FAILURE, "realloc(): cannot allocate memory for HTTP/2 data\n");
+}
+
+/* HPACK integer with an n-bit prefix; the first byte keeps the bits of "first" above the prefix */
+static void hpack_int(h2_buf *b, uint8_t first, int n, uint64_t v) {
+  uint8_t max = (1 << n) - 1;
+
+  h2_buf_reserve(b, 11);
+  if (v < max) {
+    b->p[b->len++] = first | v;
+    return;
+  }
+  b->p[b->len++] = first | max;
+  for (v -= max; v >= 128; v >>= 7)
+    b->p[b->len++] = (v & 0x7f) | 0x80;
+  b->p[b->len++] = v;
+}
+
+/* HPACK string literal without Huffman coding */
+static void hpack_str(h2_buf *b, const char *s, size_t len) {
+  hpack_int(b, 0x00, 7, len);
+  h2_buf_reserve(b, len);
+  memcpy(b->p + b->len, s, len);
+  b->len += len;
+}
+
+/* Return the static table index of the entry name: value or, failing that, of the name only; set *full on a full match. */
+static int hpack_static_find(const char *name, const char *value, bool *full) {
+  int i, name_idx = 0;
+
+  for (i = 0; i < HPACK_STATIC_N; i++) {
+    if (strcmp(hpack_static[i][0], name)) continue;
+    if (!strcmp(hpack_static[i][1], value)) {
+      *full = true;
+      return i + 1;
+    }
+    if (!name_idx) name_idx = i + 1;
+  }
+  *full = false;
+
+  return name_idx;
+}
+
+/* request header fields of a request definition */
+typedef struct {
+  const char *name[H2_FIELDS_MAX];
+  const char *value[H2_FIELDS_MAX];
+  int n;
+} h2_fields;
+
+static void h2_fields_add(h2_fields *f, const char *name, const char *value) {
+  if (f->n == H2_FIELDS_MAX)
+    die(EXIT_FAILURE, "too many HTTP/2 header fields (> %d)\n", H2_FIELDS_MAX);
+  f->name[f->n] = name;
+  f->value[f->n++] = value;
+}
+
+/*
+ * Pre-encode the HPACK header blocks of the requests of d; these are the same for every request.
+ * Fields found in the static table are always indexed, the rest are literals.  H2_HB_INDEX adds
+ * them to the peer's dynamic table and H2_HB_INDEXED references them there afterwards.
+ */
+void h2_def_init(request_def *d) {
+  h2_buf hb[H2_HB_N] = {{ 0 }};
+  h2_fields f = { .n = 0 };
+  char authority[NI_MAXHOST + 8], names[H2_FIELDS_MAX][256], len[HTTP_CONT_MAX + 1];
+  int static_idx[H2_FIELDS_MAX], entries = 0, entry, i, j;
+  bool full[H2_FIELDS_MAX];
+  key_value *kv;
+
+  d->h2_body_len = d->req_body? strlen(d->req_body): 0;
+
+  if ((d->scheme == h2 && d->port == 443) || (d->scheme == h2c && d->port == 80))
+    snprintf(authority, sizeof(authority), "%s", d->host);
+  else
+    snprintf(authority, sizeof(authority), "%s:%d", d->host, d->port);
+
+  h2_fields_add(&f, ":method", d->method? d->method: "GET");
+  h2_fields_add(&f, ":scheme", (d->scheme == h2)? "https": "http");
+  h2_fields_add(&f, ":authority", authority);
+  h2_fields_add(&f, ":path", d->path? d->path: "/");
+  h2_fields_add(&f, "user-agent", HTTP_UA);
+  h2_fields_add(&f, "accept", "*/*");
+
+  for (kv = d->headers; kv && kv->key; kv++) {
+    /* HTTP/2 header field names are lowercase */
+    char *name;
+    if (f.n == H2_FIELDS_MAX)
+      die(EXIT_FAILURE, "too many HTTP/2 header fields (> %d)\n", H2_FIELDS_MAX);
+    name = names[f.n];
+    for (j = 0; kv->key[j] && j < sizeof(names[0]) - 1; j++) name[j] = tolower((unsigned char)kv->key[j]);
+    name[j] = '\0';
+
+    for (j = 0; h2_hdrs_skip[j] && strcmp(h2_hdrs_skip[j], name); j++);
+    if (h2_hdrs_skip[j]) {
+      warning("header `%s' not allowed in HTTP/2, ignoring\n", kv->key);
+      continue;
+    }
+    h2_fields_add(&f, name, kv->value? kv->value: "");
+  }
+
+  if (d->h2_body_len) {
+    snprintf(len, sizeof(len), "%zu", d->h2_body_len);
+    h2_fields_add(&f, "content-length", len);
+  }
+
+  d->h2_table_size = 0;
+  for (i = 0; i < f.n; i++) {
+    static_idx[i] = hpack_static_find(f.name[i], f.value[i], &full[i]);
+    if (full[i]) continue;
+    entries++;
+    d->h2_table_size += strlen(f.name[i]) + strlen(f.value[i]) + 32;	/* RFC 7541, 4.1 */
+  }
+  if (d->h2_table_size > H2_TABLE_SIZE) {
+    /* the entries would not fit into the peer's dynamic table, do not use it */
+    d->h2_table_size = 0;
+  }
+
+  for (i = 0, entry = 0; i < f.n; i++) {
+    if (full[i]) {
+      for (j = 0; j < H2_HB_N; j++)
+        hpack_int(&hb[j], 0x80, 7, static_idx[i]);
+      continue;
+    }
+
+    for (j = 0; j < H2_HB_N; j++) {
+      if (j == H2_HB_INDEXED && d->h2_table_size) {
+        /* entry e of n inserted by H2_HB_INDEX is at index HPACK_STATIC_N + n - e (the newest comes first) */
+        hpack_int(&hb[j], 0x80, 7, HPACK_STATIC_N + entries - entry);
+        continue;
+      }
+      if (j == H2_HB_INDEX && d->h2_table_size)
+        hpack_int(&hb[j], 0x40, 6, static_idx[i]);	/* literal with incremental indexing */
+      else
+        hpack_int(&hb[j], 0x00, 4, static_idx[i]);	/* literal without indexing */
+      if (!static_idx[i]) hpack_str(&hb[j], f.name[i], strlen(f.name[i]));
+      hpack_str(&hb[j], f.value[i], strlen(f.value[i]));
+    }
+    entry++;
+  }
+
+  for (i = 0; i < H2_HB_N; i++) {
+    d->h2_hblock[i] = hb[i].p;
+    d->h2_hblock_len[i] = hb[i].len;
+  }
+}
+
+void h2_def_free(request_def *d) {
+  int i;
+
+  for (i = 0; i < H2_HB_N; i++) {
+    free(d->h2_hblock[i]); d->h2_hblock[i] = NULL;
+  }
+}
+
+h2_state *h2_new(const request_def *d) {
+  h2_state *s;
+
+  if ((s = calloc(1, sizeof(h2_state) + d->streams * sizeof(h2_stream))) == NULL ||
+      (s->frame = malloc(H2_FRAME_LEN)) == NULL ||
+      (s->hblock = malloc(H2_HBLOCK_MAX)) == NULL)
+    die(EXIT_FAILURE, "cannot allocate memory for HTTP/2 connection state\n");
+
+  return s;
+}
+
+void h2_free(connection *c) {
+  if (!c->h2) return;
+
+  free(c->h2->out.p);
+  free(c->h2->frame);
+  free(c->h2->hblock);
+  free(c->h2); c->h2 = NULL;
+}
+
+/* Reset the HTTP/2 state of c for a new connection; the requests in flight are lost with the old one. */
+void h2_reset(connection *c) {
+  h2_state *s = c->h2;
+
+  s->out.len = s->out_sent = 0;
+  s->hdr_have = s->have = s->len = 0;
+  s->hblock_len = 0;
+  s->hblock_sid = 0;
+  s->preface = false;
+  s->goaway = false;
+  s->table_update = false;
+  s->hb = H2_HB_INDEX;
+  s->next_id = 1;
+  s->active = 0;
+  s->peer_streams = 100;		/* until the peer's SETTINGS arrive (RFC 7540, 6.5.2 recommends no less) */
+  s->peer_frame = H2_FRAME_LEN;
+  s->peer_window = 65535;
+  s->window = 65535;
+  s->recv = 0;
+  s->done = NULL;
+  memset(s->streams, 0, c->def->streams * sizeof(h2_stream));
+}
+
+static inline void h2_put32(char *p, uint32_t v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline uint32_t h2_get32(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return (uint32_t)u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3];
+}
+
+/* Append a frame with a payload of len bytes to the output; return the payload to fill in. */
+static char *h2_frame(h2_state *s, size_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+  char *p;
+
+  h2_buf_reserve(&s->out, H2_FRAME_HDR + len);
+  p = s->out.p + s->out.len;
+  p[0] = len >> 16; p[1] = len >> 8; p[2] = len;
+  p[3] = type;
+  p[4] = flags;
+  h2_put32(p + 5, sid);
+  s->out.len += H2_FRAME_HDR + len;
+
+  return p + H2_FRAME_HDR;
+}
+
+static inline char *h2_setting(char *p, uint16_t id, uint32_t v) {
+  p[0] = id >> 8; p[1] = id;
+  h2_put32(p + 2, v);
+
+  return p + 6;
+}
+
+/* The client connection preface: no dynamic table, no server push, the largest receive windows. */
+static void h2_preface(h2_state *s) {
+  char *p;
+
+  h2_buf_reserve(&s->out, sizeof(H2_PREFACE) - 1);
+  memcpy(s->out.p + s->out.len, H2_PREFACE, sizeof(H2_PREFACE) - 1);
+  s->out.len += sizeof(H2_PREFACE) - 1;
+
+  p = h2_frame(s, 18, H2_SETTINGS, 0, 0);
+  p = h2_setting(p, H2_SETTINGS_HEADER_TABLE_SIZE, 0);
+  p = h2_setting(p, H2_SETTINGS_ENABLE_PUSH, 0);
+  p = h2_setting(p, H2_SETTINGS_INITIAL_WINDOW_SIZE, H2_WINDOW_MAX);
+
+  p = h2_frame(s, 4, H2_WINDOW_UPDATE, 0, 0);
+  h2_put32(p, H2_WINDOW_MAX - 65535);
+
+  s->preface = true;
+}
+
+static h2_stream *h2_stream_find(connection *c, uint32_t sid) {
+  h2_stream *st, *end = c->h2->streams + c->def->streams;
+
+  for (st = c->h2->streams; st < end; st++)
+    if (st->id == sid) return st;
+
+  return NULL;
+}
+
+/* Queue as much of the request body of st as the flow-control windows allow. */
+static void h2_body(connection *c, h2_stream *st) {
+  h2_state *s = c->h2;
+  const request_def *d = c->def;
+  size_t n;
+  char *p;
+
+  while (st->body_sent < d->h2_body_len && s->window > 0 && st->window > 0) {
+    n = MIN(d->h2_body_len - st->body_sent, MIN(s->window, st->window));
+    n = MIN(n, s->peer_frame);
+    p = h2_frame(s, n, H2_DATA, (st->body_sent + n == d->h2_body_len)? H2_END_STREAM: 0, st->id);
+    memcpy(p, d->req_body + st->body_sent, n);
+    st->body_sent += n;
+    st->written += H2_FRAME_HDR + n;
+    s->window -= n;
+    st->window -= n;
+  }
+}
+
+static inline bool h2_stream_can_open(connection *c) {
+  h2_state *s = c->h2;
+  const request_def *d = c->def;
+
+  return !s->goaway && s->next_id <= H2_STREAM_ID_MAX &&
+         s->active < d->streams && s->active < s->peer_streams &&
+         !(d->keep_alive_reqs && c->cstats.reqs >= d->keep_alive_reqs) &&
+         !(d->reqs_max && c->cstats.reqs_total >= d->reqs_max) &&
+         s->out.len - s->out_sent < H2_OUT_HIGH;
+}
+
+/* Start a request on a new stream: queue its HEADERS (and CONTINUATION) frames and the body. */
+static void h2_stream_open(connection *c) {
+  h2_state *s = c->h2;
+  const request_def *d = c->def;
+  const char *hb = d->h2_hblock[s->hb];
+  size_t hb_len = d->h2_hblock_len[s->hb], pre = s->table_update? 1: 0, off = 0, n;
+  h2_stream *st;
+  char *p;
+
+  for (st = s->streams; st->id; st++);		/* there is a free slot: s->active < d->streams */
+  st->id = s->next_id;
+  s->next_id += 2;
+  st->status = 0;
+  st->body_sent = 0;
+  st->window = s->peer_window;
+  st->recv = 0;
+  st->written = 0;
+  st->read = 0;
+  s->active++;
+  c->cstats.reqs++;
+  c->cstats.reqs_total++;
+  COUNTER_ADD(CONN_COUNTERS(c)->reqs, 1);
+  st->start = (c->cstats.reqs == 1)? c->cstats.start: time_us();
+
+  if (s->hb == H2_HB_INDEX) s->hb = H2_HB_INDEXED;
+
+  /* the header block, prefixed by a dynamic table size update to 0 if due, in frames of up to peer_frame bytes */
+  do {
+    n = MIN(pre + hb_len - off, s->peer_frame);
+    p = h2_frame(s, n, off? H2_CONTINUATION: H2_HEADERS,
+                 ((off + n == pre + hb_len)? H2_END_HEADERS: 0) | ((!off && !d->h2_body_len)? H2_END_STREAM: 0), st->id);
+    if (off) {
+      memcpy(p, hb + off - pre, n);
+    } else {
+      if (pre) p[0] = 0x20;
+      memcpy(p + pre, hb, n - pre);
+    }
+    off += n;
+    st->written += H2_FRAME_HDR + n;
+  } while (off < pre + hb_len);
+  s->table_update = false;
+
+  if (d->h2_body_len) h2_body(c, st);
+}
+
+/* Queue the request data the windows and limits allow: pending bodies first, then new streams. */
+static void h2_queue(connection *c) {
+  h2_state *s = c->h2;
+  h2_stream *st, *end = s->streams + c->def->streams;
+
+  if (c->def->h2_body_len && s->window > 0)
+    for (st = s->streams; st < end; st++)
+      if (st->id && st->body_sent < c->def->h2_body_len) h2_body(c, st);
+
+  while (h2_stream_can_open(c))
+    h2_stream_open(c);
+}
+
+/* Record the response (or the error err) of stream st and free the stream. */
+static void h2_stream_close(connection *c, h2_stream *st, char *err) {
+  h2_state *s = c->h2;
+
+  if (err) {
+    c->status = 0;
+    COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
+  } else {
+    c->status = st->status;
+    response_record(c, time_us() - st->start);
+  }
+  /* the request and response lengths of this stream rather than the connection's bytes since the last response */
+  c->written = st->written;
+  c->read = st->read;
+  s->done = st;
+  if (stats.fd) write_stats_line(stats.fd, c, err);
+  s->done = NULL;
+  c->written = c->read = 0;
+
+  st->id = 0;
+  s->active--;
+}
+
+/*
+ * No streams open: report reaching max-requests, or reconnect if no more requests can be sent
+ * on this connection (keep-alive-requests, GOAWAY, exhausted stream identifiers).  Return true
+ * if c was reconnected.
+ */
+static bool h2_idle(connection *c) {
+  h2_state *s = c->h2;
+  const request_def *d = c->def;
+
+  if (s->active) return false;
+
+  if (d->reqs_max && c->cstats.reqs_total >= d->reqs_max) {
+    if (!s->reqs_max_done) {
+      s->reqs_max_done = true;
+      if (requests_max_cb) requests_max_cb();
+    }
+    return false;
+  }
+
+  if (s->goaway || s->next_id > H2_STREAM_ID_MAX || (d->keep_alive_reqs && c->cstats.reqs >= d->keep_alive_reqs)) {
+    socket_reconnect(c);
+    return true;
+  }
+
+  return false;
+}
+
+/* Write the queued frames; return 1 when all were written, 0 if the socket would block, -1 on an error (c is reconnected). */
+static int h2_flush(aeEventLoop *loop, connection *c, uint64_t now) {
+  h2_state *s = c->h2;
+  ssize_t n;
+
+  while (s->out_sent < s->out.len) {
+    n = CONN_WRITE(c, s->out.p + s->out_sent, s->out.len - s->out_sent);
+    SELF_IO(c, writes, n);
+
+    if (n < 0) {
+      if (errno == EAGAIN) {
+        if (!(aeGetFileEvents(loop, c->fd) & AE_WRITABLE))
+          aeCreateFileEventOrDie(loop, c->fd, AE_WRITABLE, socket_write, c);
+        return 0;
+      }
+
+      /* ECONNRESET (104) and simillar */
+      error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
+      c->status = 0;
+      if (stats.fd) write_stats_line(stats.fd, c, "h2_write()");
+      COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
+      socket_reconnect(c);
+      return -1;
+    }
+
+    if (c->cstats.handshake == 0)
+      /* first write within an established connection */
+      connection_handshake_done(c, now);
+
+    s->out_sent += n;
+    c->cstats.written_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->sent, n);
+  }
+  s->out.len = s->out_sent = 0;
+
+  return 1;
+}
+
+void h2_write(aeEventLoop *loop, connection *c) {
+  h2_state *s = c->h2;
+  uint64_t now = time_us();
+
+  if (c->cstats.writeable == 0)
+    /* first write within an established connection */
+    c->cstats.writeable = now;
+
+  if (!s->preface) {
+    h2_preface(s);
+    aeCreateFileEventOrDie(loop, c->fd, AE_READABLE, socket_read, c);
+  }
+
+  if (h2_idle(c)) return;
+
+  for (;;) {
+    h2_queue(c);
+    if (s->out_sent == s->out.len) break;
+    if (h2_flush(loop, c, now) <= 0) return;
+  }
+
+  /* nothing more to write until the peer responds, updates a window or acknowledges settings */
+  if (aeGetFileEvents(loop, c->fd) & AE_WRITABLE)
+    aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
+}
+
+/* HPACK integer with an n-bit prefix */
+static int hpack_int_decode(const unsigned char **p, const unsigned char *end, int n, uint64_t *v) {
+  uint8_t max = (1 << n) - 1;
+  int shift = 0;
+
+  if (*p >= end) return -1;
+  *v = *(*p)++ & max;
+  if (*v < max) return 0;
+
+  do {
+    if (*p >= end || shift > 56) return -1;
+    *v += (uint64_t)(**p & 0x7f) << shift;
+    shift += 7;
+  } while (*(*p)++ & 0x80);
+
+  return 0;
+}
+
+/*
+ * Decode a 3-digit :status value; Huffman coded digits are 00000-00010 ('0'-'2') and
+ * 011001-011111 ('3'-'9'), followed by up to 7 bits of EOS padding (RFC 7541, Appendix B).
+ */
+static int hpack_status_value(const unsigned char *p, size_t len, bool huffman) {
+  uint64_t bits = 0, code;
+  size_t total = len * 8, pos = 0, rem, i;
+  int status = 0, digits = 0;
+
+  if (!huffman) {
+    for (i = 0; i < len; i++) {
+      if (!isdigit(p[i])) return -1;
+      status = status * 10 + p[i] - '0';
+    }
+    return (len == 3)? status: -1;
+  }
+
+  if (len > 8) return -1;
+  for (i = 0; i < len; i++) bits = bits << 8 | p[i];
+
+  while ((rem = total - pos) > 0) {
+    if (rem < 8 && (bits & ((1ULL << rem) - 1)) == (1ULL << rem) - 1)
+      /* EOS padding */
+      break;
+    if (rem < 5) return -1;
+    if ((code = (bits >> (rem - 5)) & 0x1f) < 0x3) {
+      pos += 5;
+    } else {
+      if (rem < 6 || (code = (bits >> (rem - 6)) & 0x3f) < 0x19 || code > 0x1f) return -1;
+      code -= 0x19 - 3;
+      pos += 6;
+    }
+    status = status * 10 + code;
+    digits++;
+  }
+
+  return (digits == 3)? status: -1;
+}
+
+/* Return the :status of an HPACK header block, 0 if it has none (trailers), -1 on a decoding error. */
+static int hpack_status(const unsigned char *p, size_t len) {
+  const unsigned char *end = p + len;
+  uint64_t idx, slen;
+  bool huffman, is_status;
+  int status = 0, v;
+
+  while (p < end) {
+    if (*p & 0x80) {
+      /* indexed header field; the peer has no dynamic table to refer to */
+      if (hpack_int_decode(&p, end, 7, &idx) || idx == 0 || idx > HPACK_STATIC_N) return -1;
+      if (idx >= HPACK_STATUS && idx < HPACK_STATUS + 7) status = atoi(hpack_static[idx - 1][1]);
+      continue;
+    }
+
+    if ((*p & 0xe0) == 0x20) {
+      /* dynamic table size update */
+      if (hpack_int_decode(&p, end, 5, &idx)) return -1;
+      continue;
+    }
+
+    /* literal header field: with incremental indexing (6-bit prefix), without indexing or never indexed (4-bit) */
+    if (hpack_int_decode(&p, end, (*p & 0x40)? 6: 4, &idx) || idx > HPACK_STATIC_N) return -1;
+    is_status = idx >= HPACK_STATUS && idx < HPACK_STATUS + 7;
+    if (!idx) {
+      /* literal name */
+      if (p >= end) return -1;
+      huffman = *p & 0x80;
+      if (hpack_int_decode(&p, end, 7, &slen) || slen > end - p) return -1;
+      is_status = !huffman && slen == 7 && !memcmp(p, ":status", 7);
+      p += slen;
+    }
+    if (p >= end) return -1;
+    huffman = *p & 0x80;
+    if (hpack_int_decode(&p, end, 7, &slen) || slen > end - p) return -1;
+    if (is_status) {
+      if ((v = hpack_status_value(p, slen, huffman)) < 0) return -1;
+      status = v;
+    }
+    p += slen;
+  }
+
+  return status;
+}
+
+/* A complete response header block was received. */
+static int h2_headers(connection *c) {
+  h2_state *s = c->h2;
+  h2_stream *st;
+  int status = hpack_status((unsigned char *)s->hblock, s->hblock_len);
+
+  if (status < 0) return -1;
+  if ((st = h2_stream_find(c, s->hblock_sid)) == NULL) {
+    /* stream already closed, e.g. reset by us or the peer */
+    s->hblock_sid = 0;
+    return 0;
+  }
+  s->hblock_sid = 0;
+  st->read += s->hblock_read;
+
+  if (status >= 100 && status < 200)
+    /* informational response, the final one follows */
+    return 0;
+  if (status) st->status = status;
+  if (s->hblock_end_stream) h2_stream_close(c, st, NULL);
+
+  return 0;
+}
+
+static int h2_hblock_append(h2_state *s, const char *p, size_t len) {
+  if (s->hblock_len + len > H2_HBLOCK_MAX) return -1;
+  memcpy(s->hblock + s->hblock_len, p, len);
+  s->hblock_len += len;
+
+  return 0;
+}
+
+/* Process a complete frame (only the header of a DATA frame, its payload is not kept); return -1 on a protocol error. */
+static int h2_frame_recv(connection *c) {
+  h2_state *s = c->h2;
+  h2_stream *st, *end;
+  char *p = s->frame, *pend = s->frame + s->len;
+  uint32_t v;
+  int64_t delta;
+  uint16_t id;
+
+  switch (s->type) {
+  case H2_DATA:
+    if (!s->sid) return -1;
+    s->recv += s->len;
+    if (s->recv >= H2_WINDOW_MAX / 2) {
+      h2_put32(h2_frame(s, 4, H2_WINDOW_UPDATE, 0, 0), s->recv);
+      s->recv = 0;
+    }
+    if ((st = h2_stream_find(c, s->sid)) == NULL) return 0;
+    st->read += H2_FRAME_HDR + s->len;
+    if (s->flags & H2_END_STREAM) {
+      h2_stream_close(c, st, NULL);
+    } else if ((st->recv += s->len) >= H2_WINDOW_MAX / 2) {
+      h2_put32(h2_frame(s, 4, H2_WINDOW_UPDATE, 0, st->id), st->recv);
+      st->recv = 0;
+    }
+    return 0;
+
+  case H2_HEADERS:
+    if (!s->sid) return -1;
+    if (s->flags & H2_PADDED) {
+      if (p >= pend || *(unsigned char *)p >= pend - p) return -1;
+      pend -= *(unsigned char *)p++;
+    }
+    if (s->flags & H2_PRIO) {
+      if (pend - p < 5) return -1;
+      p += 5;
+    }
+    s->hblock_len = 0;
+    s->hblock_read = H2_FRAME_HDR + s->len;
+    s->hblock_sid = s->sid;
+    s->hblock_end_stream = s->flags & H2_END_STREAM;
+    if (h2_hblock_append(s, p, pend - p)) return -1;
+    return (s->flags & H2_END_HEADERS)? h2_headers(c): 0;
+
+  case H2_CONTINUATION:
+    if (!s->hblock_sid || s->sid != s->hblock_sid) return -1;
+    s->hblock_read += H2_FRAME_HDR + s->len;
+    if (h2_hblock_append(s, p, pend - p)) return -1;
+    return (s->flags & H2_END_HEADERS)? h2_headers(c): 0;
+
+  case H2_RST_STREAM:
+    if (!s->sid || s->len != 4) return -1;
+    if ((st = h2_stream_find(c, s->sid)) != NULL) h2_stream_close(c, st, "h2: stream reset");
+    return 0;
+
+  case H2_SETTINGS:
+    if (s->sid || (s->len % 6)) return -1;
+    if (s->flags & H2_ACK) return 0;
+    for (; p < pend; p += 6) {
+      id = (uint16_t)((unsigned char)p[0] << 8 | (unsigned char)p[1]);
+      v = h2_get32(p + 2);
+      switch (id) {
+      case H2_SETTINGS_HEADER_TABLE_SIZE:
+        if (v < c->def->h2_table_size && s->hb != H2_HB_LITERAL) {
+          /* our entries do not fit (any longer): empty the table and send literals from now on */
+          s->hb = H2_HB_LITERAL;
+          s->table_update = true;
+        }
+        break;
+      case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+        s->peer_streams = v;
+        break;
+      case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+        if (v > H2_WINDOW_MAX) return -1;
+        delta = (int64_t)v - s->peer_window;
+        for (st = s->streams, end = st + c->def->streams; st < end; st++)
+          if (st->id) st->window += delta;
+        s->peer_window = v;
+        break;
+      case H2_SETTINGS_MAX_FRAME_SIZE:
+        if (v < H2_FRAME_LEN || v > 0xffffff) return -1;
+        s->peer_frame = v;
+        break;
+      }
+    }
+    h2_frame(s, 0, H2_SETTINGS, H2_ACK, 0);
+    return 0;
+
+  case H2_PUSH_PROMISE:
+    /* disabled by our SETTINGS_ENABLE_PUSH */
+    return -1;
+
+  case H2_PING:
+    if (s->sid || s->len != 8) return -1;
+    if (!(s->flags & H2_ACK)) memcpy(h2_frame(s, 8, H2_PING, H2_ACK, 0), s->frame, 8);
+    return 0;
+
+  case H2_GOAWAY:
+    if (s->sid || s->len < 8) return -1;
+    v = h2_get32(p) & H2_STREAM_ID_MAX;
+    s->goaway = true;
+    /* streams above the last stream identifier were not processed by the peer */
+    for (st = s->streams, end = st + c->def->streams; st < end; st++)
+      if (st->id > v) h2_stream_close(c, st, "h2: stream reset");
+    return 0;
+
+  case H2_WINDOW_UPDATE:
+    if (s->len != 4 || (v = h2_get32(p) & 0x7fffffff) == 0) return -1;
+    if (!s->sid)
+      s->window += v;
+    else if ((st = h2_stream_find(c, s->sid)) != NULL)
+      st->window += v;
+    return 0;
+
+  default:
+    /* PRIORITY and unknown frame types */
+    return 0;
+  }
+}
+
+/* Feed len bytes read from the connection to the frame parser; return -1 on a protocol error. */
+static int h2_input(connection *c, const char *buf, size_t len) {
+  h2_state *s = c->h2;
+  size_t n;
+
+  for (;;) {
+    if (s->hdr_have < H2_FRAME_HDR) {
+      if (!len) return 0;
+      n = MIN(H2_FRAME_HDR - s->hdr_have, len);
+      memcpy(s->hdr + s->hdr_have, buf, n);
+      s->hdr_have += n;
+      buf += n;
+      len -= n;
+      if (s->hdr_have < H2_FRAME_HDR) return 0;
+
+      s->len = s->hdr[0] << 16 | s->hdr[1] << 8 | s->hdr[2];
+      s->type = s->hdr[3];
+      s->flags = s->hdr[4];
+      s->sid = h2_get32((char *)s->hdr + 5) & H2_STREAM_ID_MAX;
+      s->have = 0;
+      if (s->type != H2_DATA && s->len > H2_FRAME_LEN) return -1;
+      if (s->hblock_sid && s->type != H2_CONTINUATION) return -1;	/* header blocks must not be interleaved */
+    }
+
+    n = MIN(len, s->len - s->have);
+    if (s->type != H2_DATA) memcpy(s->frame + s->have, buf, n);
+    s->have += n;
+    buf += n;
+    len -= n;
+    if (s->have < s->len) return 0;
+
+    if (h2_frame_recv(c)) return -1;
+    s->hdr_have = 0;
+  }
+}
+
+void h2_read(aeEventLoop *loop, connection *c) {
+  ssize_t n;
+
+  do {
+    n = CONN_READ(c, RECVBUF);
+    SELF_IO(c, reads, n);
+
+    if (n < 0) {
+      if (errno == EAGAIN) break;
+
+      /* ECONNRESET (104) and simillar */
+      error("cannot read from [%d] (%s:%d): %s: (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
+      goto err_conn;
+    }
+
+    if (n == 0) {
+      /* the peer closed the connection, e.g. after GOAWAY */
+      error("host closed the connection [%d] (%s:%d), reconnecting...\n", c->fd, c->def->host, c->def->port);
+      goto err_conn;
+    }
+
+    c->cstats.read_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->recv, n);
+
+    if (h2_input(c, c->t->buf, n)) {
+      error("h2: protocol error [%d] (%s:%d), reconnecting...\n", c->fd, c->def->host, c->def->port);
+      goto err_parser;
+    }
+#ifdef HAVE_SSL
+    if (c->ssl && CONN_READABLE(c)) {
+      /* there is data buffered and available in the SSL object to be read */
+      continue;
+    }
+#endif
+    break;
+  } while (true);
+
+  if (h2_idle(c)) return;
+
+  /* send the acknowledgements and window updates, and new requests in place of the finished ones */
+  h2_write(loop, c);
+  return;
+
+err_parser:
+  c->status = 0;
+  if (stats.fd) write_stats_line(stats.fd, c, "h2: protocol error");
+  COUNTER_ADD(CONN_COUNTERS(c)->err_parser, 1);
+  socket_reconnect(c);
+  return;
+
+err_conn:
+  c->status = 0;
+  if (stats.fd) write_stats_line(stats.fd, c, "socket_read(): connection");
+  COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
+  socket_reconnect(c);
+}
@@ -0,0 +1,85 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdbool.h>			/* bool, true, false */
+#include <stdint.h>			/* uint32_t, uint64_t, ... */
+
+#include "net.h"			/* connection, request_def */
+
+#define H2_STREAMS_MAX		1024		/* maximum number of concurrent streams per connection ("streams") */
+#define H2_FRAME_HDR		9		/* frame header length */
+#define H2_FRAME_LEN		16384		/* maximum frame payload we receive (SETTINGS_MAX_FRAME_SIZE default) */
+#define H2_HBLOCK_MAX		(1UL<<16)	/* maximum length of a response header block (HEADERS + CONTINUATION) */
+#define H2_OUT_HIGH		(1UL<<16)	/* do not open new streams while more than this many bytes wait to be written */
+#define H2_WINDOW_MAX		0x7fffffff	/* maximum flow-control window, also our receive window */
+#define H2_STREAM_ID_MAX	0x7fffffff	/* maximum stream identifier */
+#define H2_TABLE_SIZE		4096		/* SETTINGS_HEADER_TABLE_SIZE default */
+
+/* header blocks pre-encoded for every request definition, see h2_def_init() */
+enum {
+  H2_HB_INDEX,		/* literals incrementally indexed into the peer's dynamic table; sent first on a connection */
+  H2_HB_INDEXED,	/* references to the dynamic table entries H2_HB_INDEX added */
+  H2_HB_LITERAL,	/* literals without indexing; used when the peer's dynamic table is too small */
+  H2_HB_N
+};
+
+/* growable buffer */
+typedef struct h2_buf {
+  char *p;
+  size_t len;
+  size_t cap;
+} h2_buf;
+
+typedef struct h2_stream {
+  uint32_t id;			/* stream identifier, 0: free slot */
+  int status;			/* response :status */
+  uint64_t start;		/* time [us] since the Epoch the request started */
+  uint64_t body_sent;		/* bytes of the request body sent */
+  int64_t window;		/* send window of the stream */
+  uint64_t recv;		/* DATA bytes received since the last WINDOW_UPDATE of the stream */
+  uint64_t written;		/* bytes of the request frames (including frame headers) */
+  uint64_t read;		/* bytes of the response frames (including frame headers) */
+} h2_stream;
+
+typedef struct h2_state {
+  h2_buf out;			/* frames waiting to be written */
+  size_t out_sent;		/* bytes of out already written */
+  unsigned char hdr[H2_FRAME_HDR];	/* header of the frame being received */
+  size_t hdr_have;		/* bytes of hdr received */
+  uint32_t len;			/* payload length of the frame being received */
+  uint8_t type;			/* type of the frame being received */
+  uint8_t flags;		/* flags of the frame being received */
+  uint32_t sid;			/* stream identifier of the frame being received */
+  size_t have;			/* bytes of the payload received */
+  char *frame;			/* payload of the non-DATA frame being received (H2_FRAME_LEN) */
+  char *hblock;			/* response header block being received (H2_HBLOCK_MAX) */
+  size_t hblock_len;		/* length of the data in hblock */
+  uint32_t hblock_sid;		/* stream the header block belongs to, 0: no header block being received */
+  size_t hblock_read;		/* bytes of the frames (including frame headers) of the header block */
+  bool hblock_end_stream;	/* the HEADERS frame of the block ended the stream */
+  bool preface;			/* connection preface sent */
+  bool goaway;			/* peer sent GOAWAY; reconnect once the streams below its last stream identifier finish */
+  bool reqs_max_done;		/* requests_max_cb() was called for this connection */
+  bool table_update;		/* prepend a dynamic table size update to the next header block */
+  int hb;			/* header block (H2_HB_*) to send with the next request */
+  uint32_t next_id;		/* stream identifier of the next request */
+  int active;			/* number of open streams */
+  uint32_t peer_streams;	/* peer's SETTINGS_MAX_CONCURRENT_STREAMS */
+  uint32_t peer_frame;		/* peer's SETTINGS_MAX_FRAME_SIZE */
+  int64_t peer_window;		/* peer's SETTINGS_INITIAL_WINDOW_SIZE */
+  int64_t window;		/* send window of the connection */
+  uint64_t recv;		/* DATA bytes received since the last WINDOW_UPDATE of the connection */
+  h2_stream *done;		/* stream whose response is being recorded, see request_start() */
+  h2_stream streams[];		/* def->streams stream slots */
+} h2_state;
+
+/* Module functions */
+extern void h2_def_init(request_def *);
+extern void h2_def_free(request_def *);
+extern h2_state *h2_new(const request_def *);
+extern void h2_free(connection *);
+extern void h2_reset(connection *);
+extern void h2_write(aeEventLoop *, connection *);
+extern void h2_read(aeEventLoop *, connection *);
+
+#endif /* H2_H */
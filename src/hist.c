@@ -0,0 +1,115 @@
+#include <string.h>		/* memset() */
+
+#include "hist.h"
+
+#define HIST_SUB_HALF	(1UL << (HIST_SUB_BITS - 1))
+#define HIST_VALUE_MAX	((1UL << HIST_MAX_BITS) - 1)
+
+#ifndef MIN
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+#endif
+
+static inline unsigned int hist_index(uint64_t v) {
+  unsigned int e;
+
+  if (v > HIST_VALUE_MAX) v = HIST_VALUE_MAX;
+  if (v < (1UL << HIST_SUB_BITS)) return v;
+
+  /* shift the value so that it falls into [HIST_SUB_HALF, 2*HIST_SUB_HALF) */
+  e = (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+
+  return (e << (HIST_SUB_BITS - 1)) + (v >> e);
+}
+
+/* The highest value that would be recorded into bucket i. */
+static inline uint64_t hist_value(unsigned int i) {
+  unsigned int e;
+
+  if (i < (1UL << HIST_SUB_BITS)) return i;
+
+  e = (i >> (HIST_SUB_BITS - 1)) - 1;
+
+  return ((uint64_t)(i - (e << (HIST_SUB_BITS - 1)) + 1) << e) - 1;
+}
+
+void hist_init(hist *h) {
+  memset(h, 0, sizeof(*h));
+  h->min = UINT64_MAX;
+}
+
+/* single writer, concurrent readers: see hist_record() */
+#define HIST_STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define HIST_LOAD(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/*
+ * Only the thread owning the histogram writes to it, no locking required.  The stores are
+ * atomic so that the main thread can merge a snapshot of a histogram being recorded into.
+ */
+void hist_record(hist *h, uint64_t v) {
+  unsigned int i = hist_index(v);
+
+  HIST_STORE(h->counts[i], h->counts[i] + 1);
+  HIST_STORE(h->count, h->count + 1);
+  if (v < h->min) HIST_STORE(h->min, v);
+  if (v > h->max) HIST_STORE(h->max, v);
+}
+
+/* Merge src into dst; src may be recorded into at the same time (see hist_record()). */
+void hist_merge(hist *dst, const hist *src) {
+  unsigned int i;
+  uint64_t min = HIST_LOAD(src->min), max = HIST_LOAD(src->max);
+
+  if (HIST_LOAD(src->count) == 0) return;
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    dst->counts[i] += HIST_LOAD(src->counts[i]);
+
+  dst->count += HIST_LOAD(src->count);
+  if (min < dst->min) dst->min = min;
+  if (max > dst->max) dst->max = max;
+}
+
+/*
+ * Subtract an earlier snapshot prev of h from h, leaving the values recorded in between.  The
+ * count is recomputed from the buckets (the snapshots might have caught the buckets and the
+ * count of a value being recorded apart) and min/max are only known to the bucket precision.
+ */
+void hist_sub(hist *h, const hist *prev) {
+  unsigned int i;
+
+  h->count = h->max = 0;
+  h->min = UINT64_MAX;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    h->counts[i] -= MIN(prev->counts[i], h->counts[i]);
+    if (!h->counts[i]) continue;
+
+    h->count += h->counts[i];
+    if (h->min == UINT64_MAX) h->min = i? hist_value(i - 1) + 1: 0;
+    h->max = hist_value(i);
+  }
+}
+
+/* Return the value at percentile p (0.0 - 100.0); 0 for an empty histogram. */
+uint64_t hist_percentile(const hist *h, double p) {
+  uint64_t rank, seen = 0;
+  unsigned int i;
+
+  if (h->count == 0) return 0;
+
+  rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > h->count) rank = h->count;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      uint64_t v = hist_value(i);
+      /* the bucket upper bound might not have been seen at all */
+      if (v > h->max) v = h->max;
+      if (v < h->min) v = h->min;
+      return v;
+    }
+  }
+
+  return h->max;
+}
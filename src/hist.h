@@ -0,0 +1,29 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>	/* uint64_t */
+
+/*
+ * Log-linear (HDR-style) histogram of latencies in [us].  Values below 2^HIST_SUB_BITS are
+ * recorded exactly, larger values fall into 2^(HIST_SUB_BITS-1) linear sub-buckets per power
+ * of two, i.e. with a relative error of at most 1/64.
+ */
+#define HIST_SUB_BITS	7					/* 64 sub-buckets per power of two */
+#define HIST_MAX_BITS	36					/* track values up to 2^36 [us] (~19h), clamp any larger ones */
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1))
+
+typedef struct hist {
+  uint64_t count;		/* number of recorded values */
+  uint64_t min;			/* smallest recorded value */
+  uint64_t max;			/* largest recorded value */
+  uint64_t counts[HIST_BUCKETS];
+} hist;
+
+/* Module functions */
+extern void hist_init(hist *);
+extern void hist_record(hist *, uint64_t);
+extern void hist_merge(hist *, const hist *);
+extern void hist_sub(hist *, const hist *);
+extern uint64_t hist_percentile(const hist *, double);
+
+#endif /* HIST_H */
@@ -1,26 +1,42 @@
+#define _GNU_SOURCE			/* pthread_setaffinity_np(), CPU_SET() */
+#include <ctype.h>		/* isspace() */
+#include <dirent.h>		/* opendir() */
 #include <errno.h>		/* errno */
+#include <fcntl.h>		/* open() */
 #include <getopt.h>		/* getopt_long() */
 #include <inttypes.h>		/* PRIu64 */
+#include <limits.h>		/* PATH_MAX */
 #include <pthread.h>		/* pthread_create() */
+#include <sched.h>		/* cpu_set_t */
 #include <signal.h>		/* signal() */
 #include <stdio.h>		/* stdout, stderr, fopen(), fclose() */
 #include <stdlib.h>		/* free() */
 #include <string.h>		/* strlen() */
+#include <sys/mman.h>		/* mmap(), munmap() */
 #include <sys/stat.h>		/* stat() */
-#include <sys/time.h>		/* gettimeofday() */
+#include <time.h>		/* clock_gettime() */
 #include <unistd.h>		/* read(), close() */
 
 #include "../version.h"
 #include "../json/json.h"
 
+#include "check.h"		/* check_conn_init() */
+#include "cps.h"		/* cps_thread_init() */
+#include "dist.h"		/* dist_agent(), dist_coordinator() */
+#include "dns.h"		/* dns_resolve() */
+
+#include "h2.h"			/* H2_STREAMS_MAX */
 #include "mb.h"
 #include "merr.h"
+#include "replay.h"		/* replay_load() */
+#include "metrics.h"		/* metrics_start() */
 #include "net.h"
 #include "mcg.h"
 #ifdef HAVE_SSL
 #include "ssl.h"
 #endif
 #include "stats.h"		/* MIN/MAX() */
+#include "tmpl.h"		/* tmpl_conn_init() */
 
 /* Module variables */
 struct config cfg;				/* client options */
@@ -29,8 +45,12 @@ void (*requests_max_cb)() = NULL;
 
 /* Global variables */
 static connection *cs;
+static request_def *defs;		/* request definitions of the input request file */
+static char *random_data;		/* PRNG data of the "random" bodies shared by all connections */
+static int defs_n;			/* number of request definitions in defs */
 static int connections = 0;			/* number of connections defined in input requests file */
 static volatile sig_atomic_t run;		/* thread termination variable */
+static int64_t time_offset;		/* time [us] since the Epoch minus CLOCK_MONOTONIC time when we started, see time_us() */
 
 struct http_parser_settings parser_settings = {
   .on_message_complete	= message_complete,
@@ -43,14 +63,34 @@ struct http_parser_settings parser_settings = {
 };
 
 static struct option longopts[] = {
+  { "agent",         required_argument, NULL, 'a' },
+  { "agents",        required_argument, NULL, 'A' },
   { "cookies",       no_argument,       NULL, 'c' },
+  { "connect-rate",  required_argument, NULL, 'R' },
+  { "connect-ramp",  required_argument, NULL, 'u' },
+  { "cpu-list",      required_argument, NULL, 'C' },
   { "duration",      required_argument, NULL, 'd' },
+  { "dump",          required_argument, NULL, 'D' },
+  { "dns-ttl",       required_argument, NULL, 'n' },
+  { "incoming-cpu",  no_argument,       NULL, 'I' },
+  { "interval",      required_argument, NULL, 'T' },
+  { "interval-json", required_argument, NULL, 'J' },
+  { "metrics",       required_argument, NULL, 'm' },
   { "request-file",  required_argument, NULL, 'i' },
+  { "numa",          no_argument,       NULL, 'N' },
+  { "per-target",    no_argument,       NULL, 'P' },
+  { "summary-json",  required_argument, NULL, 'j' },
   { "response-file", required_argument, NULL, 'o' },
+  { "secret",        required_argument, NULL, 'K' },
+  { "shard",         no_argument,       NULL, 'S' },
+  { "output-format", required_argument, NULL, 'O' },
   { "quiet",         required_argument, NULL, 'q' },
   { "ramp-up",       required_argument, NULL, 'r' },
+  { "replay",        required_argument, NULL, 'p' },
+  { "replay-speed",  required_argument, NULL, 'x' },
   { "ssl-version",   required_argument, NULL, 's' },
   { "threads",       required_argument, NULL, 't' },
+  { "timestamping",  required_argument, NULL, 'k' },
   { "version",       no_argument,       NULL, 'v' },
   { NULL,            0,                 NULL,  0  }
 };
@@ -58,10 +98,12 @@ static struct option longopts[] = {
 /* Internal functions */
 static void usage(int);
 static inline char *mstrdup(const char *);
+void time_init();
 uint64_t time_us();
 int stats_open(const char *);
 int stats_init();
 static char *format_bytes(char *dst, long double n);
+static char *format_time(char *dst, uint64_t us);
 static void stats_print();
 int stats_close();
 void exit_handler();
@@ -69,16 +111,24 @@ void mb_threads_auto();
 void sig_int_term(int);
 void signals_set();
 static void json_check_value(const json_value *, json_type, const char *);
-static void json_process_connection_tcp_keep_alive(const json_value *, connection *);
-static void json_process_connection_tcp(const json_value *, connection *);
-static void json_process_connection_headers(const json_value *, connection *);
-static void json_process_connection_body(const json_value *, connection *);
-static void json_process_connection_delay(const json_value *, connection *);
-static void json_process_connection_close(const json_value *, connection *);
-static int json_process_connection(const json_value *, connection *);
-static int json_process_connections(const json_value *);
-static void request_initialize_body_random(connection *, int);
+static char *json_string_list(const json_value *, const char *);
+static void json_process_connection_tcp_keep_alive(const json_value *, request_def *);
+static void json_process_connection_tcp(const json_value *, request_def *);
+static void json_process_connection_headers(const json_value *, request_def *);
+static void json_process_connection_body(const json_value *, request_def *);
+static void json_process_connection_delay(const json_value *, request_def *);
+static void json_process_connection_close(const json_value *, request_def *);
+static void json_process_connection_check(const json_value *, request_def *);
+static int json_process_connection(const json_value *, request_def *);
+static int request_def_check(request_def *);
+static int requests_parse_json(const char *, size_t);
+static int requests_parse_lines(const char *, size_t);
+static void body_random_init(int);
+char *requests_load(const char *, size_t *);
+int requests_parse(char *, size_t);
 int requests_read(const char *);
+static int cpu_list_parse(const char *, int **);
+static int numa_nodes_read();
 static int args_parse(struct config *, int, char **);
 #ifdef HAVE_SSL
 void ssl_ctx_init();
@@ -91,15 +141,35 @@ static void requests_done();
 static void usage(int ret) {
   fprintf(stderr, "Usage: " PGNAME " <options>\n"
                   "Options:\n"
+                  "  -a, --agent <[h:]p>        run tests of a coordinator received on [host:]port\n"
+                  "  -A, --agents <s>           coordinate: run the test on the agents host:port,...\n"
                   "  -c, --cookies              use session cookies: %s\n"
+                  "  -C, --cpu-list <s>         pin worker threads to CPUs round-robin, e.g. 0-3,8-11\n"
                   "  -d, --duration <n>         test duration (including ramp-up) [s]: %"PRIu64"\n"
+                  "  -D, --dump <s>             convert a binary response stats file to CSV\n"
+                  "  -I, --incoming-cpu         set SO_INCOMING_CPU to the CPU of the worker thread (needs -C)\n"
                   "  -i, --request-file <s>     input request file\n"
+                  "  -j, --summary-json <s>     write the results (totals and per target) to a file in JSON\n"
+                  "  -J, --interval-json <s>    write the interval reports to a file as JSON lines (needs -T)\n"
+                  "  -k, --timestamping <s>     report kernel timestamped response times as well (sw|hw)\n"
+                  "  -K, --secret <s>           file with the secret shared by the coordinator and its agents\n"
+                  "  -m, --metrics <[h:]p>      serve OpenMetrics on [host:]port/metrics while the test runs\n"
+                  "  -n, --dns-ttl <n>          re-resolve the target hosts every <n> seconds while the test runs\n"
+                  "  -N, --numa                 NUMA node-local worker threads and connections\n"
                   "  -o, --response-file <s>    output response stats file\n"
+                  "  -O, --output-format <s>    output response stats file format (csv|binary): csv\n"
+                  "  -p, --replay <s>           replay the requests of a log at their recorded times\n"
+                  "  -P, --per-target           report the results of every request of the request file\n"
                   "  -q, --quiet                quiet mode\n"
                   "  -r, --ramp-up <n>          thread ramp-up time [s]: %"PRIu64"\n"
+                  "  -R, --connect-rate <n>     open at most <n> new connections per second (reconnects included)\n"
                   "  -s, --ssl-version <n>      SSL version: auto(0), SSLv3(1) - TLS1.2(4) [%d]\n"
+                  "  -S, --shard                coordinate: split the clients of every request between the agents\n"
                   "  -t, --threads <n>          number of worker threads: %"PRIu64"\n"
+                  "  -T, --interval <n>         report live results every <n> seconds (fractions allowed)\n"
+                  "  -u, --connect-ramp <n>[:s] raise the connect rate over <n> seconds, linearly or in <s> steps\n"
                   "  -v, --version              print version details\n"
+                  "  -x, --replay-speed <n>     replay <n> times as fast as recorded: 1\n"
                   "\n", cfg.cookies? "yes" : "no", cfg.duration, cfg.ramp_up, MB_TLS_VERSION, cfg.threads
           );
 
@@ -116,10 +186,24 @@ static inline char *mstrdup(const char *s) {
   return ret;
 }
 
+/* Fix the offset of the monotonic clock to the time since the Epoch; call before starting any threads. */
+void time_init() {
+  struct timespec rt, mt;
+
+  clock_gettime(CLOCK_REALTIME, &rt);
+  clock_gettime(CLOCK_MONOTONIC, &mt);
+  time_offset = ((int64_t)rt.tv_sec - mt.tv_sec) * 1000000 + (rt.tv_nsec - mt.tv_nsec) / 1000;
+}
+
+/*
+ * Return the time [us] since the Epoch.  It is read from the monotonic clock (vDSO, as cheap as
+ * gettimeofday()), so that the latencies measured are not skewed when the wall clock is stepped.
+ */
 uint64_t time_us() {
-  struct timeval t;
-  gettimeofday(&t, NULL);
-  return (t.tv_sec * 1000000) + t.tv_usec;
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000 + time_offset;
 }
 
 int stats_open(const char *file_out) {
@@ -139,9 +223,33 @@ int stats_init() {
   stats.fd = NULL;
   stats.err_conn = 0;
   stats.err_status = 0;
+  stats.err_parser = 0;
+  stats.err_check = 0;
+  hist_init(&stats.latency);
+  stats.tls_full = 0;
+  stats.tls_resumed = 0;
+  hist_init(&stats.tls_handshake);
+  hist_init(&stats.kernel_latency);
+  stats.interval_fd = NULL;
+  stats.targets = NULL;
+  memset(&stats.self, 0, sizeof(stats.self));
+  stats.self_loop_us = 0;
+  stats.self_busy_max = 0;
+  stats.self_busy_thread = 0;
+  if (cfg.per_target || cfg.summary_json) {
+    if ((stats.targets = calloc(defs_n, sizeof(target_summary))) == NULL)
+      die(EXIT_FAILURE, "calloc(): cannot allocate memory for per-target results\n");
+  }
+  if (cfg.interval_json && (stats.interval_fd = fopen(cfg.interval_json, "w")) == NULL)
+    error("cannot open file `%s' for writing: %s (%d)\n", cfg.interval_json, strerror(errno), errno);
 
   /* open stats file for writing */
-  return stats_open(cfg.file_resp);
+  int ret = stats_open(cfg.file_resp);
+
+  if (stats.fd && stats_header_write(stats.fd, defs, defs_n))
+    die(EXIT_FAILURE, "cannot write response stats file header: %s (%d)\n", strerror(errno), errno);
+
+  return ret;
 }
 
 static char *format_bytes(char *dst, long double n) {
@@ -159,38 +267,445 @@ static char *format_bytes(char *dst, long double n) {
   return dst;
 }
 
-/* Print statistics */
-void stats_print() {
+static char *format_time(char *dst, uint64_t us) {
+  if (us < 1000)
+    snprintf(dst, 12, "%"PRIu64"us", us);
+  else if (us < 1000000)
+    snprintf(dst, 12, "%0.2Lfms", (long double)us/1000);
+  else
+    snprintf(dst, 12, "%0.2Lfs", (long double)us/1000000);
+
+  return dst;
+}
+
+static const double percentiles[] = { 50, 90, 99, 99.9 };	/* percentiles of the latencies reported */
+
+static void hist_print(const char *name, const hist *h) {
+  char s[12];
+  int n;
+
+  fprintf(stdout, "%s: min %s", name, format_time(s, h->min));
+  for (n = 0; n < sizeof(percentiles)/sizeof(percentiles[0]); n++)
+    fprintf(stdout, ", p%g %s", percentiles[n], format_time(s, hist_percentile(h, percentiles[n])));
+  fprintf(stdout, ", max %s\n", format_time(s, h->max));
+}
+
+/* Return the busy share [%] of an event loop that ran for loop_us and waited for events wait_us of it. */
+static double self_busy(uint64_t loop_us, uint64_t wait_us) {
+  return loop_us? 100.0 * (loop_us > wait_us? loop_us - wait_us: 0) / loop_us: 0;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total? 100.0 * part / total: 0;
+}
+
+/* Add the overhead counters of a (running) worker thread s to sum. */
+static void self_add(self_counters *sum, const self_counters *s) {
+  sum->loop.polls += COUNTER_GET(s->loop.polls);
+  sum->loop.events += COUNTER_GET(s->loop.events);
+  sum->loop.wait_us += COUNTER_GET(s->loop.wait_us);
+  sum->loop.timers += COUNTER_GET(s->loop.timers);
+  sum->loop.timers_late += COUNTER_GET(s->loop.timers_late);
+  sum->reads += COUNTER_GET(s->reads);
+  sum->reads_eagain += COUNTER_GET(s->reads_eagain);
+  sum->writes += COUNTER_GET(s->writes);
+  sum->writes_eagain += COUNTER_GET(s->writes_eagain);
+  sum->lag_n += COUNTER_GET(s->lag_n);
+  sum->lag_sum += COUNTER_GET(s->lag_sum);
+  sum->lag_max = MAX(sum->lag_max, COUNTER_GET(s->lag_max));
+}
+
+/* Merge the overhead of the finished worker thread t into stats; warn if it was close to saturation. */
+static void self_merge(const thread *t) {
+  uint64_t loop_us = t->self.loop_start? t->self.loop_end - t->self.loop_start: 0;
+  double busy = self_busy(loop_us, t->self.loop.wait_us);
+
+  self_add(&stats.self, &t->self);
+  stats.self_loop_us += loop_us;
+  if (busy > stats.self_busy_max) {
+    stats.self_busy_max = busy;
+    stats.self_busy_thread = t->id + 1;
+  }
+  if (busy > MB_BUSY_WARN)
+    warning("thread %d was %0.1f%% busy, the results may be limited by mb rather than the server\n", t->id + 1, busy);
+}
+
+/* Print the overhead of the worker threads of summary sum, see self_counters */
+void self_print(const summary *sum) {
+  const self_counters *s = &sum->self;
   char s1[12], s2[12];
+
+  if (!s->loop.polls) return;
+
+  fprintf(stdout, "Self: busy %0.1f%%, max %0.1f%% (thread %d), events/wakeup: %0.2f, EAGAIN reads: %0.1f%%, writes: %0.1f%%, timers late: %0.1f%%",
+    self_busy(sum->self_loop_us, s->loop.wait_us), sum->self_busy_max, sum->self_busy_thread,
+    (double)s->loop.events / s->loop.polls, percent(s->reads_eagain, s->reads), percent(s->writes_eagain, s->writes),
+    percent(s->loop.timers_late, s->loop.timers));
+  if (s->lag_n)
+    fprintf(stdout, ", delay lag: avg %s, max %s", format_time(s1, s->lag_sum / s->lag_n), format_time(s2, s->lag_max));
+  fprintf(stdout, "\n");
+}
+
+/* Print the response times between the kernel timestamps of summary s (--timestamping) */
+void kernel_latency_print(const summary *s) {
+  if (s->kernel_latency.count)
+    hist_print("Kernel latency", &s->kernel_latency);
+  else if (cfg.timestamping)
+    warning("no kernel timestamped responses%s\n", (cfg.timestamping == ts_hardware)?
+      "; is hardware timestamping enabled on the network interface?": "");
+}
+
+/* Collect the results of this test run */
+static void summary_get(summary *s) {
   connection *cs_ptr = cs;
-  uint64_t reqs = 0;
-  uint64_t sent_bytes = 0;
-  uint64_t recv_bytes = 0;
-  uint64_t duration = time_us() - stats.start;
-  long double rps, sent_mbps, recv_mbps;
   int n;
 
+  s->duration = time_us() - stats.start;
+  s->reqs = s->sent = s->recv = 0;
   for (n = 0; n < connections; n++, cs_ptr++) {
-    reqs += cs_ptr->cstats.reqs_total;
-    sent_bytes += cs_ptr->cstats.written_total;
-    recv_bytes += cs_ptr->cstats.read_total;
+    s->reqs += cs_ptr->cstats.reqs_total;
+    s->sent += cs_ptr->cstats.written_total;
+    s->recv += cs_ptr->cstats.read_total;
   }
+  s->err_conn = stats.err_conn;
+  s->err_status = stats.err_status;
+  s->err_parser = stats.err_parser;
+  s->err_check = stats.err_check;
+  s->tls_full = stats.tls_full;
+  s->tls_resumed = stats.tls_resumed;
+  s->latency = stats.latency;
+  s->tls_handshake = stats.tls_handshake;
+  s->kernel_latency = stats.kernel_latency;
+  s->self = stats.self;
+  s->self_loop_us = stats.self_loop_us;
+  s->self_busy_max = stats.self_busy_max;
+  s->self_busy_thread = stats.self_busy_thread;
+}
 
-  rps = (long double)reqs*1000000/duration;
-  recv_mbps = (long double)recv_bytes/duration*1000000;
-  sent_mbps = (long double)sent_bytes/duration*1000000;
-  fprintf(stdout, "Time: %0.2Lfs\n", (long double)duration/1000000);
-  format_bytes(s1, sent_bytes); format_bytes(s2, sent_mbps);
+void summary_print(const summary *s) {
+  char s1[12], s2[12];
+  long double rps, sent_mbps, recv_mbps;
+
+  rps = (long double)s->reqs*1000000/s->duration;
+  recv_mbps = (long double)s->recv/s->duration*1000000;
+  sent_mbps = (long double)s->sent/s->duration*1000000;
+  fprintf(stdout, "Time: %0.2Lfs\n", (long double)s->duration/1000000);
+  format_bytes(s1, s->sent); format_bytes(s2, sent_mbps);
   fprintf(stdout, "Sent: %s, %s/s\n", s1, s2);
-  format_bytes(s1, recv_bytes); format_bytes(s2, recv_mbps);
+  format_bytes(s1, s->recv); format_bytes(s2, recv_mbps);
   fprintf(stdout, "Recv: %s, %s/s\n", s1, s2);
-  fprintf(stdout, "Hits: %"PRIu64", %0.2Lf/s\n", reqs, rps);
-  if (stats.err_conn || stats.err_status || stats.err_parser)
-    fprintf(stdout, "Errors connection: %"PRIu64", status: %"PRIu64", parser: %"PRIu64"\n", stats.err_conn, stats.err_status, stats.err_parser);
+  fprintf(stdout, "Hits: %"PRIu64", %0.2Lf/s\n", s->reqs, rps);
+  if (s->latency.count) hist_print("Latency", &s->latency);
+  if (s->tls_handshake.count) {
+    uint64_t handshakes = s->tls_full + s->tls_resumed;
+
+    /* the figure TLS terminators are sized by */
+    fprintf(stdout, "TLS handshakes: %"PRIu64", %0.2Lf/s, full: %"PRIu64", resumed: %"PRIu64" (%0.2Lf%%)\n",
+      handshakes, (long double)handshakes*1000000/s->duration, s->tls_full, s->tls_resumed,
+      (long double)s->tls_resumed*100/handshakes);
+    hist_print("TLS handshake", &s->tls_handshake);
+  }
+  if (s->err_conn || s->err_status || s->err_parser || s->err_check)
+    fprintf(stdout, "Errors connection: %"PRIu64", status: %"PRIu64", parser: %"PRIu64", check: %"PRIu64"\n",
+      s->err_conn, s->err_status, s->err_parser, s->err_check);
+}
+
+/* Merge the per-target results of the (finished) worker thread t into stats.targets; takes its histograms */
+static void targets_merge(thread *t) {
+  target_summary *ts;
+  const thread_counters *tc;
+  int i, n;
+
+  for (i = 0; i < defs_n; i++) {
+    ts = &stats.targets[i];
+    tc = &t->counters[i];
+    ts->reqs += tc->reqs;
+    ts->sent += tc->sent;
+    ts->recv += tc->recv;
+    ts->connects += tc->connects;
+    for (n = 0; n < 5; n++) ts->status[n] += tc->status[n];
+    ts->err_conn += tc->err_conn;
+    ts->err_status += tc->err_status;
+    ts->err_parser += tc->err_parser;
+    ts->err_check += tc->err_check;
+    if (!t->target_latency[i]) continue;
+    if (ts->latency) {
+      hist_merge(ts->latency, t->target_latency[i]);
+      free(t->target_latency[i]);
+    } else {
+      ts->latency = t->target_latency[i];
+    }
+    t->target_latency[i] = NULL;
+  }
+}
+
+/* Print the results of every request definition (--per-target) */
+static void targets_print(const summary *s) {
+  const target_summary *ts;
+  char name[BUFSIZ], s1[12], s2[12];
+  long double secs = (long double)s->duration / 1000000;
+  int i;
+
+  for (i = 0; i < defs_n; i++) {
+    ts = &stats.targets[i];
+    fprintf(stdout, "Target %d: %s, clients: %d, connections: %"PRIu64"\n",
+      i, request_def_name(name, sizeof(name), &defs[i]), defs[i].clients, ts->connects);
+    format_bytes(s1, ts->sent); format_bytes(s2, ts->sent / secs);
+    fprintf(stdout, "  Sent: %s, %s/s", s1, s2);
+    format_bytes(s1, ts->recv); format_bytes(s2, ts->recv / secs);
+    fprintf(stdout, ", Recv: %s, %s/s\n", s1, s2);
+    fprintf(stdout, "  Hits: %"PRIu64", %0.2Lf/s, 1xx: %"PRIu64", 2xx: %"PRIu64", 3xx: %"PRIu64", 4xx: %"PRIu64", 5xx: %"PRIu64"\n",
+      ts->reqs, ts->reqs / secs, ts->status[0], ts->status[1], ts->status[2], ts->status[3], ts->status[4]);
+    if (ts->latency) hist_print("  Latency", ts->latency);
+    if (ts->err_conn || ts->err_status || ts->err_parser || ts->err_check)
+      fprintf(stdout, "  Errors connection: %"PRIu64", status: %"PRIu64", parser: %"PRIu64", check: %"PRIu64"\n",
+        ts->err_conn, ts->err_status, ts->err_parser, ts->err_check);
+  }
+}
+
+static void json_string_write(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+    else fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static void json_hist_write(FILE *f, const hist *h) {
+  int n;
+
+  fprintf(f, "{\"count\":%"PRIu64",\"min\":%"PRIu64, h->count, h->count? h->min: 0);
+  for (n = 0; n < sizeof(percentiles)/sizeof(percentiles[0]); n++)
+    fprintf(f, ",\"p%g\":%"PRIu64, percentiles[n], hist_percentile(h, percentiles[n]));
+  fprintf(f, ",\"max\":%"PRIu64"}", h->max);
+}
+
+/* Write the results to the file cfg.summary_json in JSON (--summary-json); latencies in [us] */
+static void summary_json_write(const summary *s) {
+  const target_summary *ts;
+  long double secs = (long double)s->duration / 1000000;
+  char name[BUFSIZ];
+  FILE *f;
+  int i, n;
+
+  if ((f = fopen(cfg.summary_json, "w")) == NULL) {
+    error("cannot open file `%s' for writing: %s (%d)\n", cfg.summary_json, strerror(errno), errno);
+    return;
+  }
+
+  fprintf(f, "{\"duration\":%0.3Lf,\"reqs\":%"PRIu64",\"rps\":%0.2Lf,\"sent\":%"PRIu64",\"recv\":%"PRIu64","
+    "\"errors\":{\"connection\":%"PRIu64",\"status\":%"PRIu64",\"parser\":%"PRIu64",\"check\":%"PRIu64"},\"latency\":",
+    secs, s->reqs, s->reqs / secs, s->sent, s->recv, s->err_conn, s->err_status, s->err_parser, s->err_check);
+  json_hist_write(f, &s->latency);
+  if (stats.kernel_latency.count) {
+    fprintf(f, ",\"kernel_latency\":");
+    json_hist_write(f, &stats.kernel_latency);
+  }
+  if (s->tls_full + s->tls_resumed) {
+    fprintf(f, ",\"tls\":{\"full\":%"PRIu64",\"resumed\":%"PRIu64",\"handshake\":", s->tls_full, s->tls_resumed);
+    json_hist_write(f, &s->tls_handshake);
+    fprintf(f, "}");
+  }
+
+  if (stats.self.loop.polls) {
+    const self_counters *sc = &stats.self;
+
+    fprintf(f, ",\"self\":{\"busy\":%0.1f,\"busy_max\":%0.1f,\"busy_max_thread\":%d,\"wakeups\":%llu,\"events\":%llu,"
+      "\"reads\":%"PRIu64",\"reads_eagain\":%"PRIu64",\"writes\":%"PRIu64",\"writes_eagain\":%"PRIu64","
+      "\"timers\":%llu,\"timers_late\":%llu,\"lag\":{\"count\":%"PRIu64",\"avg\":%"PRIu64",\"max\":%"PRIu64"}}",
+      self_busy(stats.self_loop_us, sc->loop.wait_us), stats.self_busy_max, stats.self_busy_thread, sc->loop.polls, sc->loop.events,
+      sc->reads, sc->reads_eagain, sc->writes, sc->writes_eagain, sc->loop.timers, sc->loop.timers_late,
+      sc->lag_n, sc->lag_n? sc->lag_sum / sc->lag_n: 0, sc->lag_max);
+  }
+
+  fprintf(f, ",\"targets\":[");
+  for (i = 0; i < defs_n; i++) {
+    ts = &stats.targets[i];
+    fprintf(f, "%s{\"target\":%d,\"request\":", i? ",": "", i);
+    json_string_write(f, request_def_name(name, sizeof(name), &defs[i]));
+    fprintf(f, ",\"clients\":%d,\"connections\":%"PRIu64",\"reqs\":%"PRIu64",\"rps\":%0.2Lf,"
+      "\"sent\":%"PRIu64",\"recv\":%"PRIu64",\"status\":{",
+      defs[i].clients, ts->connects, ts->reqs, ts->reqs / secs, ts->sent, ts->recv);
+    for (n = 0; n < 5; n++)
+      fprintf(f, "%s\"%dxx\":%"PRIu64, n? ",": "", n + 1, ts->status[n]);
+    fprintf(f, "},\"errors\":{\"connection\":%"PRIu64",\"status\":%"PRIu64",\"parser\":%"PRIu64",\"check\":%"PRIu64"},\"latency\":",
+      ts->err_conn, ts->err_status, ts->err_parser, ts->err_check);
+    if (ts->latency) json_hist_write(f, ts->latency);
+    else fprintf(f, "{\"count\":0}");
+    fprintf(f, "}");
+  }
+  fprintf(f, "]}\n");
+
+  if (fclose(f)) error("cannot write file `%s': %s (%d)\n", cfg.summary_json, strerror(errno), errno);
+}
+
+/* Sum up the counters and latencies of the (running) worker threads */
+static void interval_snapshot(summary *s, const thread *threads) {
+  const thread *t;
+  const thread_counters *tc;
+
+  memset(s, 0, sizeof(*s));
+  hist_init(&s->latency);
+  hist_init(&s->tls_handshake);
+  s->duration = time_us() - stats.start;
+  for (t = threads; t < threads + cfg.threads; t++) {
+    for (tc = t->counters; tc < t->counters + defs_n; tc++) {
+      s->reqs += COUNTER_GET(tc->reqs);
+      s->sent += COUNTER_GET(tc->sent);
+      s->recv += COUNTER_GET(tc->recv);
+      s->err_conn += COUNTER_GET(tc->err_conn);
+      s->err_status += COUNTER_GET(tc->err_status);
+      s->err_parser += COUNTER_GET(tc->err_parser);
+      s->err_check += COUNTER_GET(tc->err_check);
+    }
+    hist_merge(&s->latency, &t->latency);
+  }
+}
+
+/*
+ * Sum up the overhead counters of the (running) worker threads into s and return the busy
+ * shares of their event loops since the last call: the average in *busy_avg, the highest in
+ * *busy_max.
+ */
+static void self_snapshot(self_counters *s, const thread *threads, double *busy_avg, double *busy_max) {
+  static struct {
+    uint64_t time;		/* time [us] since the Epoch of the last call */
+    uint64_t wait_us;		/* the loop's waiting time at the last call */
+  } *prev;			/* per worker thread */
+  uint64_t now = time_us(), loop_sum = 0, wait_sum = 0;
+  int i;
+
+  if (!prev && (prev = calloc(cfg.threads, sizeof(*prev))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for the interval reports\n");
+
+  memset(s, 0, sizeof(*s));
+  *busy_max = 0;
+  for (i = 0; i < cfg.threads; i++) {
+    const thread *t = &threads[i];
+    uint64_t start = COUNTER_GET(t->self.loop_start), end = COUNTER_GET(t->self.loop_end);
+    uint64_t wait_us = COUNTER_GET(t->self.loop.wait_us), from = MAX(prev[i].time, start), to = end? end: now;
+
+    if (start && to > from) {
+      loop_sum += to - from;
+      wait_sum += wait_us - prev[i].wait_us;
+      *busy_max = MAX(*busy_max, self_busy(to - from, wait_us - prev[i].wait_us));
+    }
+    prev[i].time = now;
+    prev[i].wait_us = wait_us;
+    self_add(s, &t->self);
+  }
+  *busy_avg = self_busy(loop_sum, wait_sum);
+}
+
+/*
+ * Report the results of the last interval (--interval).  The worker threads are not stopped or
+ * locked: their counters are read while they keep running, the interval is the difference of
+ * two such snapshots.
+ */
+static void interval_report(const thread *threads, summary *prev) {
+  static summary cur, diff;		/* large, keep them off the stack */
+  static self_counters self_prev;
+  self_counters self;
+  summary *d = &diff;
+  long double secs, elapsed;
+  double busy_avg, busy_max;
+  char s1[12], s2[12], s3[12];
+  int n;
+
+  interval_snapshot(&cur, threads);
+  self_snapshot(&self, threads, &busy_avg, &busy_max);
+  *d = cur;
+  hist_sub(&d->latency, &prev->latency);
+  d->duration -= prev->duration;
+  d->reqs -= prev->reqs;
+  d->sent -= prev->sent;
+  d->recv -= prev->recv;
+  d->err_conn -= prev->err_conn;
+  d->err_status -= prev->err_status;
+  d->err_parser -= prev->err_parser;
+  d->err_check -= prev->err_check;
+  *prev = cur;				/* the base of the next interval */
+  secs = (long double)d->duration / 1000000;
+  elapsed = (long double)cur.duration / 1000000;
+
+  fprintf(stdout, "[%0.1Lfs] Hits: %"PRIu64", %0.2Lf/s, Sent: %s/s, Recv: %s/s",
+    elapsed, d->reqs, d->reqs / secs, format_bytes(s1, d->sent / secs), format_bytes(s2, d->recv / secs));
+  if (d->err_conn || d->err_status || d->err_parser || d->err_check)
+    fprintf(stdout, ", Errors: %"PRIu64"/%"PRIu64"/%"PRIu64"/%"PRIu64, d->err_conn, d->err_status, d->err_parser, d->err_check);
+  if (d->latency.count) {
+    fprintf(stdout, ", Latency:");
+    for (n = 0; n < sizeof(percentiles)/sizeof(percentiles[0]); n++)
+      fprintf(stdout, " p%g %s", percentiles[n], format_time(s3, hist_percentile(&d->latency, percentiles[n])));
+    fprintf(stdout, " max %s", format_time(s3, d->latency.max));
+  }
+  fprintf(stdout, ", Busy: %0.0f%%, max %0.0f%%\n", busy_avg, busy_max);
+  fflush(stdout);
+
+  /* the counters of the interval */
+  self.loop.polls -= self_prev.loop.polls;
+  self.loop.events -= self_prev.loop.events;
+  self.loop.timers -= self_prev.loop.timers;
+  self.loop.timers_late -= self_prev.loop.timers_late;
+  self.reads -= self_prev.reads;
+  self.reads_eagain -= self_prev.reads_eagain;
+  self.writes -= self_prev.writes;
+  self.writes_eagain -= self_prev.writes_eagain;
+  self.lag_n -= self_prev.lag_n;
+  self.lag_sum -= self_prev.lag_sum;
+  self_prev.loop.polls += self.loop.polls;
+  self_prev.loop.events += self.loop.events;
+  self_prev.loop.timers += self.loop.timers;
+  self_prev.loop.timers_late += self.loop.timers_late;
+  self_prev.reads += self.reads;
+  self_prev.reads_eagain += self.reads_eagain;
+  self_prev.writes += self.writes;
+  self_prev.writes_eagain += self.writes_eagain;
+  self_prev.lag_n += self.lag_n;
+  self_prev.lag_sum += self.lag_sum;
+
+  if (!stats.interval_fd) return;
+
+  fprintf(stats.interval_fd, "{\"time\":%"PRIu64",\"elapsed\":%0.3Lf,\"interval\":%0.3Lf,"
+    "\"reqs\":%"PRIu64",\"rps\":%0.2Lf,\"sent\":%"PRIu64",\"recv\":%"PRIu64","
+    "\"err_conn\":%"PRIu64",\"err_status\":%"PRIu64",\"err_parser\":%"PRIu64",\"err_check\":%"PRIu64","
+    "\"latency\":{\"count\":%"PRIu64",\"min\":%"PRIu64,
+    stats.start + cur.duration, elapsed, secs, d->reqs, d->reqs / secs, d->sent, d->recv,
+    d->err_conn, d->err_status, d->err_parser, d->err_check, d->latency.count, d->latency.count? d->latency.min: 0);
+  for (n = 0; n < sizeof(percentiles)/sizeof(percentiles[0]); n++)
+    fprintf(stats.interval_fd, ",\"p%g\":%"PRIu64, percentiles[n], hist_percentile(&d->latency, percentiles[n]));
+  fprintf(stats.interval_fd, ",\"max\":%"PRIu64"},\"self\":{\"busy\":%0.1f,\"busy_max\":%0.1f,\"wakeups\":%llu,\"events\":%llu,"
+    "\"reads\":%"PRIu64",\"reads_eagain\":%"PRIu64",\"writes\":%"PRIu64",\"writes_eagain\":%"PRIu64","
+    "\"timers\":%llu,\"timers_late\":%llu,\"lag_avg\":%"PRIu64"}}\n",
+    d->latency.max, busy_avg, busy_max, self.loop.polls, self.loop.events, self.reads, self.reads_eagain, self.writes,
+    self.writes_eagain, self.loop.timers, self.loop.timers_late, self.lag_n? self.lag_sum / self.lag_n: 0);
+  fflush(stats.interval_fd);
+}
+
+/* Print statistics; an agent reports them to its coordinator as well */
+void stats_print() {
+  summary s;
+
+  summary_get(&s);
+  if (cfg.agent_fd >= 0) dist_agent_report(&s);
+  summary_print(&s);
+  kernel_latency_print(&s);
+  replay_print(s.reqs);
+  self_print(&s);
+  if (cfg.per_target && stats.targets) targets_print(&s);
+  if (cfg.summary_json && stats.targets) summary_json_write(&s);
 }
 
 int stats_close() {
   if (stats.fd && stats.fd != stdout) fclose(stats.fd);
+  if (stats.interval_fd) fclose(stats.interval_fd);
+  if (stats.targets) {
+    int i;
+
+    for (i = 0; i < defs_n; i++) free(stats.targets[i].latency);
+    free(stats.targets); stats.targets = NULL;
+  }
 
   return 0;
 }
@@ -199,6 +714,9 @@ void exit_handler() {
   stats_print();
   stats_close();
   connections_free(cs);
+  request_defs_free(defs, defs_n);
+  replay_free();
+  free(random_data);
 #ifdef HAVE_SSL
   ssl_shutdown();
 #endif
@@ -233,6 +751,32 @@ void signals_set() {
     error("sigaction(): %s (%d)\n", strerror(errno), errno);
 }
 
+/* Return a copy of string v, or of the strings of array v joined by commas; name is the key of v. */
+static char *json_string_list(const json_value *v, const char *name) {
+  char *s;
+  size_t len = 0;
+  int i;
+
+  if (v->type == json_string) return mstrdup(v->u.string.ptr);
+  if (v->type != json_array || !v->u.array.length)
+    die(EXIT_FAILURE, "invalid input request file, string or non-empty array of strings expected for %s\n", name);
+
+  for (i = 0; i < v->u.array.length; i++) {
+    json_check_value(v->u.array.values[i], json_string, "string expected in the array");
+    len += v->u.array.values[i]->u.string.length + 1;
+  }
+  if ((s = malloc(len)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for %s\n", name);
+  for (len = 0, i = 0; i < v->u.array.length; i++) {
+    memcpy(s + len, v->u.array.values[i]->u.string.ptr, v->u.array.values[i]->u.string.length);
+    len += v->u.array.values[i]->u.string.length;
+    s[len++] = ',';
+  }
+  s[len - 1] = '\0';
+
+  return s;
+}
+
 static void json_check_value(const json_value *value, json_type type, const char *err) {
   if (value == NULL)
     return;
@@ -241,7 +785,7 @@ static void json_check_value(const json_value *value, json_type type, const char
     die(EXIT_FAILURE, "invalid input request file: %s\n", err);
 }
 
-static void json_process_connection_tcp_keep_alive(const json_value *value, connection *c) {
+static void json_process_connection_tcp_keep_alive(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
@@ -253,23 +797,23 @@ static void json_process_connection_tcp_keep_alive(const json_value *value, conn
     const json_value *v = value->u.object.values[i].value;
     if (!strcmp(k, "enable")) {
       json_check_value(v, json_boolean, "boolean expected for tcp.keep-alive.enable");
-      c->tcp.keep_alive.enable = v->u.boolean;
+      d->tcp.keep_alive.enable = v->u.boolean;
     } else if (!strcmp(k, "idle")) {
       json_check_value(v, json_integer, "integer expected for tcp.keep-alive.idle");
-      c->tcp.keep_alive.idle = v->u.integer;
+      d->tcp.keep_alive.idle = v->u.integer;
     } else if (!strcmp(k, "intvl")) {
       json_check_value(v, json_integer, "integer expected for tcp.keep-alive.intvl");
-      c->tcp.keep_alive.intvl = v->u.integer;
+      d->tcp.keep_alive.intvl = v->u.integer;
     } else if (!strcmp(k, "cnt")) {
       json_check_value(v, json_integer, "integer expected for tcp.keep-alive.cnt");
-      c->tcp.keep_alive.cnt = v->u.integer;
+      d->tcp.keep_alive.cnt = v->u.integer;
     } else {
       die(EXIT_FAILURE, "invalid input request file, key tcp.keep-alive.%s\n", k);
     }
   }
 }
 
-static void json_process_connection_tcp(const json_value *value, connection *c) {
+static void json_process_connection_tcp(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
@@ -281,26 +825,29 @@ static void json_process_connection_tcp(const json_value *value, connection *c)
     const json_value *v = value->u.object.values[i].value;
     if (!strcmp(k, "keep-alive")) {
       if (v->type == json_object)
-        json_process_connection_tcp_keep_alive(v, c);
+        json_process_connection_tcp_keep_alive(v, d);
       else
         die(EXIT_FAILURE, "invalid input request file, tcp not an object\n");
+    } else if (!strcmp(k, "zerocopy")) {
+      json_check_value(v, json_boolean, "boolean expected for tcp.zerocopy");
+      d->tcp.zerocopy = v->u.boolean;
     } else {
       die(EXIT_FAILURE, "invalid input request file, key tcp.%s\n", k);
     }
   }
 }
 
-static void json_process_connection_headers(const json_value *value, connection *c) {
+static void json_process_connection_headers(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
     return;
 
   length = value->u.object.length;
-  if ((c->headers = calloc(length + 1, sizeof(key_value))) == NULL)
+  if ((d->headers = calloc(length + 1, sizeof(key_value))) == NULL)
     die(EXIT_FAILURE, "calloc(): cannot allocate memory for headers\n");
 
-  key_value *kv = c->headers;
+  key_value *kv = d->headers;
   for (i = 0; i < length; i++, kv++) {
     const char *k = value->u.object.values[i].name;
     const json_value *v = value->u.object.values[i].value;
@@ -311,7 +858,7 @@ static void json_process_connection_headers(const json_value *value, connection
   }
 }
 
-static void json_process_connection_body(const json_value *value, connection *c) {
+static void json_process_connection_body(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
@@ -323,36 +870,39 @@ static void json_process_connection_body(const json_value *value, connection *c)
     const json_value *v = value->u.object.values[i].value;
     if (!strcmp(k, "content")) {
       json_check_value(v, json_string, "string expected for body.content");
-      if (c->req_body != NULL) free(c->req_body);
-      c->req_body = mstrdup(v->u.string.ptr);
+      if (d->req_body != NULL) free(d->req_body);
+      d->req_body = mstrdup(v->u.string.ptr);
     } else if (!strcmp(k, "size")) {
       json_check_value(v, json_integer, "integer expected for body.size");
-      c->req_body_size = v->u.integer;
+      d->req_body_size = v->u.integer;
+    } else if (!strcmp(k, "stream")) {
+      json_check_value(v, json_boolean, "boolean expected for body.stream");
+      d->req_body_stream = v->u.boolean;
     } else if (!strcmp(k, "type")) {
       json_check_value(v, json_string, "string expected for body.type");
       if (!strcmp(v->u.string.ptr, "random")) {
-        c->req_body_type = body_random;
+        d->req_body_type = body_random;
       } else if (!strcmp(v->u.string.ptr, "content")) {
-        c->req_body_type = body_content;
+        d->req_body_type = body_content;
       } else die(EXIT_FAILURE, "invalid body type: `%s'\n", v->u.string.ptr);
     } else {
       die(EXIT_FAILURE, "invalid input request file, key body.%s\n", k);
     }
   }
 
-  if (c->req_body_type == body_random) {
-    if (c->req_body) {
+  if (d->req_body_type == body_random) {
+    if (d->req_body) {
       warning("request body content provided but body random type specified; ignoring request's body.content\n");
-      free(c->req_body); c->req_body = NULL;
+      free(d->req_body); d->req_body = NULL;
     }
 
-    if (c->req_body_size == 0) {
+    if (d->req_body_size == 0) {
       die(EXIT_FAILURE, "request's body.size cannot be 0 when request's body random type is specified\n");
     }
   }
 }
 
-static void json_process_connection_delay(const json_value *value, connection *c) {
+static void json_process_connection_delay(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
@@ -364,21 +914,71 @@ static void json_process_connection_delay(const json_value *value, connection *c
     const json_value *v = value->u.object.values[i].value;
     if (!strcmp(k, "min")) {
       json_check_value(v, json_integer, "integer expected for delay.min");
-      c->delay_min = v->u.integer;
+      d->delay_min = v->u.integer;
     } else if (!strcmp(k, "max")) {
       json_check_value(v, json_integer, "integer expected for delay.max");
-      c->delay_max = v->u.integer;
+      d->delay_max = v->u.integer;
     } else {
       die(EXIT_FAILURE, "invalid input request file, key delay.%s\n", k);
     }
   }
 
-  if (c->delay_min > c->delay_max) {
-    die(EXIT_FAILURE, "invalid input request file, delay.min (%"PRIu64") > delay.max (%"PRIu64")\n", c->delay_min, c->delay_max);
+  if (d->delay_min > d->delay_max) {
+    die(EXIT_FAILURE, "invalid input request file, delay.min (%"PRIu64") > delay.max (%"PRIu64")\n", d->delay_min, d->delay_max);
+  }
+}
+
+static void json_process_connection_check(const json_value *value, request_def *d) {
+  int length, i;
+  char *end;
+
+  if (value == NULL)
+    return;
+
+  d->check.enable = true;
+  length = value->u.object.length;
+  for (i = 0; i < length; i++) {
+    const char *k = value->u.object.values[i].name;
+    const json_value *v = value->u.object.values[i].value;
+    if (!strcmp(k, "length")) {
+      json_check_value(v, json_integer, "integer expected for check.length");
+      if (v->u.integer < 0) die(EXIT_FAILURE, "check.length must be >= 0\n");
+      d->check.length = v->u.integer;
+    } else if (!strcmp(k, "contains")) {
+      json_check_value(v, json_string, "string expected for check.contains");
+      if (d->check.contains != NULL) free(d->check.contains);
+      d->check.contains = mstrdup(v->u.string.ptr);
+    } else if (!strcmp(k, "regex")) {
+      json_check_value(v, json_string, "string expected for check.regex");
+      if (d->check.regex_src != NULL) free(d->check.regex_src);
+      d->check.regex_src = mstrdup(v->u.string.ptr);
+    } else if (!strcmp(k, "window")) {
+      json_check_value(v, json_integer, "integer expected for check.window");
+      if (v->u.integer < 1 || v->u.integer > CHECK_WINDOW_MAX)
+        die(EXIT_FAILURE, "check.window must be between 1 and %lu\n", CHECK_WINDOW_MAX);
+      d->check.window = v->u.integer;
+    } else if (!strcmp(k, "crc32c")) {
+      /* a hexadecimal string as printed by most tools, or a number */
+      if (v->type == json_integer && v->u.integer >= 0 && v->u.integer <= UINT32_MAX) {
+        d->check.crc32c = v->u.integer;
+      } else if (v->type == json_string) {
+        unsigned long crc = strtoul(v->u.string.ptr, &end, 16);
+        if (!*v->u.string.ptr || *end || crc > UINT32_MAX)
+          die(EXIT_FAILURE, "invalid check.crc32c %s\n", v->u.string.ptr);
+        d->check.crc32c = crc;
+      } else die(EXIT_FAILURE, "invalid input request file: hexadecimal string expected for check.crc32c\n");
+      d->check.crc = true;
+    } else if (!strcmp(k, "sample")) {
+      json_check_value(v, json_integer, "integer expected for check.sample");
+      if (v->u.integer < 1) die(EXIT_FAILURE, "check.sample must be >= 1\n");
+      d->check.sample = v->u.integer;
+    } else {
+      die(EXIT_FAILURE, "invalid input request file, key check.%s\n", k);
+    }
   }
 }
 
-static void json_process_connection_close(const json_value *value, connection *c) {
+static void json_process_connection_close(const json_value *value, request_def *d) {
   int length, i;
 
   if (value == NULL)
@@ -390,19 +990,39 @@ static void json_process_connection_close(const json_value *value, connection *c
     const json_value *v = value->u.object.values[i].value;
     if (!strcmp(k, "client")) {
       json_check_value(v, json_boolean, "boolean expected for close.client");
-      c->close_client = v->u.boolean;
+      d->close_client = v->u.boolean;
     } else if (!strcmp(k, "linger")) {
       json_check_value(v, json_integer, "integer expected for close.linger");
-      c->close_linger = true;
-      c->close_linger_sec = v->u.integer;
+      d->close_linger = true;
+      d->close_linger_sec = v->u.integer;
     } else {
       die(EXIT_FAILURE, "invalid input request file, key close.%s\n", k);
     }
   }
 }
 
-static int json_process_connection(const json_value *value, connection *c) {
-  int length, i, clients = 1;
+static void scheme_parse(request_def *d, const char *s) {
+  if (!strcmp(s, "http")) d->scheme = http;
+  else if (!strcmp(s, "https")) {
+#ifndef HAVE_SSL
+    die(EXIT_FAILURE, "ssl support not compiled in\n");
+#endif
+    d->scheme = https;
+    cfg.ssl = true;
+  }
+  else if (!strcmp(s, "h2")) {
+#ifndef HAVE_SSL
+    die(EXIT_FAILURE, "ssl support not compiled in\n");
+#endif
+    d->scheme = h2;
+    cfg.ssl = true;
+  }
+  else if (!strcmp(s, "h2c")) d->scheme = h2c;
+  else die(EXIT_FAILURE, "invalid scheme %s\n", s);
+}
+
+static int json_process_connection(const json_value *value, request_def *d) {
+  int length, i;
 
   if (value == NULL)
     return -1;
@@ -411,7 +1031,7 @@ static int json_process_connection(const json_value *value, connection *c) {
     return -1;
 
   /* set the defaults */
-  connection_init(c);
+  request_def_init(d);
 
   length = value->u.object.length;
   for (i = 0; i < length; i++) {
@@ -421,7 +1041,7 @@ static int json_process_connection(const json_value *value, connection *c) {
     if (!strcmp(k, "tcp")) {
       /* TCP-related options */
       if (v->type == json_object)
-        json_process_connection_tcp(v, c);
+        json_process_connection_tcp(v, d);
       else
         die(EXIT_FAILURE, "invalid input request file, tcp not an object\n");
 
@@ -431,7 +1051,7 @@ static int json_process_connection(const json_value *value, connection *c) {
     if (!strcmp(k, "delay")) {
       /* delay.min/max */
       if (v->type == json_object)
-        json_process_connection_delay(v, c);
+        json_process_connection_delay(v, d);
       else
         die(EXIT_FAILURE, "invalid input request file, delay not an object\n");
 
@@ -441,7 +1061,7 @@ static int json_process_connection(const json_value *value, connection *c) {
     if (!strcmp(k, "headers")) {
       /* headers */
       if (v->type == json_object)
-        json_process_connection_headers(v, c);
+        json_process_connection_headers(v, d);
       else
         die(EXIT_FAILURE, "invalid input request file, headers not an object\n");
 
@@ -451,22 +1071,31 @@ static int json_process_connection(const json_value *value, connection *c) {
     if (!strcmp(k, "body")) {
       /* body */
       if (v->type == json_object) {
-        json_process_connection_body(v, c);
-        if (c->req_body_type == body_random) request_initialize_body_random(c, i);
+        json_process_connection_body(v, d);
       } else if (v->type == json_string) {
         /* versions up to 0.1.5 used string for "body", provide some backward compatibility */
-        if (c->req_body != NULL) free(c->req_body);
-        c->req_body = mstrdup(v->u.string.ptr);
+        if (d->req_body != NULL) free(d->req_body);
+        d->req_body = mstrdup(v->u.string.ptr);
         warning("using string type for request body is deprecated, please change your input request file\n");
       } else die(EXIT_FAILURE, "invalid input request file, headers not an object\n");
 
       continue;
     }
 
+    if (!strcmp(k, "check")) {
+      /* check.length/contains/regex/window/crc32c/sample */
+      if (v->type == json_object)
+        json_process_connection_check(v, d);
+      else
+        die(EXIT_FAILURE, "invalid input request file, check not an object\n");
+
+      continue;
+    }
+
     if (!strcmp(k, "close")) {
       /* close.client/linger */
       if (v->type == json_object)
-        json_process_connection_close(v, c);
+        json_process_connection_close(v, d);
       else
         die(EXIT_FAILURE, "invalid input request file, close not an object\n");
 
@@ -474,200 +1103,570 @@ static int json_process_connection(const json_value *value, connection *c) {
     }
 
     if (!strcmp(k, "host_from")) {
-      json_check_value(v, json_string, "string expected for host_from");
-      if (c->host_from != NULL) free(c->host_from);
-      c->host_from = mstrdup(v->u.string.ptr);
+      if (d->host_from != NULL) free(d->host_from);
+      d->host_from = json_string_list(v, "host_from");
+    } else if (!strcmp(k, "port_from")) {
+      char *end;
+      long lo, hi;
+
+      json_check_value(v, json_string, "string expected for port_from");
+      lo = strtol(v->u.string.ptr, &end, 10);
+      hi = (*end == '-')? strtol(end + 1, &end, 10): -1;
+      if (*end || lo < 1 || hi < lo || hi > 65535)
+        die(EXIT_FAILURE, "invalid input request file, port_from `%s' not a <first>-<last> port range\n", v->u.string.ptr);
+      d->port_from.lo = lo;
+      d->port_from.hi = hi;
     } else if (!strcmp(k, "host")) {
       json_check_value(v, json_string, "string expected for host");
-      if (c->host != NULL) free(c->host);
-      c->host = mstrdup(v->u.string.ptr);
+      if (d->host != NULL) free(d->host);
+      d->host = mstrdup(v->u.string.ptr);
     } else if (!strcmp(k, "port")) {
       json_check_value(v, json_integer, "integer expected for port");
-      c->port = v->u.integer;
+      d->port = v->u.integer;
     } else if (!strcmp(k, "scheme")) {
       json_check_value(v, json_string, "string expected for scheme");
-      if (!strcmp(v->u.string.ptr, "http")) c->scheme = http;
-      else if (!strcmp(v->u.string.ptr, "https")) {
-#ifndef HAVE_SSL
-        die(EXIT_FAILURE, "ssl support not compiled in\n");
-#endif
-        c->scheme = https;
-        cfg.ssl = true;
-      }
-      else die(EXIT_FAILURE, "invalid scheme %s\n", v);
+      scheme_parse(d, v->u.string.ptr);
     } else if (!strcmp(k, "method")) {
       json_check_value(v, json_string, "string expected for method");
-      if (c->method != NULL) free(c->method);
-      c->method = mstrdup(v->u.string.ptr);
+      if (d->method != NULL) free(d->method);
+      d->method = mstrdup(v->u.string.ptr);
     } else if (!strcmp(k, "path")) {
       json_check_value(v, json_string, "string expected for path");
-      if (c->path != NULL) free(c->path);
-      c->path = mstrdup(v->u.string.ptr);
+      if (d->path != NULL) free(d->path);
+      d->path = mstrdup(v->u.string.ptr);
+    } else if (!strcmp(k, "values")) {
+      json_check_value(v, json_string, "string expected for values");
+      if (d->values_file != NULL) free(d->values_file);
+      d->values_file = mstrdup(v->u.string.ptr);
     } else if (!strcmp(k, "max-requests")) {
       json_check_value(v, json_integer, "integer expected for max-requests");
-      c->reqs_max = v->u.integer;
-      if (c->reqs_max < 0) die(EXIT_FAILURE, "max-requests must be >= 0\n", optarg);
+      d->reqs_max = v->u.integer;
+      if (d->reqs_max < 0) die(EXIT_FAILURE, "max-requests must be >= 0\n", optarg);
     } else if (!strcmp(k, "keep-alive-requests")) {
       json_check_value(v, json_integer, "integer expected for keep-alive-requests");
-      c->keep_alive_reqs = v->u.integer;
-      if (c->keep_alive_reqs < 0) die(EXIT_FAILURE, "keep-alive-requests must be >= 0\n", optarg);
+      d->keep_alive_reqs = v->u.integer;
+      if (d->keep_alive_reqs < 0) die(EXIT_FAILURE, "keep-alive-requests must be >= 0\n", optarg);
+    } else if (!strcmp(k, "pipeline")) {
+      json_check_value(v, json_integer, "integer expected for pipeline");
+      if (v->u.integer < 1 || v->u.integer > PIPELINE_MAX)
+        die(EXIT_FAILURE, "pipeline must be between 1 and %d\n", PIPELINE_MAX);
+      d->pipeline = v->u.integer;
+    } else if (!strcmp(k, "streams")) {
+      json_check_value(v, json_integer, "integer expected for streams");
+      if (v->u.integer < 1 || v->u.integer > H2_STREAMS_MAX)
+        die(EXIT_FAILURE, "streams must be between 1 and %d\n", H2_STREAMS_MAX);
+      d->streams = v->u.integer;
     } else if (!strcmp(k, "tls-session-reuse")) {
       json_check_value(v, json_boolean, "boolean expected for tls-session-reuse");
-      c->tls_session_reuse = v->u.boolean;
+      d->tls_session_reuse = v->u.boolean;
+    } else if (!strcmp(k, "tls-session-reuse-ratio")) {
+      if (v->type == json_integer) d->tls_session_reuse_ratio = v->u.integer;
+      else if (v->type == json_double) d->tls_session_reuse_ratio = v->u.dbl;
+      else die(EXIT_FAILURE, "invalid input request file: number expected for tls-session-reuse-ratio\n");
+      if (d->tls_session_reuse_ratio < 0 || d->tls_session_reuse_ratio > 1)
+        die(EXIT_FAILURE, "tls-session-reuse-ratio must be between 0 and 1\n");
+    } else if (!strcmp(k, "tls-session-shared")) {
+      json_check_value(v, json_boolean, "boolean expected for tls-session-shared");
+      d->tls_session_shared = v->u.boolean;
     } else if (!strcmp(k, "clients")) {
       json_check_value(v, json_integer, "integer expected for clients");
-      clients = v->u.integer;
-      if (clients > MB_MAX_CLIENTS)
-        die(EXIT_FAILURE, "too many clients specified for a request (%d > %d)\n", clients, MB_MAX_CLIENTS);
+      d->clients = v->u.integer;
+      if (d->clients > MB_MAX_CLIENTS)
+        die(EXIT_FAILURE, "too many clients specified for a request (%d > %d)\n", d->clients, MB_MAX_CLIENTS);
     } else if (!strcmp(k, "ramp-up")) {
       json_check_value(v, json_integer, "integer expected for ramp-up time");
-      c->ramp_up = v->u.integer;
+      d->ramp_up = v->u.integer;
+    } else if (!strcmp(k, "rate")) {
+      json_check_value(v, json_integer, "integer expected for rate");
+      if (v->u.integer < 0) die(EXIT_FAILURE, "rate must be >= 0\n");
+      d->rate.reqs = v->u.integer;
     } else {
       die(EXIT_FAILURE, "invalid input request file, key %s\n", k);
     }
   }
 
-  if (!c->host) {
+  return request_def_check(d);
+}
+
+/* Validate request definition d of any input request file format, prepare its requests; return its number of clients */
+static int request_def_check(request_def *d) {
+  if (!d->host) {
     die(EXIT_FAILURE, "invalid input request file, host not defined\n");
   }
 
-  if (!c->port) {
+  if (!d->port) {
     die(EXIT_FAILURE, "invalid input request file, port not defined\n");
   }
 
-  /* resolve the target host and service */
-  if (!c->addr_to) {
-    /* translating addresses comes at a cost, cache the structures */
-    if (host_resolve(c->host, c->port, &c->addr_to) < 0)
-      die(EXIT_FAILURE, "cannot resolve: %s:%d\n", c->host, c->port);
+  if (d->port_from.hi && !d->host_from) {
+    die(EXIT_FAILURE, "invalid input request file, port_from needs host_from\n");
+  }
+
+  if (d->pipeline > 1) {
+    /* the requests in flight are written back-to-back and matched to the responses in order */
+    if (d->rate.reqs || d->delay_max)
+      die(EXIT_FAILURE, "pipeline cannot be combined with rate or delay\n");
+    if (d->req_body_type == body_random)
+      die(EXIT_FAILURE, "pipeline cannot be combined with the random body type\n");
+  }
+
+  /* the kernel timestamps are matched to the responses with a single request in flight, not read through TLS */
+  d->timestamping = cfg.timestamping && d->scheme == http && d->pipeline <= 1;
+  if (cfg.timestamping && !d->timestamping)
+    warning("timestamping needs plain HTTP/1.1 without pipelining; not timestamping %s:%d\n", d->host, d->port);
+
+  if (d->scheme == h2 || d->scheme == h2c) {
+    /* the requests of a connection are multiplexed on "streams" concurrent streams */
+    if (d->rate.reqs || d->delay_max)
+      die(EXIT_FAILURE, "HTTP/2 cannot be combined with rate or delay\n");
+    if (d->pipeline > 1)
+      die(EXIT_FAILURE, "HTTP/2 cannot be combined with pipeline, use streams\n");
+    if (d->req_body_type == body_random)
+      die(EXIT_FAILURE, "HTTP/2 cannot be combined with the random body type\n");
+    if (cfg.cookies)
+      warning("cookies are not supported over HTTP/2, ignoring them for %s:%d\n", d->host, d->port);
+  } else if (d->streams > 1) {
+    warning("streams specified for a non-HTTP/2 scheme; ignoring\n");
+    d->streams = 1;
   }
 
-  /* resolve the source host if any */
-  if (c->host_from) {
-    if (host_resolve(c->host_from, 0, &c->addr_from) < 0)
-      die(EXIT_FAILURE, "cannot resolve: %s\n", c->host_from);
+  if (d->rate.reqs) {
+    /* open-loop: every client sends its share of the requests at a fixed interval */
+    if (d->delay_max || d->ramp_up)
+      warning("request rate specified; ignoring request's delay and ramp-up\n");
+    d->delay_min = d->delay_max = d->ramp_up = 0;
+    d->rate.interval = MAX((uint64_t)d->clients * 1000000 / d->rate.reqs, 1);
   }
 
-  /* prepare HTTP data to send over a socket */
-  http_requests_create(c);
+  if (d->req_body_type == body_random) {
+    /* TE chunk headers of the plain HTTP sendmsg() path; never modified later (MSG_ZEROCOPY) */
+    size_t chunk_len = MIN(d->req_body_size, CHUNK_IOV);
+    snprintf(d->chunk_hdr[0], sizeof(d->chunk_hdr[0]), "%lX" HTTP_CRLF, chunk_len);
+    snprintf(d->chunk_hdr[1], sizeof(d->chunk_hdr[1]), "%lX" HTTP_CRLF, d->req_body_size % chunk_len);
+  }
+
+  if (d->check.enable) {
+    /* the bodies are only seen by the HTTP/1.1 parser */
+    if (d->scheme == h2 || d->scheme == h2c)
+      die(EXIT_FAILURE, "response checks are not supported over HTTP/2\n");
+    check_def_init(d);
+    parser_settings.on_message_begin = check_message_begin;
+    parser_settings.on_body = check_body;
+  }
 
-  return clients;
+  /* prepare HTTP data to send over a socket, shared by the connections */
+  request_def_requests_create(d);
+
+  if (d->tmpl[0]) {
+    /* the slots are filled in the HTTP/1.1 request headers rendered for every request */
+    if (d->scheme == h2 || d->scheme == h2c)
+      die(EXIT_FAILURE, "request templates cannot be combined with HTTP/2\n");
+    if (cfg.cookies)
+      die(EXIT_FAILURE, "request templates cannot be combined with cookies\n");
+    if (d->tcp.zerocopy && d->req_body_type == body_random && !d->req_body_stream)
+      die(EXIT_FAILURE, "request templates cannot be combined with zerocopy\n");
+  }
+
+  return d->clients;
 }
 
-static int json_process_connections(const json_value *value) {
-  int i, j;
-  int length, ret, connections;
-  connection *c = cs;
-  connection *cs_ptr;
+/* Add the request definition parsed into defs[defs_n]; return the number of its clients we run */
+static int request_def_add() {
+  request_def *d = defs + defs_n;
 
-  if (value == NULL)
-    return 0;
+  d->target = defs_n++;
+  if (cfg.shards > 1)
+    /* distributed mode: our share of the clients, the remainders of different requests go to different agents */
+    d->clients = d->clients / cfg.shards + ((d->target + cfg.shard_id) % cfg.shards < d->clients % cfg.shards);
 
-  length = value->u.array.length;
-  if (!length) die(EXIT_FAILURE, "no requests found in the input request file\n");
-  connections = length;
-  for (i = 0; i < length; i++) {
-    if (value->u.array.values[i]->type != json_object)
-      die(EXIT_FAILURE, "invalid input request file\n");
-
-    ret = json_process_connection(value->u.array.values[i], c);
-    if (ret < 0)
-      die(EXIT_FAILURE, "invalid input request file (array %d)\n", i);
-
-    if (ret > 1) {
-      int offset = c - cs;
-      connections += ret - 1;
-      /* we have more than one client/connection per a given request */
-      if ((cs = realloc(cs, (connections + 1) * sizeof(connection))) == NULL) {
-        die(EXIT_FAILURE, "realloc() failed: %s (%d)\n", strerror(errno), errno);
-      }
-      /* copy the connection data to the uninitialised connections that follow */
-      c = cs + offset;
-      for (j = 1; j < ret; j++) {
-        cs_ptr = c + j;
-        memcpy(cs_ptr, c, sizeof(connection));
-        if (cs_ptr->req_body_type == body_random) request_initialize_body_random(cs_ptr, j);
-        cs_ptr->request = NULL;		/* shallow copy, prevent `free's when calling http_requests_create() */
-        cs_ptr->request_cclose = NULL;	/* shallow copy, prevent `free's when calling http_requests_create() */
-        http_requests_create(cs_ptr);	/* prepare HTTP data to send over a socket */
-        cs_ptr->duplicate = true;	/* do not free any data structures on this connection */
-      }
-      c = cs + offset + ret;
-      continue;
+  return d->clients;
+}
+
+/* Create the connections of all the request definitions at once */
+static void connections_create(int connections) {
+  request_def *d;
+  connection *c;
+  int j;
+
+  if ((cs = calloc(connections + 1, sizeof(connection))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for %d connections\n", connections);
+
+  /* one or more clients/connections per a given request */
+  for (d = defs, c = cs; d < defs + defs_n; d++) {
+    for (j = 0; j < d->clients; j++, c++) {
+      connection_init(c, d);
+      c->client = j;
+      tmpl_conn_init(c);
+      check_conn_init(c);
+      if (d->rate.reqs)
+        c->rate.next = (uint64_t)j * 1000000 / d->rate.reqs;	/* spread the clients' intended starts evenly */
     }
+  }
+}
 
-    c += ret;
+/*
+ * Find the object after the first i objects of the top-level array of JSON request file data
+ * [*p, end); return it and set *len to its length, return NULL at the end of the array.  *p is
+ * advanced past the object, the objects are parsed one by one and we never hold the tree of the
+ * whole file.  Only the syntax between the objects is checked here, json_parse() does the rest.
+ */
+static const char *json_next_object(const char **p, const char *end, size_t *len, int i) {
+  const char *s = *p, *o;
+  bool str = false;
+  int depth = 0;
+
+  while (s < end && isspace(*s)) s++;
+  if (!i) {
+    if (s >= end || *s++ != '[') die(EXIT_FAILURE, "invalid input request file\n");
+    while (s < end && isspace(*s)) s++;
+  }
+  if (s < end && *s == ']') {
+    /* nothing but whitespace after the array */
+    for (s++; s < end && isspace(*s); s++);
+    if (s < end) die(EXIT_FAILURE, "invalid input request file\n");
+    *p = s;
+    return NULL;
+  }
+  if (i) {
+    if (s >= end || *s++ != ',') die(EXIT_FAILURE, "invalid input request file\n");
+    while (s < end && isspace(*s)) s++;
   }
+  if (s >= end || *s != '{') die(EXIT_FAILURE, "invalid input request file\n");
 
-  return connections;
-}
+  for (o = s; s < end; s++) {
+    if (str) {
+      if (*s == '\\') s++;
+      else if (*s == '"') str = false;
+      continue;
+    }
+    if (*s == '"') str = true;
+    else if (*s == '{' || *s == '[') depth++;
+    else if ((*s == '}' || *s == ']') && --depth == 0) break;
+  }
+  if (s >= end) die(EXIT_FAILURE, "unable to parse json data\n");
 
-static void request_initialize_body_random(connection *c, int i) {
-  /* Initialize requests's body size with random data */
-  size_t random_bytes_alloc = (c->req_body_size > MAX_REQ_LEN)? MAX_REQ_LEN: c->req_body_size;
-  random_bytes_alloc += NUM2HEX_DIGITS(random_bytes_alloc) + 9;	/* account for TE chunked overhead: <len>\r\n + <body>\r\n + 0\r\n\r\n */
-  if ((c->req_body_random = malloc(random_bytes_alloc)) == NULL)
-    die(EXIT_FAILURE, "malloc(): cannot allocate memory for connection's random data\n");
+  *p = s + 1;
+  *len = *p - o;
 
-  __uint128_t state = i * 2; /* different random data for every input "request" definition */
-  mcg64_seed(&state);
-  mcg64cpy(&state, c->req_body_random, random_bytes_alloc);
+  return o;
 }
 
-int requests_read(const char *file_in) {
-  FILE *fp;
-  struct stat filestatus;
-  int file_size;
-  char *file_contents;
-  json_char *json;
+/* Parse the JSON request file data json of length len; return the number of connections */
+static int requests_parse_json(const char *json, size_t len) {
+  const char *p = json, *o;
   json_value *value;
-  int connections = 0;
+  int n = 0, connections = 0;
+  size_t olen;
+
+  /* size the request definitions first */
+  while (json_next_object(&p, json + len, &olen, n)) n++;
+  if (!n) die(EXIT_FAILURE, "no requests found in the input request file\n");
+  if ((defs = calloc(n, sizeof(request_def))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for request definitions\n");
+
+  for (p = json; (o = json_next_object(&p, json + len, &olen, defs_n)); ) {
+    if ((value = json_parse((json_char *)o, olen)) == NULL)
+      die(EXIT_FAILURE, "unable to parse json data (array %d)\n", defs_n);
+    if (json_process_connection(value, defs + defs_n) < 0)
+      die(EXIT_FAILURE, "invalid input request file (array %d)\n", defs_n);
+    connections += request_def_add();
+    json_value_free(value);
+  }
+
+  return connections;
+}
 
-  if (stat(file_in, &filestatus) != 0) {
-    die(EXIT_FAILURE, "file `%s' not found\n", file_in);
+/*
+ * Generate the PRNG data of the "random" bodies once, split between cfg.threads threads.  The
+ * read-only buffer is shared by all connections; every client reads it at a different offset
+ * within BODY_RANDOM_SPREAD.  "stream" bodies are generated while sending and need no buffer.
+ */
+static void body_random_init(int connections) {
+  size_t random_bytes = 0;
+  int i;
+
+  for (i = 0; i < connections; i++)
+    if (cs[i].def->req_body_type == body_random && cs[i].def->req_body_stream)
+      cs[i].body.stream = (uint64_t)i << BODY_STREAM_SPREAD;
+
+  for (i = 0; i < defs_n; i++)
+    if (defs[i].req_body_type == body_random && !defs[i].req_body_stream)
+      random_bytes = MAX(random_bytes, MIN(defs[i].req_body_size, MAX_REQ_LEN));
+  if (!random_bytes) return;
+
+  random_bytes += BODY_RANDOM_SPREAD;
+  if ((random_data = malloc(random_bytes)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for random body data\n");
+
+  __uint128_t state = BODY_RANDOM_SEED;
+  mcg64cpy_mt(&state, random_data, random_bytes, cfg.threads);
+
+  for (i = 0; i < connections; i++)
+    if (cs[i].def->req_body_type == body_random && !cs[i].def->req_body_stream)
+      cs[i].req_body_random = random_data + ((uint64_t)i * 4093) % BODY_RANDOM_SPREAD;	/* odd stride: distinct offsets */
+}
+
+/*
+ * Parse line n of a line request file, "[<method>] <url> [<clients>]", into request definition d.
+ * The url is <scheme>://<host>[:<port>][<path>], an IPv6 host address in brackets.
+ */
+static void request_line_parse(request_def *d, char *line, int n) {
+  char *tok[4], *save, *url, *host, *clients = NULL, *p;
+  long v = 1;
+  int toks = 0;
+
+  for (p = strtok_r(line, " \t", &save); p && toks < 4; p = strtok_r(NULL, " \t", &save)) tok[toks++] = p;
+  if (strstr(tok[0], "://")) {
+    url = tok[0];
+    if (toks > 1) clients = tok[1];
+    if (toks > 2) die(EXIT_FAILURE, "invalid input request file, line %d: too many fields\n", n);
+  } else {
+    if (toks < 2) die(EXIT_FAILURE, "invalid input request file, line %d: url expected\n", n);
+    d->method = mstrdup(tok[0]);
+    url = tok[1];
+    if (toks > 2) clients = tok[2];
+    if (toks > 3) die(EXIT_FAILURE, "invalid input request file, line %d: too many fields\n", n);
+  }
+  if (clients) {
+    v = strtol(clients, &p, 10);
+    if (p == clients || *p) v = 0;	/* not a number */
   }
-  file_size = filestatus.st_size;
-  file_contents = (char *) malloc(filestatus.st_size);
-  if (file_contents == NULL) {
-    die(EXIT_FAILURE, "malloc(): unable to allocate %d bytes\n", file_size);
+  if (v < 1 || v > MB_MAX_CLIENTS)
+    die(EXIT_FAILURE, "invalid input request file, line %d: clients must be between 1 and %d\n", n, MB_MAX_CLIENTS);
+  d->clients = v;
+
+  if ((p = strstr(url, "://")) == NULL)
+    die(EXIT_FAILURE, "invalid input request file, line %d: url expected\n", n);
+  *p = '\0';
+  scheme_parse(d, url);
+  d->port = SCHEME_TLS(d->scheme)? 443: 80;
+
+  host = p + 3;
+  if (*host == '[') {
+    /* IPv6 address */
+    if ((p = strchr(++host, ']')) == NULL)
+      die(EXIT_FAILURE, "invalid input request file, line %d: unterminated IPv6 address\n", n);
+    *p++ = '\0';
+  } else {
+    p = host + strcspn(host, ":/");
   }
+  if (*p == ':') {
+    *p++ = '\0';
+    v = strtol(p, &p, 10);
+    if (v < 1 || v > 65535 || (*p && *p != '/'))
+      die(EXIT_FAILURE, "invalid input request file, line %d: invalid port\n", n);
+    d->port = v;
+  } else if (*p && *p != '/') {
+    die(EXIT_FAILURE, "invalid input request file, line %d: invalid host\n", n);
+  }
+  d->path = mstrdup(*p == '/'? p: "/");
+  *p = '\0';
+  if (!*host) die(EXIT_FAILURE, "invalid input request file, line %d: host expected\n", n);
+  d->host = mstrdup(host);
+}
 
-  fp = fopen(file_in, "rt");
-  if (fp == NULL) {
-    fclose(fp);
-    free(file_contents);
-    die(EXIT_FAILURE, "unable to open %s\n", file_in);
+/* Find the next request line of the line request file data [*p, end), skip empty lines and #comments */
+static const char *request_line_next(const char **p, const char *end, size_t *len, int *n) {
+  const char *l, *eol;
+
+  for (l = *p; l < end; l = eol + 1) {
+    if ((eol = memchr(l, '\n', end - l)) == NULL) eol = end;
+    (*n)++;
+    while (l < eol && isspace(*l)) l++;
+    if (l == eol || *l == '#') continue;
+
+    *p = eol + 1;
+    for (*len = eol - l; *len && isspace(l[*len - 1]); (*len)--);
+
+    return l;
   }
-  if (fread(file_contents, file_size, 1, fp) != 1) {
-    fclose(fp);
-    free(file_contents);
-    die(EXIT_FAILURE, "fread(): unable to read content of %s\n", file_in);
+
+  return NULL;
+}
+
+/* Parse the line request file data of length len; return the number of connections */
+static int requests_parse_lines(const char *data, size_t len) {
+  const char *p = data, *l;
+  char *line = NULL;
+  int n = 0, lineno = 0, connections = 0;
+  size_t llen;
+
+  /* size the request definitions first */
+  while (request_line_next(&p, data + len, &llen, &lineno)) n++;
+  if (!n) die(EXIT_FAILURE, "no requests found in the input request file\n");
+  if ((defs = calloc(n, sizeof(request_def))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for request definitions\n");
+
+  for (p = data, lineno = 0; (l = request_line_next(&p, data + len, &llen, &lineno)); ) {
+    if ((line = realloc(line, llen + 1)) == NULL)
+      die(EXIT_FAILURE, "realloc(): cannot allocate memory for a request line\n");
+    memcpy(line, l, llen);
+    line[llen] = '\0';
+
+    request_def_init(defs + defs_n);
+    request_line_parse(defs + defs_n, line, lineno);
+    request_def_check(defs + defs_n);
+    connections += request_def_add();
   }
-  fclose(fp);
+  free(line);
 
-  json = (json_char *) file_contents;
+  return connections;
+}
 
-  value = json_parse(json, file_size);
+/* Map the input request file read-only, set *len to its length; release it by requests_unload() */
+char *requests_load(const char *file_in, size_t *len) {
+  struct stat filestatus;
+  char *file_contents;
+  int fd;
 
-  if (value == NULL) {
-    free(file_contents);
-    die(EXIT_FAILURE, "unable to parse json data\n");
+  if ((fd = open(file_in, O_RDONLY)) < 0 || fstat(fd, &filestatus) != 0) {
+    die(EXIT_FAILURE, "unable to open %s: %s (%d)\n", file_in, strerror(errno), errno);
   }
+  if ((*len = filestatus.st_size) == 0) {
+    die(EXIT_FAILURE, "input request file %s is empty\n", file_in);
+  }
+  if ((file_contents = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    die(EXIT_FAILURE, "mmap(): unable to map %s: %s (%d)\n", file_in, strerror(errno), errno);
+  }
+  close(fd);
+  madvise(file_contents, *len, MADV_SEQUENTIAL);
+
+  return file_contents;
+}
+
+void requests_unload(char *file_contents, size_t len) {
+  munmap(file_contents, len);
+}
 
-  if (value->type != json_array)
-    die(EXIT_FAILURE, "invalid input request file\n");
+int requests_read(const char *file_in) {
+  size_t len;
+  char *data = requests_load(file_in, &len);
+  int connections = requests_parse(data, len);
 
-  if ((cs = malloc((value->u.array.length + 1) * sizeof(connection))) == NULL)
-    die(EXIT_FAILURE, "malloc(): cannot allocate memory for connections\n");
+  requests_unload(data, len);
+  return connections;
+}
 
-  connections = json_process_connections(value);
+/* Parse the input request file data of length len, a JSON array or request lines; return the number of connections */
+int requests_parse(char *data, size_t len) {
+  const char *p = data;
+  int connections;
+
+  while (p < data + len && isspace(*p)) p++;
+  if (p < data + len && *p == '[')
+    connections = requests_parse_json(data, len);
+  else
+    connections = requests_parse_lines(data, len);
+
+  /* the replay stream takes the place of the requests, spread across their clients */
+  if (cfg.replay) connections = replay_load(cfg.replay, cfg.replay_speed, defs, defs_n);
+  connections_create(connections);
+  if (cfg.replay) replay_conns_init(cs, connections);
+  dns_resolve(defs, defs_n);		/* all the hosts at once */
   cs[connections].t = NULL;	/* last (unused) connection (for looping over all connections) */
+  body_random_init(connections);
 
-  json_value_free(value);
-  free(file_contents);
   return connections;
 }
 
+/*
+ * Parse a CPU list such as "0-3,8,10-11" (see cpuset(7)) into a newly allocated array *cpus.
+ * Return the number of CPUs in the list, -1 if the list is invalid.
+ */
+static int cpu_list_parse(const char *s, int **cpus) {
+  int n = 0, alloc = 0;
+  long from, to;
+  char *p_err;
+
+  *cpus = NULL;
+  while (*s) {
+    from = to = strtol(s, &p_err, 10);
+    if (p_err == s || from < 0) goto err;
+    if (*p_err == '-') {
+      s = p_err + 1;
+      to = strtol(s, &p_err, 10);
+      if (p_err == s || to < from) goto err;
+    }
+    if (*p_err == ',') p_err++;
+    else if (*p_err && *p_err != '\n') goto err;
+    s = p_err;
+
+    for (; from <= to; from++) {
+      if (n == alloc) {
+        alloc = alloc? alloc * 2: 64;
+        if ((*cpus = realloc(*cpus, alloc * sizeof(int))) == NULL)
+          die(EXIT_FAILURE, "realloc(): cannot allocate memory for CPU list\n");
+      }
+      (*cpus)[n++] = from;
+    }
+    if (*s == '\n') break;
+  }
+
+  return n;
+
+err:
+  free(*cpus); *cpus = NULL;
+  return -1;
+}
+
+/* CPUs of the NUMA nodes, read from sysfs when --numa is given without --cpu-list */
+static cpu_set_t *numa_nodes;
+static int numa_nodes_n;
+
+static int numa_nodes_read() {
+  char path[PATH_MAX], list[BUFSIZ];
+  DIR *dir;
+  struct dirent *de;
+  FILE *fp;
+  int *cpus, n, i, node;
+
+  if ((dir = opendir("/sys/devices/system/node")) == NULL) return -1;
+
+  while ((de = readdir(dir)) != NULL) {
+    if (sscanf(de->d_name, "node%d", &node) != 1) continue;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", de->d_name);
+    if ((fp = fopen(path, "r")) == NULL) continue;
+    n = fgets(list, sizeof(list), fp)? cpu_list_parse(list, &cpus): -1;
+    fclose(fp);
+    if (n <= 0) continue;	/* memory-only node */
+
+    if ((numa_nodes = realloc(numa_nodes, (numa_nodes_n + 1) * sizeof(cpu_set_t))) == NULL)
+      die(EXIT_FAILURE, "realloc(): cannot allocate memory for NUMA nodes\n");
+    CPU_ZERO(&numa_nodes[numa_nodes_n]);
+    for (i = 0; i < n; i++)
+      if (cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &numa_nodes[numa_nodes_n]);
+    numa_nodes_n++;
+    free(cpus);
+  }
+  closedir(dir);
+
+  return numa_nodes_n;
+}
+
+/*
+ * Pin thread t to its CPU from --cpu-list, or with --numa alone to all the CPUs of a NUMA node
+ * (round-robin), before the thread allocates its memory so that the memory is node-local.
+ */
+static void thread_pin(thread *t) {
+  cpu_set_t set;
+  int r;
+
+  t->cpu = -1;
+  CPU_ZERO(&set);
+  if (cfg.cpus) {
+    t->cpu = cfg.cpus[t->id % cfg.cpus_n];
+    CPU_SET(t->cpu, &set);
+  } else if (cfg.numa && numa_nodes_n > 0) {
+    set = numa_nodes[t->id % numa_nodes_n];
+  } else {
+    return;
+  }
+
+  if ((r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+    warning("unable to set CPU affinity of thread %d: %s (%d)\n", t->id + 1, strerror(r), r);
+}
+
 static int args_parse(struct config *cfg, int argc, char **argv) {
   int c;
   char *p_err;
@@ -676,16 +1675,50 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
   cfg->duration = MB_CFG_DURATION;	/* default duration */
   cfg->file_req = NULL;
   cfg->file_resp = NULL;
+  cfg->output_format = output_csv;
+  cfg->file_dump = NULL;
   cfg->ramp_up = 0;
+  cfg->connect_rate = 0;
+  cfg->connect_ramp = 0;
+  cfg->connect_steps = 0;
   cfg->ssl_version = MB_TLS_VERSION;
   cfg->ssl = false;
-
-  while ((c = getopt_long(argc, argv, "cd:i:o:r:s:t:hqv", longopts, NULL)) != -1) {
+  cfg->agent = NULL;
+  cfg->agents = NULL;
+  cfg->shard = false;
+  cfg->shard_id = 0;
+  cfg->shards = 0;
+  cfg->agent_fd = -1;
+  cfg->secret = NULL;
+  cfg->interval = 0;
+  cfg->interval_json = NULL;
+  cfg->metrics = NULL;
+  cfg->per_target = false;
+  cfg->summary_json = NULL;
+  cfg->dns_ttl = 0;
+  cfg->timestamping = ts_none;
+  cfg->replay = NULL;
+  cfg->replay_speed = 1;
+
+  while ((c = getopt_long(argc, argv, "a:A:cC:d:D:Ii:j:J:k:K:m:n:No:O:p:Pr:R:s:St:T:u:x:hqv", longopts, NULL)) != -1) {
     switch (c) {
+    case 'a':
+      cfg->agent = optarg;
+      break;
+
+    case 'A':
+      cfg->agents = optarg;
+      break;
+
     case 'c':
       cfg->cookies = true;
       break;
 
+    case 'C':
+      if ((cfg->cpus_n = cpu_list_parse(optarg, &cfg->cpus)) <= 0)
+        die(EXIT_FAILURE, "cpu-list: `%s' not a list of CPUs\n", optarg);
+      break;
+
     case 'd':
       cfg->duration = strtol(optarg, &p_err, 0);
       if (p_err == optarg || *p_err) {
@@ -694,14 +1727,71 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
       if (cfg->duration <= 0 || optarg[0] == '-') die(EXIT_FAILURE, "duration must be > 0\n", optarg);
       break;
 
+    case 'D':
+      cfg->file_dump = optarg;
+      break;
+
+    case 'I':
+      cfg->incoming_cpu = true;
+      break;
+
     case 'i':
       cfg->file_req = optarg;
       break;
 
+    case 'j':
+      cfg->summary_json = optarg;
+      break;
+
+    case 'J':
+      cfg->interval_json = optarg;
+      break;
+
+    case 'k':
+      if (!strcmp(optarg, "sw")) cfg->timestamping = ts_software;
+      else if (!strcmp(optarg, "hw")) cfg->timestamping = ts_hardware;
+      else die(EXIT_FAILURE, "timestamping: `%s' not one of sw|hw\n", optarg);
+      break;
+
+    case 'K':
+      cfg->secret = optarg;
+      break;
+
+    case 'm':
+      cfg->metrics = optarg;
+      break;
+
+    case 'n':
+      cfg->dns_ttl = strtol(optarg, &p_err, 0);
+      if (p_err == optarg || *p_err) {
+        die(EXIT_FAILURE, "dns-ttl: `%s' not an integer\n", optarg);
+      }
+      if (cfg->dns_ttl <= 0 || optarg[0] == '-') die(EXIT_FAILURE, "dns-ttl must be > 0\n");
+      cfg->dns_ttl *= 1000000;
+      break;
+
+    case 'N':
+      cfg->numa = true;
+      break;
+
     case 'o':
       cfg->file_resp = optarg;
       break;
 
+    case 'O':
+      if (!strcmp(optarg, "csv")) cfg->output_format = output_csv;
+      else if (!strcmp(optarg, "binary")) cfg->output_format = output_binary;
+      else die(EXIT_FAILURE, "output-format: `%s' not one of csv|binary\n", optarg);
+      break;
+
+    case 'p':
+      cfg->replay = optarg;
+      break;
+
+    case 'P':
+      cfg->per_target = true;
+      break;
+
     case 'r':
       cfg->ramp_up = strtol(optarg, &p_err, 0);
       if (p_err == optarg || *p_err) {
@@ -710,6 +1800,40 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
       if (cfg->ramp_up < 0 || optarg[0] == '-') die(EXIT_FAILURE, "ramp-up must be > 0\n", optarg);
       break;
 
+    case 'R':
+      cfg->connect_rate = strtod(optarg, &p_err);
+      if (p_err == optarg || *p_err) {
+        die(EXIT_FAILURE, "connect-rate: `%s' not a number\n", optarg);
+      }
+      if (cfg->connect_rate <= 0) die(EXIT_FAILURE, "connect-rate must be > 0\n");
+      break;
+
+    case 'u': {
+      double ramp = strtod(optarg, &p_err);
+      if (p_err == optarg || (*p_err && *p_err != ':')) {
+        die(EXIT_FAILURE, "connect-ramp: `%s' not a number\n", optarg);
+      }
+      if (ramp <= 0) die(EXIT_FAILURE, "connect-ramp must be > 0\n");
+      cfg->connect_ramp = ramp * 1000000;
+      if (*p_err == ':') {
+        char *steps = p_err + 1;
+        cfg->connect_steps = strtol(steps, &p_err, 0);
+        if (p_err == steps || *p_err) {
+          die(EXIT_FAILURE, "connect-ramp: steps `%s' not an integer\n", steps);
+        }
+        if (cfg->connect_steps <= 0) die(EXIT_FAILURE, "connect-ramp steps must be > 0\n");
+      }
+      break;
+    }
+
+    case 'x':
+      cfg->replay_speed = strtod(optarg, &p_err);
+      if (p_err == optarg || *p_err) {
+        die(EXIT_FAILURE, "replay-speed: `%s' not a number\n", optarg);
+      }
+      if (cfg->replay_speed <= 0) die(EXIT_FAILURE, "replay-speed must be > 0\n");
+      break;
+
     case 's':
       cfg->ssl_version = strtol(optarg, &p_err, 0);
       if (p_err == optarg || *p_err) {
@@ -718,6 +1842,10 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
       if (cfg->ssl_version < 0 || cfg->ssl_version > 4 || optarg[0] == '-') die(EXIT_FAILURE, "ssl-version must be >= 0 and <= 4\n", optarg);
       break;
 
+    case 'S':
+      cfg->shard = true;
+      break;
+
     case 't':
       cfg->threads = strtol(optarg, &p_err, 0);
       if (p_err == optarg || *p_err) {
@@ -726,6 +1854,16 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
       if (cfg->threads <= 0 || optarg[0] == '-') die(EXIT_FAILURE, "number of threads must be > 0\n", optarg);
       break;
 
+    case 'T': {
+      double interval = strtod(optarg, &p_err);
+      if (p_err == optarg || *p_err) {
+        die(EXIT_FAILURE, "interval: `%s' not a number\n", optarg);
+      }
+      if (interval < 0.001) die(EXIT_FAILURE, "interval must be >= 0.001\n");
+      cfg->interval = interval * 1000000;
+      break;
+    }
+
     case 'h':
       usage(EXIT_SUCCESS);
       break;
@@ -747,6 +1885,11 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
     }
   }
 
+  if (cfg->file_dump) {
+    /* conversion only, no test run */
+    exit(stats_dump(cfg->file_dump)? EXIT_FAILURE: EXIT_SUCCESS);
+  }
+
   if (cfg->cookies) {
     /* Parsing headers is expensive, turn it on only when needed. */
     parser_settings.on_header_field = header_field;
@@ -757,11 +1900,88 @@ static int args_parse(struct config *cfg, int argc, char **argv) {
     usage(EXIT_FAILURE);
   }
 
-  if (cfg->file_req == NULL) {
+  if (cfg->connect_ramp && !cfg->connect_rate) {
+    error("connect-ramp needs a connect rate\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->agent && cfg->agents) {
+    error("agent and agents are mutually exclusive\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if ((cfg->agent || cfg->agents) && !cfg->secret) {
+    /* anyone reaching an agent could otherwise make it send anything anywhere */
+    error("distributed mode needs a shared secret\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if ((cfg->connect_rate || cfg->connect_ramp) && cfg->agents) {
+    /* the rate of every mb instance, the agents are host-specific */
+    error("connect-rate and connect-ramp apply to the agents, set them on their command lines\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->interval && cfg->agents) {
+    /* the coordinator only hears from the agents at the end of the test */
+    error("interval reports come from the agents, set interval on their command lines\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->timestamping && cfg->agents) {
+    /* the agents' network interfaces */
+    error("timestamping applies to the agents, set it on their command lines\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->metrics && cfg->agents) {
+    /* the coordinator runs no worker threads to take the counters of */
+    error("metrics are served by the agents, set metrics on their command lines\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if ((cfg->per_target || cfg->summary_json) && cfg->agents) {
+    /* the agents send the totals only */
+    error("per-target results and summary-json are written by the agents, set them on their command lines\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->replay && cfg->agents) {
+    error("replay runs on a single mb instance, not on agents\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->replay && cfg->cookies) {
+    /* the recorded requests carry their own cookies, if any */
+    error("replay sends the recorded requests, not session cookies\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->replay && cfg->ramp_up) {
+    /* the threads share the timeline of the replay */
+    warning("replaying; ignoring the ramp-up time\n");
+    cfg->ramp_up = 0;
+  }
+
+  if (cfg->file_req == NULL && !cfg->agent) {
+    /* agents receive the requests from the coordinator */
     error("need to specify an input requests file\n");
     usage(EXIT_FAILURE);
   }
 
+  if (cfg->incoming_cpu && !cfg->cpus) {
+    error("incoming-cpu needs the worker threads pinned to CPUs (cpu-list)\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->interval_json && !cfg->interval) {
+    error("interval-json needs an interval\n");
+    usage(EXIT_FAILURE);
+  }
+
+  if (cfg->numa && !cfg->cpus && numa_nodes_read() <= 0)
+    warning("cannot read the NUMA topology, worker threads will not be pinned\n");
+
   return 0;
 }
 
@@ -779,20 +1999,121 @@ static int watchdog(aeEventLoop *loop, long long id, void *data) {
   return WATCHDOG_MS;
 }
 
+/*
+ * Estimated relative cost (CPU time per second) of connection c for balancing the connections
+ * between threads.  Rough on purpose: a plain HTTP keep-alive request with a small body costs 1,
+ * payload, TLS and reconnects add to it, and the cost is scaled by the expected request rate
+ * (closed-loop requests are assumed to take ~1ms unless delayed).
+ */
+static double connection_cost(const connection *c) {
+  const request_def *d = c->def;
+  double cost = 1.0, reqs;
+  size_t body = (d->req_body_type == body_random)? d->req_body_size: (d->req_body? strlen(d->req_body): 0);
+
+  cost += (double)body / SNDBUF;
+  if (SCHEME_TLS(d->scheme)) cost += 1.0;					/* record encryption */
+  if (d->keep_alive_reqs) {
+    /* connection (re-)establishment, TLS handshakes being the expensive part of it */
+    cost += (SCHEME_TLS(d->scheme)? (d->tls_session_reuse? 20.0 - 15.0 * d->tls_session_reuse_ratio: 20.0): 1.0) / d->keep_alive_reqs;
+  }
+
+  if (d->rate.reqs)
+    reqs = 1000000.0 / d->rate.interval;
+  else
+    reqs = 1000.0 / (1.0 + (d->delay_min + d->delay_max) / 2.0);
+
+  return cost * reqs;
+}
+
+typedef struct {
+  double cost;
+  int i;
+} connection_order;
+
+static int connection_order_cmp(const void *a, const void *b) {
+  const connection_order *x = a, *y = b;
+
+  if (x->cost != y->cost) return (x->cost < y->cost)? 1: -1;
+  return x->i - y->i;
+}
+
+/*
+ * Balance the connections between the threads: the most expensive connections first, each onto
+ * the least loaded thread (so the clients of one request definition are spread round-robin).
+ * cs is then reordered, keeping the relative order of connections, for every thread to handle a
+ * contiguous range of it.
+ */
+static void connections_assign(thread *threads) {
+  connection_order *order;
+  connection *cs_sorted;
+  double *load;
+  int *owner, *n, i, j;
+
+  order = malloc(connections * sizeof(connection_order));
+  cs_sorted = malloc(connections * sizeof(connection));
+  load = calloc(cfg.threads, sizeof(double));
+  owner = malloc(connections * sizeof(int));
+  n = calloc(cfg.threads, sizeof(int));
+  if (!order || !cs_sorted || !load || !owner || !n)
+    die(EXIT_FAILURE, "cannot allocate memory for thread assignment\n");
+
+  for (i = 0; i < connections; i++) {
+    order[i].cost = connection_cost(cs + i);
+    order[i].i = i;
+  }
+  qsort(order, connections, sizeof(connection_order), connection_order_cmp);
+
+  for (i = 0; i < connections; i++) {
+    int t = 0;
+    for (j = 1; j < cfg.threads; j++)
+      if (load[j] < load[t]) t = j;
+    load[t] += order[i].cost;
+    owner[order[i].i] = t;
+    n[t]++;
+  }
+
+  for (i = 0, j = 0; i < cfg.threads; j += n[i], i++)
+    threads[i].cs_start = threads[i].cs_end = cs + j;
+  for (i = 0; i < connections; i++) {
+    thread *t = &threads[owner[i]];
+    memcpy(cs_sorted + (t->cs_end - cs), cs + i, sizeof(connection));
+    t->cs_end++;
+  }
+  memcpy(cs, cs_sorted, connections * sizeof(connection));
+
+  free(order); free(cs_sorted); free(load); free(owner); free(n);
+}
+
 void *thread_main(void *arg) {
   thread *t = arg;
   long long time_event_id;
 
-  uint64_t connections_per_thread = (connections > cfg.threads)? (connections / cfg.threads): 1;
-  connection *cs_ptr;
-  connection *cs_ptr_start = cs + (connections_per_thread * t->id);
-  connection *cs_ptr_end = (t->id == cfg.threads - 1)? cs + connections: cs + (connections_per_thread * (t->id + 1));
+  connection *cs_ptr, *cs_local = NULL;
+  connection *cs_ptr_start = t->cs_start;
+  connection *cs_ptr_end = t->cs_end;
+  size_t cs_len = (cs_ptr_end - cs_ptr_start) * sizeof(connection);
 
-  if (t->id >= connections) {
-    warning("stopping thread %d, connections (%d) < threads (%d)\n", t->id + 1, connections, cfg.threads);
+  if (cs_ptr_start == cs_ptr_end) {
+    warning("stopping thread %d, no connections assigned\n", t->id + 1);
     goto out;
   }
 
+  thread_pin(t);
+  if ((t->buf = malloc(RECVBUF + 1)) == NULL || (t->sndbuf = malloc(SNDBUF + 32)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for thread buffers\n");
+
+  if (cfg.numa) {
+    /* node-local copy of the connections (first touched by this thread), copied back to cs when done */
+    if ((cs_local = malloc(cs_len)) == NULL)
+      die(EXIT_FAILURE, "malloc(): cannot allocate memory for connections\n");
+    memcpy(cs_local, cs_ptr_start, cs_len);
+    cs_ptr_start = cs_local;
+    cs_ptr_end = cs_local + (t->cs_end - t->cs_start);
+  }
+
+  if (stats.fd && (t->stats_buf = malloc(STATS_BUF_LEN)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for response stats buffer\n");
+
   /* create main event loop */
   t->loop = aeCreateEventLoop(connections + cfg.threads + MB_FD_START);
   time_event_id = aeCreateTimeEvent(t->loop, WATCHDOG_MS, watchdog, NULL, NULL);
@@ -800,18 +2121,26 @@ void *thread_main(void *arg) {
     die(EXIT_FAILURE, "cannot create time event: %s (%d)\n", strerror(errno), errno);
   }
 
+  /* the loop counts its own overhead, spent connecting included */
+  aeSetStats(t->loop, &t->self.loop);
+  __atomic_store_n(&t->self.loop_start, time_us(), __ATOMIC_RELAXED);
+
   /* register socket connect callback */
+  cps_thread_init(t);
   for (cs_ptr = cs_ptr_start; cs_ptr < cs_ptr_end; cs_ptr++) {
     cs_ptr->t = t;						/* point to the thread */
-    cs_ptr->delayed = cs_ptr->delay_max;			/* connection will be delayed (delay_max always >= delay_min) */
+    cs_ptr->delayed = CONN_DELAYED(cs_ptr);			/* connection will be delayed (delay_max always >= delay_min) */
+    if (cs_ptr->def->rate.reqs) cs_ptr->rate.next += time_us();	/* open-loop timeline starts now */
     socket_connect(t->loop, 0, cs_ptr, 0);
   }
 
   /* start main loop */
   aeMain(t->loop);
+  __atomic_store_n(&t->self.loop_end, time_us(), __ATOMIC_RELAXED);
 
   /* cleanup: delete time events */
   aeDeleteTimeEvent(t->loop, time_event_id);			/* remove watchdog */
+  if (t->cps.timer_id) aeDeleteTimeEvent(t->loop, t->cps.timer_id);	/* remove the connect scheduler */
   for (cs_ptr = cs_ptr_start; cs_ptr < cs_ptr_end; cs_ptr++) {
     aeDeleteTimeEvent(t->loop, cs_ptr->delayed_id);		/* remove any delayed requests */
   }
@@ -819,6 +2148,17 @@ void *thread_main(void *arg) {
   /* stop loop */
   aeDeleteEventLoop(t->loop);
 
+  /* write out the remaining response stats */
+  if (stats.fd) stats_buf_flush(stats.fd, t);
+  free(t->stats_buf); t->stats_buf = NULL;
+  free(t->buf); t->buf = NULL;
+  free(t->sndbuf); t->sndbuf = NULL;
+
+  if (cs_local) {
+    memcpy(t->cs_start, cs_local, cs_len);
+    free(cs_local);
+  }
+
 out:
   return (void *)t;
 }
@@ -827,9 +2167,11 @@ void threads_start() {
   pthread_attr_t attr;
   int i, r;
   void *thread_retval;			/* pointer to data returned by the terminating thread */
-  uint64_t thread_delay, start;
+  uint64_t thread_delay, start, next_report = 0;
   int64_t run_time;
   thread *threads;
+  static summary report;			/* totals at the last interval report */
+  thread_counters *tc;
 
   if (cfg.threads > connections) {
     info("threads (%d) > connections (%d): lowering the number of threads to %d\n", cfg.threads, connections, connections);
@@ -840,13 +2182,30 @@ void threads_start() {
   requests_max_cb = requests_done;
 
   /* initialize and set thread detached attribute */
-  if ((threads = calloc(cfg.threads, sizeof(thread))) == NULL)
-    die(EXIT_FAILURE, "calloc(): cannot allocate memory for threads\n");
+  if (posix_memalign((void **)&threads, CACHE_LINE, cfg.threads * sizeof(thread)))
+    die(EXIT_FAILURE, "posix_memalign(): cannot allocate memory for threads\n");
+  memset(threads, 0, cfg.threads * sizeof(thread));
+  for (i = 0; i < cfg.threads; i++) {
+    /* initialized before the threads start, the interval reports and metrics read them any time */
+    thread *t = &threads[i];
+    if (posix_memalign((void **)&t->counters, CACHE_LINE, defs_n * sizeof(thread_counters)))
+      die(EXIT_FAILURE, "posix_memalign(): cannot allocate memory for thread counters\n");
+    memset(t->counters, 0, defs_n * sizeof(thread_counters));
+    hist_init(&t->latency);
+    hist_init(&t->tls.handshake);
+    hist_init(&t->kernel_latency);
+    if (stats.targets && (t->target_latency = calloc(defs_n, sizeof(hist *))) == NULL)
+      die(EXIT_FAILURE, "calloc(): cannot allocate memory for per-target histograms\n");
+  }
+  connections_assign(threads);
+  if (cfg.dns_ttl) dns_refresh_start(defs, defs_n, cfg.dns_ttl);
+  if (cfg.metrics) metrics_start(cfg.metrics, threads, cfg.threads, defs, defs_n, connections + cfg.threads + MB_FD_START);
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
   thread_delay = cfg.ramp_up? (cfg.ramp_up * 1000000) / cfg.threads: 0;
   start = time_us();
+  replay_origin = start;
 
   /* start the worker threads */
   run = connections;			/* set this before starting threads */
@@ -864,10 +2223,20 @@ void threads_start() {
   pthread_attr_destroy(&attr);
 
   /* wait for the threads to do their job */
+  if (cfg.interval) {
+    interval_snapshot(&report, threads);
+    next_report = stats.start + cfg.interval;
+  }
   while (true) {
-    run_time = (cfg.duration * 1000000) - (time_us() - start);
+    uint64_t now = time_us();
+
+    if (cfg.interval && now >= next_report) {
+      interval_report(threads, &report);
+      while (next_report <= now) next_report += cfg.interval;
+    }
+    run_time = (cfg.duration * 1000000) - (now - start);
     if (run_time > 0 && run > 0) {
-      usleep(MIN(run_time, WATCHDOG_MS * 1000));
+      usleep(MIN(MIN(run_time, WATCHDOG_MS * 1000), cfg.interval? next_report - now: UINT64_MAX));
     } else break;
   };
   run = 0;
@@ -879,8 +2248,27 @@ void threads_start() {
     if (r) {
       die(EXIT_FAILURE, "return value from pthread_join() was %d for thread %d\n", r, i);
     }
+    for (tc = t->counters; tc < t->counters + defs_n; tc++) {
+      stats.err_conn += tc->err_conn;
+      stats.err_status += tc->err_status;
+      stats.err_parser += tc->err_parser;
+      stats.err_check += tc->err_check;
+    }
+    if (stats.targets) targets_merge(t);
+    self_merge(t);
+    hist_merge(&stats.latency, &t->latency);
+    stats.tls_full += t->tls.full;
+    stats.tls_resumed += t->tls.resumed;
+    hist_merge(&stats.tls_handshake, &t->tls.handshake);
+    hist_merge(&stats.kernel_latency, &t->kernel_latency);
   }
 
+  if (cfg.metrics) metrics_stop();
+  if (cfg.dns_ttl) dns_refresh_stop();
+  for (i = 0; i < cfg.threads; i++) {
+    free(threads[i].counters);
+    free(threads[i].target_latency);
+  }
   if (threads != NULL) free(threads);
 }
 
@@ -899,17 +2287,35 @@ static void requests_done() {
 #endif
 
 int main(int argc, char **argv) {
+  char *json = NULL;
+  size_t json_len = 0;
+
+  /* all the times taken are relative to this */
+  time_init();
+
   /* figure out the number of worker threads based on the hardware we have */
   mb_threads_auto();
 
   /* parse command-line arguments */
   args_parse(&cfg, argc, argv);
 
+  if (cfg.agents) {
+    /* distributed mode: the agents run the test, we merge their results */
+    dist_coordinator(cfg.agents, cfg.file_req);
+    return 0;
+  }
+
+  if (cfg.agent) {
+    /* distributed mode: only returns in a child process running a test of the coordinator */
+    json = dist_agent(cfg.agent, &json_len);
+  }
+
   /* override nameservers if environment variable(s) NAMESERVER<x> exist */
-  override_ns();
+  override_ns(true);
 
   /* read the connections file */
-  connections = requests_read(cfg.file_req);
+  connections = json? requests_parse(json, json_len): requests_read(cfg.file_req);
+  free(json);
 
   /* handle normal exit and catch some signals */
   signals_set();
@@ -919,6 +2325,11 @@ int main(int argc, char **argv) {
   ssl_ctx_init();
 #endif
 
+  if (cfg.agent) {
+    /* synchronized start of all the agents */
+    dist_agent_start();
+  }
+
   /* initialise the statistics structure and open stats file for writing if required to do so */
   stats_init();
 
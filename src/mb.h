@@ -5,6 +5,8 @@
 #include <stdio.h>		/* FILE */
 
 #include "../nginx/http_parser.h"	/* http_parser */
+#include "hist.h"			/* hist */
+#include "net.h"			/* self_counters */
 
 #define PGNAME		"mb"
 #define WATCHDOG_MS	100
@@ -15,6 +17,21 @@
 #define MB_CFG_THREADS	1	/* default number of threads */
 #define MB_FD_START	128	/* usually start with fd 5, but give us some more room */
 #define MB_TLS_VERSION 0	/* SSL version: auto(0), see cfg.ssl_version */
+#define MB_BUSY_WARN	90	/* warn that the results may be limited by mb above this busy share of a worker thread [%] */
+
+/* Results of one request definition (target) merged from all the worker threads (--per-target) */
+typedef struct target_summary {
+  uint64_t reqs;		/* number of requests sent */
+  uint64_t sent;		/* bytes sent */
+  uint64_t recv;		/* bytes received */
+  uint64_t connects;		/* connection attempts */
+  uint64_t status[5];		/* responses by status class: 1xx - 5xx */
+  uint64_t err_conn;		/* see statistics */
+  uint64_t err_status;
+  uint64_t err_parser;
+  uint64_t err_check;
+  hist *latency;		/* NULL: no responses */
+} target_summary;
 
 /* Statistics */
 typedef struct statistics {
@@ -22,18 +39,82 @@ typedef struct statistics {
   uint64_t err_conn;		/* number of connection-related errors during the test run */
   uint64_t err_status;		/* number of HTTP status errors during the test run */
   uint64_t err_parser;		/* number of HTTP errors caused by parsing HTTP responses */
+  uint64_t err_check;		/* number of responses failing the response checks */
+  hist latency;			/* response times [us] merged from all the worker threads */
+  uint64_t tls_full;		/* number of full TLS handshakes */
+  uint64_t tls_resumed;		/* number of abbreviated TLS handshakes resuming a session */
+  hist tls_handshake;		/* TLS handshake times [us] merged from all the worker threads */
+  hist kernel_latency;		/* response times [us] between the kernel timestamps, merged from all the worker threads */
   FILE *fd;			/* file descriptor of a file to write statistics to */
+  FILE *interval_fd;		/* file to write the interval reports to as JSON lines, NULL: none */
+  target_summary *targets;	/* results of every request definition, NULL: not kept */
+  self_counters self;		/* overhead counters summed over the worker threads */
+  uint64_t self_loop_us;	/* run time [us] of the worker threads' event loops summed up */
+  double self_busy_max;		/* the highest busy share of a worker thread's event loop [%] */
+  int self_busy_thread;		/* the thread it was, counted from 1 */
 } statistics;
 
+/* Results of a test run; those of several mb instances can be merged (see dist.c) */
+typedef struct summary {
+  uint64_t duration;		/* duration of the test run [us] */
+  uint64_t reqs;		/* number of requests sent */
+  uint64_t sent;		/* bytes sent */
+  uint64_t recv;		/* bytes received */
+  uint64_t err_conn;		/* see statistics */
+  uint64_t err_status;
+  uint64_t err_parser;
+  uint64_t err_check;
+  uint64_t tls_full;
+  uint64_t tls_resumed;
+  hist latency;
+  hist tls_handshake;
+  hist kernel_latency;
+  self_counters self;
+  uint64_t self_loop_us;
+  double self_busy_max;
+  int self_busy_thread;
+} summary;
+
+/* Response stats file formats */
+typedef enum {
+  output_csv,
+  output_binary
+} output_format;
+
 /* Client options */
 typedef struct config {
   bool cookies;			/* use session cookies */
   uint64_t duration;		/* duration of the test run [s] */
   char *file_req;		/* input file with individual requests */
   char *file_resp;		/* JMeter-style output file with individual response statistics */
+  output_format output_format;	/* format of the response statistics file */
+  char *file_dump;		/* binary response statistics file to convert to CSV */
   uint64_t ramp_up;		/* thread ramp-up time [s] */
+  double connect_rate;		/* new connections per second of all the threads, 0: unlimited */
+  uint64_t connect_ramp;	/* time [us] the connect rate rises to connect_rate over, 0: no ramp */
+  int connect_steps;		/* number of steps of the connect rate ramp, 0: linear */
   int ssl_version;		/* SSL version: auto(0), SSLv3(1) - TLS1.2(4) */
   uint64_t threads;		/* number of threads */
+  int *cpus;			/* CPUs to pin the worker threads to (round-robin), NULL: no pinning */
+  int cpus_n;			/* number of CPUs in cpus */
+  bool numa;			/* keep the worker threads and their connections NUMA node-local */
+  bool incoming_cpu;		/* set SO_INCOMING_CPU to the CPU the worker thread is pinned to */
+  char *agent;			/* [host:]port to accept test runs from a coordinator on (distributed mode) */
+  char *agents;			/* comma-separated host:port list of agents to run the test on (coordinator) */
+  bool shard;			/* coordinator: split the clients of every request between the agents */
+  int shard_id;			/* agent: index of our share of the clients */
+  int shards;			/* agent: number of agents sharing the clients, 0: no sharding */
+  int agent_fd;			/* agent: connection to the coordinator, -1: not an agent */
+  char *secret;			/* file with the secret shared by the coordinator and its agents */
+  uint64_t interval;		/* report live results every interval [us], 0: only at the end of the test */
+  char *interval_json;		/* file to write the interval reports to as JSON lines */
+  char *metrics;		/* [host:]port to serve OpenMetrics on while the test runs, NULL: none */
+  bool per_target;		/* print the results of every request definition */
+  char *summary_json;		/* file to write the results to in JSON, NULL: none */
+  uint64_t dns_ttl;		/* re-resolve the target hosts every dns_ttl [us] while the test runs, 0: never */
+  timestamping timestamping;	/* kernel timestamps of the requests and the responses */
+  char *replay;			/* file of recorded requests to replay at their original times, NULL: none */
+  double replay_speed;		/* replay speed: 2 replays twice as fast as recorded */
 
   bool ssl;			/* seen https protocol during parsing file with requests => initialize ssl */
 } config;
@@ -44,6 +125,12 @@ extern statistics stats;
 extern http_parser_settings parser_settings;
 
 /* Module functions */
+extern void time_init();
 extern uint64_t time_us();
+extern void summary_print(const summary *);
+extern void kernel_latency_print(const summary *);
+extern void self_print(const summary *);
+extern char *requests_load(const char *, size_t *);
+extern void requests_unload(char *, size_t);
 
 #endif /* MB_H */
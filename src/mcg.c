@@ -1,14 +1,20 @@
 #include <inttypes.h>		/* UINT64_MAX, uint64_t, ... */
+#include <pthread.h>		/* pthread_create() */
+#include <stdlib.h>		/* calloc() */
 #include <string.h>		/* memcpy() */
 
 #include "mcg.h"
 
-/* 
+/*
  * A 128-bit truncated MCG PRNG based on:
  * http://www.pcg-random.org/posts/does-it-beat-the-minimal-standard.html
  */
 
-const __uint128_t MCG64_MULT = ((__uint128_t)UINT64_MAX + 1) * UINT64_C(0x0fc94e3bf4e9ab32) + UINT64_C(0x866458cd56f5e605);
+#define MCG64_MULT_C	(((__uint128_t)UINT64_MAX + 1) * UINT64_C(0x0fc94e3bf4e9ab32) + UINT64_C(0x866458cd56f5e605))
+
+const __uint128_t MCG64_MULT = MCG64_MULT_C;
+
+#define MCG64_MT_MIN	(1UL<<24)	/* 16MB: do not bother with threads for less data than this */
 
 /* The MCG state must be seeded to an odd number. */
 void mcg64_seed(__uint128_t *state) {
@@ -21,23 +27,66 @@ static inline uint64_t mcg64(__uint128_t *state) {
   return *state >> 64;
 }
 
+/* Return the next 64-bit pseudo-random number of the stream in state. */
+uint64_t mcg64_rand(__uint128_t *state) {
+  return mcg64(state);
+}
+
+/* Return MCG64_MULT^n (mod 2^128). */
+static __uint128_t mcg64_mult_pow(uint64_t n) {
+  __uint128_t m = MCG64_MULT, r = 1;
+
+  for (; n; n >>= 1) {
+    if (n & 1) r *= m;
+    m *= m;
+  }
+
+  return r;
+}
+
+/* Advance the state by n steps in O(log n), as if mcg64() was called n times. */
+void mcg64_jump(__uint128_t *state, uint64_t n) {
+  *state *= mcg64_mult_pow(n);
+}
+
 #if 1
-/* mcg64cpy() copies "len" number of pseudo-random bytes into output array "out". */
+/*
+ * mcg64cpy() copies "len" number of pseudo-random bytes into output array "out".  The output is
+ * generated by 2 interleaved streams, each stepping 2 words ahead, which produce the very same
+ * sequence as a single stream but do not wait for the latency of each other's multiplications.
+ * More streams do not pay off on x86-64: the 128-bit states no longer fit into the registers.
+ */
 void mcg64cpy(__uint128_t *state, char *out, size_t len) {
-  uint64_t rndn;
+  static const __uint128_t mult2 = MCG64_MULT_C * MCG64_MULT_C;
+  __uint128_t s0, s1;
+  uint64_t rndn[2];
   size_t n;
   const char *out_end = out + len;
 
-  while (1) {
-    rndn = mcg64(state);
+  if (len >= sizeof(rndn)) {
+    /* keep the states in locals, "out" may alias them as far as the compiler knows */
+    s0 = *state * MCG64_MULT;
+    s1 = s0 * MCG64_MULT;
+    for (;;) {
+      /* store the words one by one, a 16-byte copy of rndn[] would stall on store forwarding */
+      rndn[0] = s0 >> 64;
+      memcpy(out, &rndn[0], 8);
+      rndn[1] = s1 >> 64;
+      memcpy(out + 8, &rndn[1], 8);
+      out += sizeof(rndn);
+
+      if ((size_t)(out_end - out) < sizeof(rndn)) break;
+      s0 *= mult2; s1 *= mult2;
+    }
+    *state = s1;
+  }
+
+  while (out < out_end) {
+    rndn[0] = mcg64(state);
 
     n = (out_end - out) > 8? 8: (out_end - out);
-    memcpy(out, &rndn, n);
+    memcpy(out, rndn, n);
     out += n;
-
-    if (out >= out_end) {
-      return;
-    }
   }
 }
 #else
@@ -54,3 +103,77 @@ void mcg64cpy(__uint128_t *state, char *out, size_t len) {
   }
 }
 #endif
+
+/*
+ * Copy "len" bytes of the pseudo-random stream seeded by "seed" starting at byte "offset" into
+ * "out", i.e. the bytes mcg64cpy() would produce there, without generating the ones before.
+ */
+void mcg64cpy_at(__uint128_t seed, uint64_t offset, char *out, size_t len) {
+  size_t skip = offset % 8, n;
+  uint64_t rndn;
+
+  mcg64_jump(&seed, offset / 8);
+  if (skip) {
+    rndn = mcg64(&seed);
+    n = (8 - skip) < len? (8 - skip): len;
+    memcpy(out, (char *)&rndn + skip, n);
+    out += n;
+    len -= n;
+  }
+  mcg64cpy(&seed, out, len);
+}
+
+typedef struct {
+  __uint128_t state;
+  char *out;
+  size_t len;
+} mcg64cpy_part;
+
+static void *mcg64cpy_thread(void *arg) {
+  mcg64cpy_part *p = arg;
+
+  mcg64cpy(&p->state, p->out, p->len);
+
+  return NULL;
+}
+
+/*
+ * Multi-threaded mcg64cpy(): split "out" into word-aligned parts filled by up to "threads"
+ * threads, each part starting at its own jump-ahead of the state.  The output and the final
+ * state are identical to those of mcg64cpy().
+ */
+void mcg64cpy_mt(__uint128_t *state, char *out, size_t len, int threads) {
+  mcg64cpy_part *parts;
+  pthread_t *tids;
+  size_t words = (len + 7) / 8, part_words, offset = 0;
+  int i, started;
+
+  if (threads > 1 && len / MCG64_MT_MIN < threads) threads = len / MCG64_MT_MIN;
+  if (threads <= 1 ||
+      (parts = calloc(threads, sizeof(mcg64cpy_part))) == NULL ||
+      (tids = calloc(threads, sizeof(pthread_t))) == NULL) {
+    if (threads > 1) free(parts);
+    mcg64cpy(state, out, len);
+    return;
+  }
+
+  part_words = words / threads;
+  for (i = 0; i < threads; i++) {
+    parts[i].state = *state;
+    mcg64_jump(&parts[i].state, offset / 8);
+    parts[i].out = out + offset;
+    parts[i].len = (i == threads - 1)? len - offset: part_words * 8;
+    offset += parts[i].len;
+  }
+
+  /* this thread fills the first part; fill any parts we fail to start a thread for here too */
+  for (started = 1; started < threads; started++)
+    if (pthread_create(&tids[started], NULL, mcg64cpy_thread, &parts[started])) break;
+  for (i = started; i < threads; i++) mcg64cpy_thread(&parts[i]);
+  mcg64cpy_thread(&parts[0]);
+  for (i = 1; i < started; i++) pthread_join(tids[i], NULL);
+
+  mcg64_jump(state, words);
+  free(tids);
+  free(parts);
+}
@@ -1,5 +1,14 @@
 #ifndef MCG64_H
+#define MCG64_H
+
+#include <stdint.h>		/* uint64_t */
+#include <stddef.h>		/* size_t */
+
 /* Module functions */
 extern void mcg64_seed(__uint128_t *state);
+extern void mcg64_jump(__uint128_t *, uint64_t);
+extern uint64_t mcg64_rand(__uint128_t *);
 extern void mcg64cpy(__uint128_t *, char *, size_t);
+extern void mcg64cpy_at(__uint128_t, uint64_t, char *, size_t);
+extern void mcg64cpy_mt(__uint128_t *, char *, size_t, int);
 #endif /* MCG64_H */
@@ -0,0 +1,309 @@
+/*
+ * OpenMetrics exporter (--metrics): a thread of its own, with an event loop of its own, serves
+ * the per-target counters of the running worker threads to scrapers (Prometheus and alike).
+ * The counters are only read here (see COUNTER_GET()), the worker threads do not take any lock
+ * for the exporter, nor do they notice a scrape.
+ */
+#define _GNU_SOURCE		/* accept4(), memmem() */
+#include <errno.h>		/* errno */
+#include <inttypes.h>		/* PRIu64 */
+#include <pthread.h>		/* pthread_create() */
+#include <stddef.h>		/* offsetof() */
+#include <stdio.h>		/* open_memstream() */
+#include <stdlib.h>		/* free() */
+#include <string.h>		/* memmem(), strerror() */
+#include <sys/socket.h>		/* accept4(), recv(), send() */
+#include <unistd.h>		/* close() */
+
+#include "mb.h"			/* WATCHDOG_MS */
+#include "merr.h"
+#include "metrics.h"
+
+/* a scrape being served */
+typedef struct metrics_client {
+  int fd;			/* -1: free slot */
+  char req[METRICS_REQ_MAX];	/* request received so far */
+  size_t req_len;
+  char *out;			/* response */
+  size_t out_len;
+  size_t out_sent;		/* bytes of out already sent */
+} metrics_client;
+
+static struct {
+  const thread *threads;	/* worker threads whose counters are exported */
+  int threads_n;
+  const request_def *defs;	/* request definitions, the targets of the counters */
+  int defs_n;
+  int lfd;			/* listening socket */
+  aeEventLoop *loop;
+  pthread_t thread;
+  int stop;			/* set by metrics_stop() */
+  metrics_client clients[METRICS_CLIENTS];
+} metrics;
+
+/* Sum up the counter at offset (in thread_counters) of target over all worker threads */
+static uint64_t metrics_sum(int target, size_t offset) {
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i < metrics.threads_n; i++)
+    sum += COUNTER_GET(*(uint64_t *)((char *)&metrics.threads[i].counters[target] + offset));
+
+  return sum;
+}
+
+#define METRICS_SUM(target, field)	metrics_sum(target, offsetof(thread_counters, field))
+
+static void metrics_label_value(FILE *f, const char *s) {
+  for (; *s; s++) {
+    if (*s == '\\' || *s == '"') fprintf(f, "\\%c", *s);
+    else if (*s == '\n') fprintf(f, "\\n");
+    else fputc(*s, f);
+  }
+}
+
+/* Write the labels identifying target d, without the closing brace so that more can follow */
+static void metrics_labels(FILE *f, const request_def *d) {
+  fprintf(f, "{target=\"%d\",host=\"", d->target);
+  metrics_label_value(f, d->host);
+  fprintf(f, "\",port=\"%d\",path=\"", d->port);
+  metrics_label_value(f, d->path? d->path: "/");
+  fprintf(f, "\"");
+}
+
+static void metrics_counter(FILE *f, const char *name, const char *unit, const char *help, size_t offset) {
+  const request_def *d;
+
+  fprintf(f, "# TYPE %s counter\n", name);
+  if (unit) fprintf(f, "# UNIT %s %s\n", name, unit);
+  fprintf(f, "# HELP %s %s\n", name, help);
+  for (d = metrics.defs; d < metrics.defs + metrics.defs_n; d++) {
+    fprintf(f, "%s_total", name);
+    metrics_labels(f, d);
+    fprintf(f, "} %"PRIu64"\n", metrics_sum(d->target, offset));
+  }
+}
+
+/* Render the metrics of all the targets into a newly allocated buffer */
+static char *metrics_render(size_t *len) {
+  static const uint64_t bounds[LATENCY_BOUNDS_N] = { LATENCY_BOUNDS };
+  static const struct {
+    const char *name;
+    size_t offset;
+  } errs[] = {
+    { "connection", offsetof(thread_counters, err_conn) },
+    { "status", offsetof(thread_counters, err_status) },
+    { "parser", offsetof(thread_counters, err_parser) },
+    { "check", offsetof(thread_counters, err_check) },
+  };
+  const request_def *d;
+  char *buf = NULL;
+  uint64_t latency[LATENCY_BOUNDS_N + 1], n;
+  FILE *f;
+  int i;
+
+  if ((f = open_memstream(&buf, len)) == NULL) return NULL;
+
+  fprintf(f, "# TYPE mb_clients gauge\n"
+             "# HELP mb_clients Connections (clients) of the target.\n");
+  for (d = metrics.defs; d < metrics.defs + metrics.defs_n; d++) {
+    fprintf(f, "mb_clients");
+    metrics_labels(f, d);
+    fprintf(f, "} %d\n", d->clients);
+  }
+
+  metrics_counter(f, "mb_requests", NULL, "Requests sent.", offsetof(thread_counters, reqs));
+  metrics_counter(f, "mb_sent_bytes", "bytes", "Bytes sent.", offsetof(thread_counters, sent));
+  metrics_counter(f, "mb_received_bytes", "bytes", "Bytes received.", offsetof(thread_counters, recv));
+  metrics_counter(f, "mb_connections", NULL, "Connection attempts.", offsetof(thread_counters, connects));
+
+  fprintf(f, "# TYPE mb_errors counter\n"
+             "# HELP mb_errors Errors by class: connection, HTTP status (> 399), response parser and response check.\n");
+  for (d = metrics.defs; d < metrics.defs + metrics.defs_n; d++)
+    for (i = 0; i < sizeof(errs)/sizeof(errs[0]); i++) {
+      fprintf(f, "mb_errors_total");
+      metrics_labels(f, d);
+      fprintf(f, ",class=\"%s\"} %"PRIu64"\n", errs[i].name, metrics_sum(d->target, errs[i].offset));
+    }
+
+  fprintf(f, "# TYPE mb_responses counter\n"
+             "# HELP mb_responses Responses by status class.\n");
+  for (d = metrics.defs; d < metrics.defs + metrics.defs_n; d++)
+    for (i = 0; i < 5; i++) {
+      fprintf(f, "mb_responses_total");
+      metrics_labels(f, d);
+      fprintf(f, ",class=\"%dxx\"} %"PRIu64"\n", i + 1, METRICS_SUM(d->target, status[i]));
+    }
+
+  fprintf(f, "# TYPE mb_latency_seconds histogram\n"
+             "# UNIT mb_latency_seconds seconds\n"
+             "# HELP mb_latency_seconds Response times.\n");
+  for (d = metrics.defs; d < metrics.defs + metrics.defs_n; d++) {
+    /* count is the sum of the buckets read, a scrape does not catch the worker threads in step */
+    for (i = 0; i <= LATENCY_BOUNDS_N; i++)
+      latency[i] = METRICS_SUM(d->target, latency[i]);
+    for (i = 0, n = 0; i <= LATENCY_BOUNDS_N; i++) {
+      n += latency[i];
+      fprintf(f, "mb_latency_seconds_bucket");
+      metrics_labels(f, d);
+      if (i < LATENCY_BOUNDS_N) fprintf(f, ",le=\"%g\"} %"PRIu64"\n", (double)bounds[i] / 1000000, n);
+      else fprintf(f, ",le=\"+Inf\"} %"PRIu64"\n", n);
+    }
+    fprintf(f, "mb_latency_seconds_count");
+    metrics_labels(f, d);
+    fprintf(f, "} %"PRIu64"\n", n);
+    fprintf(f, "mb_latency_seconds_sum");
+    metrics_labels(f, d);
+    fprintf(f, "} %.6f\n", (double)METRICS_SUM(d->target, latency_sum) / 1000000);
+  }
+  fprintf(f, "# EOF\n");
+
+  if (fclose(f)) {
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+static void metrics_client_close(metrics_client *cl) {
+  aeDeleteFileEvent(metrics.loop, cl->fd, AE_READABLE | AE_WRITABLE);
+  close(cl->fd);
+  free(cl->out);
+  cl->fd = -1;
+  cl->out = NULL;
+}
+
+static void metrics_write(aeEventLoop *loop, int fd, void *data, int mask) {
+  metrics_client *cl = data;
+  ssize_t n;
+
+  n = send(fd, cl->out + cl->out_sent, cl->out_len - cl->out_sent, MSG_NOSIGNAL);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (n > 0) cl->out_sent += n;
+  if (n <= 0 || cl->out_sent == cl->out_len) metrics_client_close(cl);
+}
+
+/* Prepare the response to the (complete) request of cl */
+static int metrics_respond(metrics_client *cl) {
+  char *body = NULL, hdr[256];
+  size_t body_len = 0;
+  int hdr_len;
+
+  if (cl->req_len < 13 || memcmp(cl->req, "GET /metrics", 12) ||
+      (cl->req[12] != ' ' && cl->req[12] != '?')) {
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    if ((cl->out = strdup(not_found)) == NULL) return -1;
+    cl->out_len = sizeof(not_found) - 1;
+    return 0;
+  }
+
+  if ((body = metrics_render(&body_len)) == NULL) return -1;
+  hdr_len = snprintf(hdr, sizeof(hdr),
+    "HTTP/1.1 200 OK\r\nContent-Type: " METRICS_CONTENT_TYPE "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+    body_len);
+  if ((cl->out = malloc(hdr_len + body_len)) == NULL) {
+    free(body);
+    return -1;
+  }
+  memcpy(cl->out, hdr, hdr_len);
+  memcpy(cl->out + hdr_len, body, body_len);
+  cl->out_len = hdr_len + body_len;
+  free(body);
+
+  return 0;
+}
+
+static void metrics_read(aeEventLoop *loop, int fd, void *data, int mask) {
+  metrics_client *cl = data;
+  ssize_t n;
+
+  n = recv(fd, cl->req + cl->req_len, sizeof(cl->req) - cl->req_len, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (n <= 0) {
+    metrics_client_close(cl);
+    return;
+  }
+  cl->req_len += n;
+
+  /* wait for the end of the request headers; we ignore any body */
+  if (!memmem(cl->req, cl->req_len, "\r\n\r\n", 4) && cl->req_len < sizeof(cl->req)) return;
+
+  aeDeleteFileEvent(loop, fd, AE_READABLE);
+  if (metrics_respond(cl) || aeCreateFileEvent(loop, fd, AE_WRITABLE, metrics_write, cl) == AE_ERR)
+    metrics_client_close(cl);
+}
+
+static void metrics_accept(aeEventLoop *loop, int lfd, void *data, int mask) {
+  metrics_client *cl = NULL;
+  int fd, i;
+
+  if ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) return;
+
+  for (i = 0; i < METRICS_CLIENTS; i++)
+    if (metrics.clients[i].fd < 0) {
+      cl = &metrics.clients[i];
+      break;
+    }
+  if (!cl || aeCreateFileEvent(loop, fd, AE_READABLE, metrics_read, cl) == AE_ERR) {
+    /* too many scrapes at a time */
+    close(fd);
+    return;
+  }
+  cl->fd = fd;
+  cl->req_len = 0;
+  cl->out_sent = 0;
+}
+
+static int metrics_watchdog(aeEventLoop *loop, long long id, void *data) {
+  if (__atomic_load_n(&metrics.stop, __ATOMIC_RELAXED)) aeStop(loop);
+
+  return WATCHDOG_MS;
+}
+
+static void *metrics_main(void *arg) {
+  int i;
+
+  aeMain(metrics.loop);
+
+  for (i = 0; i < METRICS_CLIENTS; i++)
+    if (metrics.clients[i].fd >= 0) metrics_client_close(&metrics.clients[i]);
+  close(metrics.lfd);
+  aeDeleteEventLoop(metrics.loop);
+
+  return NULL;
+}
+
+/*
+ * Start serving the counters of the worker threads and their request definitions on listen_on
+ * ([host:]port).  setsize is the size of the event loop, it must be above any descriptor.
+ */
+void metrics_start(const char *listen_on, const thread *threads, int threads_n, const request_def *defs, int defs_n, int setsize) {
+  int i;
+
+  metrics.threads = threads;
+  metrics.threads_n = threads_n;
+  metrics.defs = defs;
+  metrics.defs_n = defs_n;
+  metrics.stop = 0;
+  for (i = 0; i < METRICS_CLIENTS; i++) metrics.clients[i].fd = -1;
+
+  if ((metrics.lfd = socket_listen(listen_on, true)) < 0)
+    die(EXIT_FAILURE, "metrics: cannot listen on %s\n", listen_on);
+  if ((metrics.loop = aeCreateEventLoop(setsize + METRICS_CLIENTS)) == NULL)
+    die(EXIT_FAILURE, "metrics: cannot create event loop\n");
+  aeCreateFileEventOrDie(metrics.loop, metrics.lfd, AE_READABLE, metrics_accept, NULL);
+  if (aeCreateTimeEvent(metrics.loop, WATCHDOG_MS, metrics_watchdog, NULL, NULL) == AE_ERR)
+    die(EXIT_FAILURE, "metrics: cannot create time event: %s (%d)\n", strerror(errno), errno);
+
+  if ((errno = pthread_create(&metrics.thread, NULL, metrics_main, NULL)))
+    die(EXIT_FAILURE, "metrics: unable to create thread: %s (%d)\n", strerror(errno), errno);
+  info("metrics: serving /metrics on %s\n", listen_on);
+}
+
+/* Stop serving the counters, the worker threads must not be freed before */
+void metrics_stop() {
+  __atomic_store_n(&metrics.stop, 1, __ATOMIC_RELAXED);
+  pthread_join(metrics.thread, NULL);
+}
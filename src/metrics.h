@@ -0,0 +1,14 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "net.h"			/* thread, request_def */
+
+#define METRICS_CLIENTS		16		/* maximum number of scrapes served at the same time */
+#define METRICS_REQ_MAX		4096		/* maximum length of a scrape request (headers) */
+#define METRICS_CONTENT_TYPE	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* Module functions */
+extern void metrics_start(const char *, const thread *, int, const request_def *, int, int);
+extern void metrics_stop();
+
+#endif /* METRICS_H */
@@ -1,7 +1,10 @@
 #include <ctype.h>		/* isspace() */
 #include <errno.h>		/* errno */
 #include <fcntl.h>		/* fnctl() */
+#include <linux/errqueue.h>	/* struct scm_timestamping */
+#include <linux/net_tstamp.h>	/* SOF_TIMESTAMPING_* */
 #include <netdb.h>		/* freeaddrinfo() */
+#include <netinet/in.h>		/* IP_BIND_ADDRESS_NO_PORT */
 #include <netinet/tcp.h>	/* TCP_NODELAY, TCP_FASTOPEN, ... */
 #include <resolv.h>		/* _res */
 #include <stdio.h>		/* stdout, stderr, fopen(), fclose() */
@@ -9,22 +12,27 @@
 #include <string.h>		/* strlen() */
 #include <sys/ioctl.h>		/* ioctl, FIONREAD */
 #include <sys/socket.h>		/* send/recv(), MSG_NOSIGNAL */
+#include <sys/uio.h>		/* struct iovec */
 #include <unistd.h>		/* read(), close() */
 
 #include "mb.h"
+#include "mcg.h"		/* mcg64cpy_at() */
 #include "merr.h"
 #include "net.h"
 #ifdef HAVE_SSL
 #include "ssl.h"
 #endif
 #include "stats.h"		/* MIN/MAX() */
+#include "h2.h"			/* h2_new(), h2_read(), h2_write() */
+#include "tmpl.h"		/* tmpl_render() */
+#include "check.h"		/* check_response() */
+#include "cps.h"		/* cps_admit() */
+#include "dns.h"		/* dns_sources_free() */
+#include "replay.h"		/* replay_entry, replay_origin */
 
 /* Internal functions */
 void aeCreateFileEventOrDie(aeEventLoop *, int, int, aeFileProc *, void *);
-static inline char *http_headers_create(connection *, bool);
-void http_request_create(connection *, const char *, char **, size_t *);
-void http_request_create_cc(connection *);
-void http_request_create_ka(connection *);
+static inline char *http_headers_create(request_def *, size_t *, bool);
 int socket_set_nonblock(int);
 int socket_set_keep_alive(int, int, int, int);
 static int tcp_non_block_bind_connect(connection *);
@@ -34,8 +42,15 @@ static int socket_connect_delay_passed(aeEventLoop *, long long, void *);
 static int socket_write_delay_passed(aeEventLoop *, long long, void *);
 static inline bool connection_delay(connection *, aeTimeProc *);
 void socket_reconnect(connection *);
+void connection_handshake_done(connection *, uint64_t);
+static inline void socket_read_pipelined(aeEventLoop *, connection *);
+static inline void pipeline_push(aeEventLoop *, connection *);
 void socket_read(aeEventLoop *, int, void *, int);
+static inline uint64_t cmsg_timestamp(struct msghdr *);
+static inline void socket_errqueue_drain(connection *);
+static inline ssize_t socket_read_timestamped(connection *, size_t);
 static inline void socket_write_request_random_chunked(aeEventLoop *, connection *, char *, size_t);
+static inline void socket_write_request_random_chunked_iov(aeEventLoop *, connection *, char *, size_t);
 static inline void socket_write_request(aeEventLoop *, connection *, char *, size_t);
 void socket_write(aeEventLoop *, int, void *, int);
 
@@ -57,38 +72,34 @@ void aeCreateFileEventOrDie(aeEventLoop *eventLoop, int fd, int mask,
 }
 
 /*
- * Create HTTP headers
+ * Create HTTP headers, set *cookie_off to the offset a "Cookie" header is to be inserted at
  * Note: this function has a side effect of trimming request body, when content length is too large.
  */
-static inline char *http_headers_create(connection *c, bool conn_close) {
-  connection *cs_ptr = c;
+static inline char *http_headers_create(request_def *d, size_t *cookie_off, bool conn_close) {
   size_t headers_len = 0;
   char *headers;
   char *headers_ptr;
 
   /* calculate headers length */
-  headers_len += strlen(c->method ? c->method : "GET") + 1 + strlen(c->path ? c->path : "/") + 1 + strlen(HTTP_PROTO) + 2;	/* + 2x spaces + HTTP_CRLF */
-  headers_len += strlen(HTTP_HOST) + 2 + strlen(c->host ? c->host : "localhost") + 2;	/* + ': ' + HTTP_CRLF */
+  headers_len += strlen(d->method ? d->method : "GET") + 1 + strlen(d->path ? d->path : "/") + 1 + strlen(HTTP_PROTO) + 2;	/* + 2x spaces + HTTP_CRLF */
+  headers_len += strlen(HTTP_HOST) + 2 + strlen(d->host ? d->host : "localhost") + 2;	/* + ': ' + HTTP_CRLF */
   headers_len += strlen(HTTP_USER_AGENT) + 2;		/* + HTTP_CRLF */
   headers_len += strlen(HTTP_ACCEPT) + 2;		/* + HTTP_CRLF */
 
-  if (cs_ptr->headers) {
+  if (d->headers) {
     key_value *kv;
-    for (kv = c->headers; kv->key; kv++) {
+    for (kv = d->headers; kv->key; kv++) {
       headers_len += strlen(kv->key);
       if (kv->value) headers_len += strlen(kv->value);
       headers_len += 4;		/* ': ' + '\r\n' */
     }
   }
-  if (cs_ptr->cookies) {
-    headers_len += 6 + strlen(cs_ptr->cookies) + 4;	/* HTTP_COOKIE + cookie length + separators */
-  }
   if (conn_close) headers_len += 17 + 2;		/* HTTP_CONN_CLOSE + separators */
-  if (cs_ptr->req_body) {
+  if (d->req_body) {
     headers_len += 14 + 4 + HTTP_CONT_MAX;		/* HTTP_CONT_LEN + separators + HTTP_CONT_MAX */
   }
 
-  if (cs_ptr->req_body_type == body_random) {
+  if (d->req_body_type == body_random) {
     /* Add Transfer-Encoding header (random body type always has chunked content) */
     headers_len += strlen(HTTP_TE_CHUNKED) + 2;		/* + HTTP_CRLF */
   }
@@ -103,13 +114,13 @@ static inline char *http_headers_create(connection *c, bool conn_close) {
            HTTP_HOST ": %s" HTTP_CRLF
            HTTP_USER_AGENT HTTP_CRLF
            HTTP_ACCEPT HTTP_CRLF,
-           c->method ? c->method : "GET",
-           c->path ? c->path : "/",
-           c->host ? c->host : "localhost");
+           d->method ? d->method : "GET",
+           d->path ? d->path : "/",
+           d->host ? d->host : "localhost");
 
-  if (cs_ptr->headers) {
+  if (d->headers) {
     key_value *kv;
-    for (kv = c->headers; kv->key; kv++) {
+    for (kv = d->headers; kv->key; kv++) {
       strcpy(headers_ptr, kv->key);
       headers_ptr += strlen(kv->key);
       strcpy(headers_ptr, ": ");
@@ -122,38 +133,29 @@ static inline char *http_headers_create(connection *c, bool conn_close) {
       headers_ptr += 2;
     }
   }
-  if (cs_ptr->cookies) {
-    /* Add "Cookie: " header */
-    strcpy(headers_ptr, HTTP_COOKIE);
-    headers_ptr += 6;
-    strcpy(headers_ptr, ": ");
-    headers_ptr += 2;
-    strcpy(headers_ptr, cs_ptr->cookies);
-    headers_ptr += strlen(cs_ptr->cookies);
-    strcpy(headers_ptr, HTTP_CRLF);
-    headers_ptr += 2;
-  }
+  /* the "Cookie" header of the cookie jar goes here, see cookie_request_render() */
+  *cookie_off = headers_ptr - headers;
   if (conn_close) {
     /* Add "Connection: close" header */
     strcpy(headers_ptr, HTTP_CONN_CLOSE HTTP_CRLF);
     headers_ptr += 17 + 2;	/* HTTP_CONN_CLOSE + separators */
   }
 
-  if (cs_ptr->req_body_type == body_random) {
+  if (d->req_body_type == body_random) {
     /* Add Transfer-Encoding header (random body type always ha chunked content) */
     strcpy(headers_ptr, HTTP_TE_CHUNKED);
     headers_ptr += strlen(HTTP_TE_CHUNKED);
     strcpy(headers_ptr, HTTP_CRLF);
     headers_ptr += 2;
-  } else if (cs_ptr->req_body) {
+  } else if (d->req_body) {
     /* Add Content-Length header */
-    size_t content_len = strlen(cs_ptr->req_body);
+    size_t content_len = strlen(d->req_body);
     strcpy(headers_ptr, HTTP_CONT_LEN);
     headers_ptr += strlen(HTTP_CONT_LEN);
     if (headers_len + 2 + content_len > MAX_REQ_LEN) {
       warning("content length too large (%ld), trimming; consider increasing MAX_REQ_LEN (%ld)\n", content_len, MAX_REQ_LEN);
       content_len = MAX_REQ_LEN - headers_len - 2;
-      cs_ptr->req_body[content_len] = 0;
+      d->req_body[content_len] = 0;
     }
     sprintf(headers_ptr, ": %lu" HTTP_CRLF, content_len);
   }
@@ -161,67 +163,132 @@ static inline char *http_headers_create(connection *c, bool conn_close) {
   return headers;
 }
 
-void http_request_create(connection *c, const char *headers, char **request, size_t *length)
+void http_request_create(const request_def *d, const char *headers, char **request, size_t *length)
 {
-  size_t request_len = strlen(headers) + 2 + (c->req_body? strlen(c->req_body): 0) + 1;	/* + HTTP_CRLF + '\0' */
+  size_t request_len = strlen(headers) + 2 + (d->req_body? strlen(d->req_body): 0) + 1;	/* + HTTP_CRLF + '\0' */
   if ((*request = malloc(request_len + 1)) == NULL) {
     die(EXIT_FAILURE, "malloc(): cannot allocate memory for HTTP request\n");
   }
 
   *length = snprintf(*request, request_len, "%s" HTTP_CRLF "%s",
               headers? headers: "",
-              c->req_body? c->req_body : "");		/* a TE chunked request has an empty body */
+              d->req_body? d->req_body : "");		/* a TE chunked request has an empty body */
 }
 
-void http_request_create_cc(connection *c)
+/* Create the cookie-less request data shared by all connections of request definition d */
+void request_def_requests_create(request_def *d)
 {
   char *headers;
 
-  if (c->request_cclose) free(c->request_cclose);
-
-  headers = http_headers_create(c, 1);
-  http_request_create(c, headers, &c->request_cclose, &c->request_cclose_length);
-  if (headers) free(headers);
-}
-
-void http_request_create_ka(connection *c)
-{
-  char *headers;
+  headers = http_headers_create(d, &d->cookie_off, 1);
+  http_request_create(d, headers, &d->request_cclose, &d->request_cclose_length);
+  free(headers);
 
-  if (c->request) free(c->request);
+  headers = http_headers_create(d, &d->cookie_off, 0);
+  http_request_create(d, headers, &d->request, &d->request_length);
+  free(headers);
 
-  headers = http_headers_create(c, 0);
-  http_request_create(c, headers, &c->request, &c->request_length);
-  if (headers) free(headers);
+  tmpl_def_init(d);
+  if (d->scheme == h2 || d->scheme == h2c) h2_def_init(d);
 }
 
-void http_requests_create(connection *c)
-{
-  http_request_create_cc(c);
-  http_request_create_ka(c);
+void request_def_init(request_def *d) {
+  d->target = 0;
+  d->clients = 1;
+  d->host_from = NULL;
+  d->scheme = http;
+  d->host = NULL;
+  d->port = 80;
+  d->addr_from = NULL;
+  d->addr_to = NULL;
+  d->addrs = NULL;
+  d->tcp.keep_alive.enable = false;
+  d->tcp.keep_alive.idle = 0;
+  d->tcp.keep_alive.intvl = 0;
+  d->tcp.keep_alive.cnt = 0;
+  d->tcp.zerocopy = false;
+  d->method = NULL;
+  d->path = NULL;
+  d->headers = NULL;
+  d->delay_min = 0;
+  d->delay_max = 0;
+  d->ramp_up = 0;
+  d->rate.reqs = 0;
+  d->rate.interval = 0;
+  d->reqs_max = 0;
+  d->keep_alive_reqs = 0;
+  d->pipeline = 1;
+  d->streams = 1;
+  d->h2_hblock[0] = d->h2_hblock[1] = d->h2_hblock[2] = NULL;
+  d->h2_table_size = 0;
+  d->h2_body_len = 0;
+  d->tls_session_reuse = true;
+  d->tls_session_reuse_ratio = 1.0;
+  d->tls_session_shared = false;
+#ifdef HAVE_SSL
+  d->tls_session = NULL;
+#endif
+  d->req_body = NULL;
+  d->req_body_type = body_content;
+  d->req_body_size = 0;
+  d->req_body_stream = false;
+  d->chunk_hdr[0][0] = d->chunk_hdr[1][0] = '\0';
+  d->request = NULL;
+  d->request_cclose = NULL;
+  d->request_length = 0;
+  d->request_cclose_length = 0;
+  d->cookie_off = 0;
+  d->check.enable = false;
+  d->check.sample = 1;
+  d->check.length = -1;
+  d->check.contains = NULL;
+  d->check.regex_src = NULL;
+  d->check.window = CHECK_WINDOW;
+  d->check.crc = false;
+  d->check.crc32c = 0;
+  d->values_file = NULL;
+  d->values = NULL;
+  d->tmpl[0] = d->tmpl[1] = NULL;
+  d->close_client = false;
+  d->close_linger = false;
+  d->close_linger_sec = 0;
 }
 
-void connection_init(connection *c) {
-  c->t = NULL;
+void connection_init(connection *c, request_def *d) {
   c->fd = -1;
-  c->host_from = NULL;
-  c->scheme = http;
-  c->host = NULL;
-  c->port = 80;
-  c->addr_from = NULL;
-  c->addr_to = NULL;
-  c->tcp.keep_alive.enable = false;
-  c->tcp.keep_alive.idle = 0;
-  c->tcp.keep_alive.intvl = 0;
-  c->tcp.keep_alive.cnt = 0;
-  c->method = NULL;
-  c->path = NULL;
-  c->headers = NULL;
-  c->delay_min = 0;
-  c->delay_max = 0;
+  c->t = NULL;
+  c->def = d;
+  c->written = 0;
+  c->written_overhead = 0;
+  c->read = 0;
+  c->status = 0;
+  c->message_complete = false;
+  c->sizing = false;
+  c->cclose = false;
+  c->header_cclose = false;
   c->delayed = false;
   c->delayed_id = 0;
-  c->ramp_up = 0;
+  c->ts.tx = c->ts.rx = 0;
+  c->tmpl_buf = NULL;
+  c->tmpl_len = 0;
+  c->tmpl_rnd = 0;
+  c->req_body_random = NULL;
+  c->body.unsent = 0;
+  c->body.offset = 0;
+  c->body.pos = 0;
+  c->body.stream = 0;
+  c->body.len = 0;
+  c->body.last = false;
+  c->rate.next = 0;
+  c->rate.intended = 0;
+  c->replay.e = NULL;
+  c->replay.n = 0;
+  c->pipe.start = NULL;
+  c->pipe.head = 0;
+  c->pipe.n = 0;
+  if (CONN_PIPELINED(c) && (c->pipe.start = calloc(d->pipeline, sizeof(uint64_t))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for the request pipeline\n");
+  c->h2 = (d->scheme == h2 || d->scheme == h2c)? h2_new(d): NULL;
   c->cstats.start = 0;
   c->cstats.writeable = 0;
   c->cstats.established = 0;
@@ -231,35 +298,17 @@ void connection_init(connection *c) {
   c->cstats.reqs_total = 0;
   c->cstats.written_total = 0;
   c->cstats.read_total = 0;
-  c->reqs_max = 0;
-  c->keep_alive_reqs = 0;
-  c->tls_session_reuse = true;
-  c->req_body = NULL;
-  c->req_body_random = NULL;
-  c->req_body_type = body_content;
-  c->req_body_size = 0;
-  c->request = NULL;
-  c->request_cclose = NULL;
-  c->close_client = false;
-  c->close_linger = false;
-  c->close_linger_sec = 0;
-  c->cclose = false;
-  c->header_cclose = false;
-  c->request_length = 0;
-  c->request_cclose_length = 0;
-  c->message_complete = false;
-  c->body.unsent = 0;
-  c->body.offset = 0;
-  c->written = 0;
-  c->written_overhead = 0;
-  c->read = 0;
-  c->status = 0;
   c->cookies = NULL;
+  c->check.on = false;
+  c->check.n = 0;
+  c->check.len = 0;
+  c->check.crc = 0;
+  c->check.head_len = 0;
+  c->check.head = NULL;
 #ifdef HAVE_SSL
   c->ssl = NULL;
   c->ssl_session = NULL;
 #endif
-  c->duplicate = false;
 }
 
 void connections_free(connection *cs) {
@@ -268,38 +317,57 @@ void connections_free(connection *cs) {
   if (!cs_ptr) return;
 
   for (; cs_ptr->t != NULL; cs_ptr++) {
-    if (cs_ptr->duplicate) {
-      /* duplicated connection, most data structures already freed by freeing related connection */
-      goto free_dups;
+    free(cs_ptr->cookies);
+    free(cs_ptr->check.head);
+    free(cs_ptr->pipe.start);
+    free(cs_ptr->tmpl_buf);
+    h2_free(cs_ptr);
+
+#ifdef HAVE_SSL
+    if (cs_ptr->ssl) ssl_free(cs_ptr);
+#endif
+  }
+
+  free(cs);
+}
+
+void request_defs_free(request_def *defs, int n) {
+  request_def *d;
+
+  if (!defs) return;
+
+  for (d = defs; d < defs + n; d++) {
+    if (d->host_from) free(d->host_from);
+    if (d->host) free(d->host);
+    if (d->addr_to) freeaddrinfo(d->addr_to);
+    while (d->addrs) {
+      addr_list *retired = d->addrs->retired;
+      free(d->addrs);
+      d->addrs = retired;
     }
-    if (cs_ptr->host_from) free(cs_ptr->host_from);
-    if (cs_ptr->host) free(cs_ptr->host);
-    if (cs_ptr->addr_from) freeaddrinfo(cs_ptr->addr_from);
-    if (cs_ptr->addr_to) freeaddrinfo(cs_ptr->addr_to);
-    if (cs_ptr->method) free(cs_ptr->method);
-    if (cs_ptr->path) free(cs_ptr->path);
-    if (cs_ptr->headers) {
+    if (d->method) free(d->method);
+    if (d->path) free(d->path);
+    if (d->headers) {
       key_value *kv;
-      for (kv = cs_ptr->headers; kv->key; kv++) {
+      for (kv = d->headers; kv->key; kv++) {
         if (kv->key) free(kv->key);
         if (kv->value) free(kv->value);
       }
-      free(cs_ptr->headers);
+      free(d->headers);
     }
-    if (cs_ptr->req_body) free(cs_ptr->req_body);
-
-free_dups:
-    if (cs_ptr->req_body_random) free(cs_ptr->req_body_random);
-    if (cs_ptr->request) free(cs_ptr->request);
-    if (cs_ptr->request_cclose) free(cs_ptr->request_cclose);
-    if (cs_ptr->cookies) free(cs_ptr->cookies);
-
+    if (d->req_body) free(d->req_body);
+    if (d->request) free(d->request);
+    if (d->request_cclose) free(d->request_cclose);
 #ifdef HAVE_SSL
-    if (cs_ptr->ssl) ssl_free(cs_ptr);
+    if (d->tls_session) wolfSSL_SESSION_free(d->tls_session);
 #endif
+    h2_def_free(d);
+    tmpl_def_free(d);
+    check_def_free(d);
   }
 
-  free(cs);
+  free(defs);
+  dns_sources_free();
 }
 
 int socket_set_nonblock(int fd) {
@@ -351,8 +419,9 @@ int socket_set_keep_alive(int fd, int idle, int intvl, int cnt) {
 }
 
 /* Override nameservers if environment variable(s) NAMESERVER<x> exist,
-   where <x> starts at 1. */
-void override_ns() {
+   where <x> starts at 1.  The resolver state is per thread, every thread resolving names
+   needs to call this; only report the override if "report" is set. */
+void override_ns(bool report) {
   int i;
   int nscount = 0;
 
@@ -369,7 +438,7 @@ void override_ns() {
     if (*ns == 0) continue;
 
     if (inet_pton(AF_INET, ns, &_res.nsaddr_list[i].sin_addr) < 1) {
-      error("ignoring invalid nameserver %s (%s)\n", envvar, ns);
+      if (report) error("ignoring invalid nameserver %s (%s)\n", envvar, ns);
       continue;
     }
 
@@ -379,6 +448,7 @@ void override_ns() {
   if (nscount > 0) {
     /* valid nameserver(s) found, adjust the _res nameserver count */
     _res.nscount = nscount;
+    if (!report) return;
 
     info("found nameserver override:\n");
     for (i = 0; i < _res.nscount; i++) {
@@ -390,6 +460,55 @@ void override_ns() {
   }
 }
 
+/* Split "[host]:port", "host:port" or "port" into newly allocated host (NULL if none) and port strings */
+void addr_parse(const char *s, char **host, char **port) {
+  const char *p = strrchr(s, ':');
+
+  *host = NULL;
+  if (!p) {
+    if ((*port = strdup(s)) == NULL) die(EXIT_FAILURE, "strdup(): cannot allocate memory\n");
+    return;
+  }
+  if (*s == '[' && p > s && p[-1] == ']') {
+    /* IPv6 address */
+    *host = strndup(s + 1, p - s - 2);
+  } else {
+    *host = strndup(s, p - s);
+  }
+  if (*host == NULL || (*port = strdup(p + 1)) == NULL) die(EXIT_FAILURE, "strdup(): cannot allocate memory\n");
+}
+
+/*
+ * Return a socket listening on listen_on ([host:]port), -1 on error.  Without a host, it listens
+ * on the wildcard address if passive, on the IPv4 loopback address otherwise.
+ */
+int socket_listen(const char *listen_on, bool passive) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = passive? AI_PASSIVE: 0 };
+  struct addrinfo *addr;
+  char *host, *port;
+  int fd, r, on = 1;
+
+  addr_parse(listen_on, &host, &port);
+  if (!host && !passive) hints.ai_family = AF_INET;	/* not ::1 first, 127.0.0.1 is what "localhost" gets */
+  r = getaddrinfo(host, port, &hints, &addr);
+  free(host); free(port);
+  if (r) {
+    error("cannot resolve %s: %s\n", listen_on, gai_strerror(r));
+    return -1;
+  }
+  if ((fd = socket(addr->ai_family, SOCK_STREAM, 0)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+      bind(fd, addr->ai_addr, addr->ai_addrlen) ||
+      listen(fd, 16)) {
+    error("cannot listen on %s: %s (%d)\n", listen_on, strerror(errno), errno);
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addr);
+
+  return fd;
+}
+
 /* network address and service translation */
 int host_resolve(char *host, int port, struct addrinfo **addr) {
   char portstr[6];              /* strlen("65535") + 1 */
@@ -422,15 +541,67 @@ int host_resolve(char *host, int port, struct addrinfo **addr) {
   return rc;
 }
 
+/*
+ * Bind socket fd of connection c to the next source address of the address family family.  The
+ * connects of a request definition go round-robin across the source addresses.  Without a
+ * port_from range, IP_BIND_ADDRESS_NO_PORT defers picking the source port to connect(), which
+ * can then reuse a port towards different targets instead of reserving it at bind().
+ */
+static int source_bind(connection *c, int fd, int family) {
+  const request_def *d = c->def;
+  const addr_list *src = d->addr_from;
+  uint64_t seq = c->client + c->cstats.connections * d->clients;
+  int ports = d->port_from.hi? d->port_from.hi - d->port_from.lo + 1: 0, i, k, flags = 1;
+  bool tried = false;
+
+  for (i = 0; i < src->n; i++) {
+    struct sockaddr_storage ss = src->a[(seq + i) % src->n].sa;
+    socklen_t len = src->a[(seq + i) % src->n].len;
+
+    if (ss.ss_family != family) continue;
+    tried = true;
+
+    if (!ports) {
+      /* best effort, kernels before 4.2 pick the port at bind() */
+      setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, (void *)&flags, sizeof(flags));
+      if (bind(fd, (struct sockaddr *)&ss, len) == 0) return 0;
+      continue;
+    }
+
+    for (k = 0; k < SOURCE_PORT_TRIES && k < ports; k++) {
+      uint16_t port = htons(d->port_from.lo + (seq / src->n + k) % ports);
+
+      if (family == AF_INET6) ((struct sockaddr_in6 *)&ss)->sin6_port = port;
+      else ((struct sockaddr_in *)&ss)->sin_port = port;
+      if (bind(fd, (struct sockaddr *)&ss, len) == 0) return 0;
+      if (errno != EADDRINUSE) break;
+    }
+  }
+
+  if (tried)
+    error("unable to bind source %s: %s (%d)\n", d->host_from, strerror(errno), errno);
+  else {
+    error("no source address of %s matches the address family of %s\n", d->host_from, d->host);
+    errno = EADDRNOTAVAIL;
+  }
+
+  return -1;
+}
+
 pthread_mutex_t socket_lock = PTHREAD_MUTEX_INITIALIZER;
 static int tcp_non_block_bind_connect(connection *c) {
-  int fd, rc, flags = 1;
-  struct addrinfo *a, *b;
+  int fd = -1, i, k, flags = 1;
+  const addr_list *addrs = def_addrs(c->def);
+
+  /* spread the clients across the addresses and move on to the next one on every reconnect */
+  k = (c->client + c->cstats.connections) % addrs->n;
+  for (i = 0; i < addrs->n; i++) {
+    const struct sockaddr *sa = (const struct sockaddr *)&addrs->a[(k + i) % addrs->n].sa;
+    socklen_t sa_len = addrs->a[(k + i) % addrs->n].len;
 
-  for (a = c->addr_to; a != NULL; a = a->ai_next) {
     pthread_mutex_lock(&socket_lock);
     /* this critical section prevents coredumps when there are too many open files (the call below returns fd < 0) */
-    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    fd = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
     pthread_mutex_unlock(&socket_lock);
     if (fd == -1) continue;
 
@@ -467,10 +638,10 @@ static int tcp_non_block_bind_connect(connection *c) {
     }
 #endif
 
-    if (c->close_linger) {
+    if (c->def->close_linger) {
       struct linger l;
       l.l_onoff = 1;
-      l.l_linger = c->close_linger_sec;
+      l.l_linger = c->def->close_linger_sec;
       if (setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof(l)) == -1) {
         error("unable to setsockopt SO_LINGER: %s (%d)\n", strerror(errno), errno);
         goto error;
@@ -483,27 +654,36 @@ static int tcp_non_block_bind_connect(connection *c) {
       goto error;
     }
 
-    if (socket_set_nonblock(fd)) goto error;
-    if (c->tcp.keep_alive.enable)
-      if (socket_set_keep_alive(fd, c->tcp.keep_alive.idle, c->tcp.keep_alive.intvl, c->tcp.keep_alive.cnt))
-        goto error;
+    if (cfg.incoming_cpu && c->t->cpu >= 0 && setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, (void *)&c->t->cpu, sizeof(c->t->cpu)) == -1) {
+      error("unable to setsockopt SO_INCOMING_CPU: %s (%d)\n", strerror(errno), errno);
+      goto error;
+    }
 
-    if (c->addr_from) {
-      bool bound = false;
+    if (c->def->tcp.zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, (void *)&flags, sizeof(flags)) == -1) {
+      error("unable to setsockopt SO_ZEROCOPY: %s (%d)\n", strerror(errno), errno);
+      goto error;
+    }
 
-      for (b = c->addr_from; b != NULL; b = b->ai_next) {
-        if ((rc = bind(fd, b->ai_addr, b->ai_addrlen)) != -1) {
-          bound = true;
-          break;
-        }
-      }
-      if (!bound) {
-        error("unable to bind source %s: %s\n", c->host_from, gai_strerror(rc));
+    if (c->def->timestamping) {
+      /* only the timestamps are looped back to the error queue, not the data sent */
+      int ts = SOF_TIMESTAMPING_OPT_TSONLY | ((cfg.timestamping == ts_hardware)?
+        SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE:
+        SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE);
+
+      if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, (void *)&ts, sizeof(ts)) == -1) {
+        error("unable to setsockopt SO_TIMESTAMPING: %s (%d)\n", strerror(errno), errno);
         goto error;
       }
     }
 
-    if (connect(fd, a->ai_addr, a->ai_addrlen) == -1) {
+    if (socket_set_nonblock(fd)) goto error;
+    if (c->def->tcp.keep_alive.enable)
+      if (socket_set_keep_alive(fd, c->def->tcp.keep_alive.idle, c->def->tcp.keep_alive.intvl, c->def->tcp.keep_alive.cnt))
+        goto error;
+
+    if (c->def->addr_from && source_bind(c, fd, sa->sa_family)) goto error;
+
+    if (connect(fd, sa, sa_len) == -1) {
       if (errno == EINPROGRESS) {
         goto end;
       }
@@ -515,7 +695,7 @@ static int tcp_non_block_bind_connect(connection *c) {
 end:
     return fd;
   }
-  if (a == NULL)
+  if (i == addrs->n)
     error("creating socket: %s (%d)\n", strerror(errno), errno);
 
 error:
@@ -545,6 +725,11 @@ static int socket_connect_delay_passed(aeEventLoop *loop, long long id, void *da
 
 static int socket_write_delay_passed(aeEventLoop *loop, long long id, void *data) {
   connection *c = data;
+  uint64_t now = time_us(), lag = now > c->delayed_due? now - c->delayed_due: 0;
+
+  COUNTER_ADD(c->t->self.lag_n, 1);
+  COUNTER_ADD(c->t->self.lag_sum, lag);
+  if (lag > c->t->self.lag_max) __atomic_store_n(&c->t->self.lag_max, lag, __ATOMIC_RELAXED);
   c->delayed = false;
   aeDeleteTimeEvent(loop, c->delayed_id);
   socket_write_enable(c);
@@ -556,17 +741,45 @@ static inline bool connection_delay(connection *c, aeTimeProc *f_cb) {
 
   if (c->delayed) {
     uint64_t now = time_us();
+
+    if (CONN_OPEN_LOOP(c)) {
+      /* open-loop: start requests on a fixed timeline regardless of how fast the responses come */
+      if (c->replay.n) {
+        /* the time of the next request of the replay stream; none left: socket_write() stops */
+        if (c->cstats.reqs_total >= c->replay.n) {
+          c->delayed = false;
+          return false;
+        }
+        c->rate.intended = replay_origin + c->replay.e[c->cstats.reqs_total].at;
+      } else {
+        c->rate.intended = c->rate.next;
+        c->rate.next += c->def->rate.interval;
+      }
+      if (c->rate.intended <= now) {
+        /* we are late, start right away; the latency is still measured from the intended start */
+        c->delayed = false;
+        return false;
+      }
+      c->delayed_due = c->rate.intended;
+      c->delayed_id = aeCreateTimeEvent(c->t->loop, (c->rate.intended - now) / 1000, f_cb, c, NULL);
+      if (c->delayed_id == AE_ERR) {
+        die(EXIT_FAILURE, "cannot create time event (rate): %s (%d)\n", strerror(errno), errno);
+      }
+      return true;
+    }
+
     /* delay_min is guranteed to be <= delay_max (checks during json parsing) */
-    delay_min = c->delay_min;
-    delay_max = c->delay_max;
-    if (c->ramp_up) {
-      ramp_up_end = stats.start + (c->ramp_up * 1000);
+    delay_min = c->def->delay_min;
+    delay_max = c->def->delay_max;
+    if (c->def->ramp_up) {
+      ramp_up_end = stats.start + (c->def->ramp_up * 1000);
       if (now < ramp_up_end) {
         ramp_up_delay = ((ramp_up_end - now)/1000)/2;	/* half of the remaining ramp-up interval in [ms] */
-        delay_max = MAX(ramp_up_delay, c->delay_max);
+        delay_max = MAX(ramp_up_delay, c->def->delay_max);
       }
     }
     delay = (delay_min == delay_max)? delay_max: (rand() % (delay_max - delay_min + 1)) + delay_min;
+    c->delayed_due = now + delay * 1000;
     c->delayed_id = aeCreateTimeEvent(c->t->loop, delay, f_cb, c, NULL);
     if (c->delayed_id == AE_ERR) {
       die(EXIT_FAILURE, "cannot create time event (delay): %s (%d)\n", strerror(errno), errno);
@@ -584,20 +797,30 @@ void socket_connect(aeEventLoop *loop, int fd, void *data, int flags) {
     /* delayed connection */
     return;
 
+  if (!cps_admit(c))
+    /* waiting for the connect rate to allow another connection */
+    return;
+
+  socket_connect_now(c);
+}
+
+/* Connect c right away, past any delay or the connect rate. */
+void socket_connect_now(connection *c) {
   c->cstats.start = time_us();
   c->fd = tcp_non_block_bind_connect(c);
 
   if (c->fd < 0) {
     char *msg = strerror(errno);
-    error("cannot connect to %s:%d: %s (%d)\n", c->host, c->port, msg, errno);
+    error("cannot connect to %s:%d: %s (%d)\n", c->def->host, c->def->port, msg, errno);
     if (errno == EMFILE) die(EXIT_FAILURE, "%s (%d)\n", msg, errno);
     return;
   } else {
-    /* connected to host c->host */
+    /* connected to host c->def->host */
     c->cstats.connections++;
+    COUNTER_ADD(CONN_COUNTERS(c)->connects, 1);
   }
 
-  if (c->scheme == https) {
+  if (SCHEME_TLS(c->def->scheme)) {
 #ifdef HAVE_SSL
     if (!ssl_new(c)) {
       die(EXIT_FAILURE, "ssl_new() error\n");
@@ -607,6 +830,7 @@ void socket_connect(aeEventLoop *loop, int fd, void *data, int flags) {
 #endif
   }
 
+  if (c->h2) h2_reset(c);
   http_parser_init(&c->parser, HTTP_RESPONSE);
   c->parser.data = c;
 
@@ -632,25 +856,130 @@ void socket_reconnect(connection *c) {
     aeDeleteTimeEvent(c->t->loop, c->delayed_id);
   }
 
-  free(c->cookies); c->cookies = NULL;
-  c->delayed = c->delay_max;
+  if (c->cookies) {
+    /* a new connection starts a new session */
+    c->cookies->len = 0;
+    c->cookies->dirty = true;
+  }
+  c->delayed = CONN_DELAYED(c);
   c->cstats.writeable = 0;
   c->cstats.established = 0;
   c->cstats.handshake = 0;
   c->cstats.reqs = 0;
   c->read = 0;
   c->written = 0;
+  c->written_overhead = 0;
+  c->ts.tx = c->ts.rx = 0;
+  c->body.unsent = 0;
+  c->sizing = false;
+  c->pipe.head = 0;
+  c->pipe.n = 0;		/* responses to the requests in flight are lost with the connection */
   socket_connect(c->t->loop, c->fd, c, 0);
 }
 
+/* The first write within an established connection succeeded: the TCP (and TLS) handshake is complete. */
+void connection_handshake_done(connection *c, uint64_t now) {
+  c->cstats.handshake = now;
+#ifdef HAVE_SSL
+  if (c->ssl) ssl_handshake_done(c);
+#endif
+}
+
+/* Return the kernel timestamp [us] of the control messages of msg, 0: none. */
+static inline uint64_t cmsg_timestamp(struct msghdr *msg) {
+  struct cmsghdr *cmsg;
+  const struct timespec *ts;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) continue;
+    /* ts[0]: software, ts[2]: raw hardware timestamp */
+    ts = &((const struct scm_timestamping *)CMSG_DATA(cmsg))->ts[(cfg.timestamping == ts_hardware)? 2: 0];
+    return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+  }
+
+  return 0;
+}
+
+/*
+ * Drain the error queue of c.  MSG_ZEROCOPY completion notifications are discarded: the random
+ * body data is never modified once generated, so we do not need to track which of the sends
+ * completed.  Of the transmit timestamps (--timestamping), that of the latest data sent is kept.
+ */
+static inline void socket_errqueue_drain(connection *c) {
+  char control[256];
+  struct msghdr msg = { 0 };
+  uint64_t ts;
+
+  do {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(c->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) return;
+    if (c->def->timestamping && (ts = cmsg_timestamp(&msg))) c->ts.tx = ts;
+  } while (true);
+}
+
+/* Read up to len bytes of the response on c, taking the receive timestamp at its start (--timestamping). */
+static inline ssize_t socket_read_timestamped(connection *c, size_t len) {
+  char control[256];
+  struct iovec iov = { .iov_base = c->t->buf, .iov_len = len };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+  ssize_t n = recvmsg(c->fd, &msg, MSG_NOSIGNAL);
+
+  if (n > 0 && c->read == 0) c->ts.rx = cmsg_timestamp(&msg);
+
+  return n;
+}
+
+/*
+ * Pipelining: message_complete() matched the responses parsed so far to the requests in flight
+ * in order.  Keep the pipeline full, or close the connection once its last request is answered.
+ */
+static inline void socket_read_pipelined(aeEventLoop *loop, connection *c) {
+  if (!c->message_complete) {
+    /* no further HTTP response fully retrieved */
+    return;
+  }
+  c->message_complete = false;
+
+  if (!http_should_keep_alive(&c->parser)) {
+    /* host responded with "Connection: close"; the requests still in flight are lost */
+    socket_reconnect(c);
+    return;
+  }
+
+  if (c->header_cclose || c->cclose) {
+    /* no more requests on this connection, wait for the last response */
+    if (c->pipe.n == 0) socket_reconnect(c);
+    return;
+  }
+
+  if (CONN_REQS_DONE(c) && c->pipe.n) {
+    /* all requests sent, wait for the remaining responses */
+    return;
+  }
+
+  if (!(aeGetFileEvents(loop, c->fd) & AE_WRITABLE))
+    /* the pipeline has room again */
+    aeCreateFileEventOrDie(loop, c->fd, AE_WRITABLE, socket_write, c);
+}
+
 void socket_read(aeEventLoop *loop, int fd, void *data, int flags) {
   ssize_t n;
   connection *c = data;
-  size_t parser_n_parsed;
+  size_t parser_n_parsed, left;
+  const char *p;
   int parser_old_state=c->parser.state;
 
+  if (c->def->tcp.zerocopy || c->def->timestamping) socket_errqueue_drain(c);
+
+  if (c->h2) {
+    h2_read(loop, c);
+    return;
+  }
+
   do {
-    n = CONN_READ(c, RECVBUF);
+    n = c->def->timestamping? socket_read_timestamped(c, RECVBUF): CONN_READ(c, RECVBUF);
+    SELF_IO(c, reads, n);
 
     if (n < 0) {
       if (errno == EAGAIN) {
@@ -658,7 +987,7 @@ void socket_read(aeEventLoop *loop, int fd, void *data, int flags) {
       }
 
       /* ECONNRESET (104) and simillar */
-      error("cannot read from [%d] (%s:%d): %s: (%d) reconnecting...\n", c->fd, c->host, c->port, strerror(errno), errno);
+      error("cannot read from [%d] (%s:%d): %s: (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
       goto err_conn;
     }
 
@@ -668,19 +997,28 @@ void socket_read(aeEventLoop *loop, int fd, void *data, int flags) {
        * This doesn't need to be client initiated, e.g. server-side disconnect to keep
        * the number of non-active TCP open connections low.
        */
-      error("host sent an empty reply [%d] (%s:%d): %s: (%d) reconnecting...\n", c->fd, c->host, c->port, strerror(errno), errno);
+      error("host sent an empty reply [%d] (%s:%d): %s: (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
       goto err_conn;
     }
 
     /* successfully read from a socket */
-    c->read += n;
     c->cstats.read_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->recv, n);
     c->t->buf[n] = '\0';
 
-    parser_old_state=c->parser.state;
-    parser_n_parsed = http_parser_execute(&c->parser, &parser_settings, c->t->buf, (size_t)n);
-    if (parser_n_parsed != n) {
-      error("parser [%d] (%s:%d): %lu != %lu; %d->%d; reconnecting...\n", c->fd, c->host, c->port, parser_n_parsed, n, parser_old_state, c->parser.state);
+    for (p = c->t->buf, left = n; ; p += parser_n_parsed, left -= parser_n_parsed) {
+      parser_old_state=c->parser.state;
+      parser_n_parsed = http_parser_execute(&c->parser, &parser_settings, p, left);
+      c->read += parser_n_parsed;
+      if (HTTP_PARSER_ERRNO(&c->parser) != HPE_PAUSED) break;
+
+      /* a response ended within the data read, c->read is its length now */
+      http_parser_pause(&c->parser, 0);
+      message_complete(&c->parser);
+      if (parser_n_parsed == left) break;	/* a zero-length http_parser_execute() would signal EOF */
+    }
+    if (parser_n_parsed != left) {
+      error("parser [%d] (%s:%d): %lu != %lu; %d->%d; reconnecting...\n", c->fd, c->def->host, c->def->port, parser_n_parsed, left, parser_old_state, c->parser.state);
       goto err_parser;
     }
 #ifdef HAVE_SSL
@@ -696,6 +1034,11 @@ void socket_read(aeEventLoop *loop, int fd, void *data, int flags) {
     break;
   } while (true);
 
+  if (CONN_PIPELINED(c)) {
+    socket_read_pipelined(loop, c);
+    return;
+  }
+
   if (c->message_complete) {
     /* HTTP response is fully retrieved */
   } else {
@@ -729,23 +1072,50 @@ void socket_read(aeEventLoop *loop, int fd, void *data, int flags) {
 err_parser:
   c->status = 0;
   if (stats.fd) write_stats_line(stats.fd, c, "socket_read(): parser");
-  stats.err_parser++;
+  COUNTER_ADD(CONN_COUNTERS(c)->err_parser, 1);
   goto reconnect;
 
 err_conn:
   c->status = 0;
   if (stats.fd) write_stats_line(stats.fd, c, "socket_read(): connection");
-  stats.err_conn++;
+  COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
 
 reconnect:
   socket_reconnect(c);
 }
 
+/*
+ * Assemble a TE chunk of len bytes of c's body data at c->body.pos into dst, piggy backing the
+ * closing TE chunk if last; return its length.  "stream" bodies are generated right in place.
+ */
+static inline size_t chunk_assemble(char *dst, const connection *c, size_t len, bool last) {
+  char *p = dst;
+
+  p += sprintf(p, "%lX" HTTP_CRLF, len);
+  if (c->def->req_body_stream)
+    mcg64cpy_at(BODY_RANDOM_SEED, c->body.pos, p, len);
+  else
+    memcpy(p, c->req_body_random + c->body.pos, len);
+  p += len;
+  memcpy(p, HTTP_CRLF, 2);
+  p += 2;
+  if (last) {
+    memcpy(p, "0" HTTP_CRLF HTTP_CRLF, 5);
+    p += 5;
+  }
+
+  return p - dst;
+}
+
+/*
+ * TLS (and "stream" body) variant: TE chunks (framing and a slice of the shared PRNG data, or
+ * freshly generated PRNG data) are assembled in the thread's scratch buffer.  A partially written chunk is assembled again from c->body when
+ * resending its remainder, so the data passed to ssl_write() is the same on the retry.
+ */
 static inline void socket_write_request_random_chunked(aeEventLoop *loop, connection *c, char *request, size_t request_headers_len) {
   uint64_t now_writable;
   ssize_t n;
   size_t write_len = c->body.unsent;
-  size_t written_body = 0;
 
   now_writable = time_us();
   if (c->cstats.writeable == 0)
@@ -759,18 +1129,18 @@ static inline void socket_write_request_random_chunked(aeEventLoop *loop, connec
     n = CONN_WRITE(c, request + c->written, write_len);
   } else if (write_len) {
     /* headers written; the previous write of request body did not send all the requested data => send the remainder chunk again */
-    n = CONN_WRITE(c, c->req_body_random + c->body.offset, write_len);
+    chunk_assemble(c->t->sndbuf, c, c->body.len, c->body.last);
+    n = CONN_WRITE(c, c->t->sndbuf + c->body.offset, write_len);
     /* c->body.(unsent|offset) only get used in future socket_write_request_random_chunked() call if (write_len != n) */
     c->body.unsent = write_len - (n > 0? n: 0);
-    c->body.offset = n > 0? c->body.offset + n: c->body.offset;
+    c->body.offset += n > 0? n: 0;
   } else {
     /* headers written, no previous partial body chunk writes; write a body chunk */
-    size_t body_offset, body_len, body_remaining_len, body_remaining_overhead_len;
+    size_t written_body, body_len, body_remaining_len, body_remaining_overhead_len;
     bool last_chunk = false;
-    size_t overhead_fixed = 4;							/* 2x CRLF */
-    written_body = c->written - request_headers_len;
+    written_body = c->written - request_headers_len - c->written_overhead;	/* body bytes sent excluding overhead */
 
-    body_remaining_len = c->req_body_size - written_body + c->written_overhead;	/* remaining total body size to send excluding overhead */
+    body_remaining_len = c->def->req_body_size - written_body;			/* remaining total body size to send excluding overhead */
     /* overhead of the remaining body if it was sent as the last chunk */
     body_remaining_overhead_len = NUM2HEX_DIGITS(body_remaining_len) + 4;	/* <len>\r\n + <body>\r\n */
     if ((body_remaining_len + body_remaining_overhead_len) > SNDBUF) {
@@ -780,32 +1150,26 @@ static inline void socket_write_request_random_chunked(aeEventLoop *loop, connec
       /* the remaining lenght of the body including TE overhead will fit into SNDBUF */
       body_len = body_remaining_len;
       last_chunk = true;
-      overhead_fixed = 9;							/* 2x CRLF + 0\r\n\r\n */
     }
 
-    /* calculate the real number of bytes to be written including the overhead */
-    write_len = NUM2HEX_DIGITS(body_len) + body_len + overhead_fixed;		/* <len>\r\n + <body>\r\n + [0\r\n\r\n] */
-
-    size_t random_bytes = (c->req_body_size > MAX_REQ_LEN)? MAX_REQ_LEN: c->req_body_size;	/* length of allocated random bytes array (excluding overhead) */
-    body_offset = ((written_body % random_bytes) + write_len > random_bytes)? 0 : written_body % random_bytes;
-
-    char *c_ptr = c->req_body_random + body_offset;
-    c_ptr += snprintf(c_ptr, 17, "%lX\r", body_len);
-    *c_ptr++ = '\n';					/* overwrite the '\0' written by snprintf() */
-    c_ptr += body_len;
-    *c_ptr++ = '\r'; *c_ptr++ = '\n';
-
-    if (last_chunk) {
-      /* this is the last chunk, piggy back the closing TE chunk */
-      *c_ptr++ = '0'; *c_ptr++ = '\r'; *c_ptr++ = '\n'; *c_ptr++ = '\r'; *c_ptr++ = '\n';
+    if (c->def->req_body_stream) {
+      c->body.pos = c->body.stream + written_body;
+    } else {
+      size_t random_bytes = (c->def->req_body_size > MAX_REQ_LEN)? MAX_REQ_LEN: c->def->req_body_size;	/* length of the PRNG data (period) */
+      c->body.pos = ((written_body % random_bytes) + body_len > random_bytes)? 0 : written_body % random_bytes;
     }
-    c->written_overhead += NUM2HEX_DIGITS(body_len) + overhead_fixed;
+    c->body.len = body_len;
+    c->body.last = last_chunk;
+
+    write_len = chunk_assemble(c->t->sndbuf, c, body_len, last_chunk);
+    c->written_overhead += write_len - body_len;
 
-    n = CONN_WRITE(c, c->req_body_random + body_offset, write_len);
+    n = CONN_WRITE(c, c->t->sndbuf, write_len);
     /* c->body.(unsent|offset) only get used in future socket_write_request_random_chunked() call if (write_len != n) */
     c->body.unsent = write_len - (n > 0? n: 0);
-    c->body.offset = n > 0? body_offset + n: body_offset;
+    c->body.offset = n > 0? n: 0;
   }
+  SELF_IO(c, writes, n);
 
   if (n < 0) {
     if (errno == EAGAIN) {
@@ -813,12 +1177,12 @@ static inline void socket_write_request_random_chunked(aeEventLoop *loop, connec
     }
 
     /* ECONNRESET (104) and simillar */
-    error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->host, c->port, strerror(errno), errno);
+    error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
     goto err_conn;
   } else {
     if (c->cstats.handshake == 0)
       /* first request within an established connection */
-      c->cstats.handshake = now_writable;
+      connection_handshake_done(c, now_writable);
 
     if (c->cstats.established == 0)
       /* a request within an established connection (keep-alive) */
@@ -826,13 +1190,14 @@ static inline void socket_write_request_random_chunked(aeEventLoop *loop, connec
 
     c->written += n;
     c->cstats.written_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->sent, n);
 
-    if (c->written == request_headers_len + c->req_body_size + c->written_overhead) {
+    if (c->written == request_headers_len + c->def->req_body_size + c->written_overhead) {
       /* writing done */
-      free(c->cookies); c->cookies = NULL;
       c->message_complete = false;
       c->cstats.reqs++;
       c->cstats.reqs_total++;
+      COUNTER_ADD(CONN_COUNTERS(c)->reqs, 1);
       c->written_overhead = 0;
       aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
       aeCreateFileEventOrDie(loop, c->fd, AE_READABLE, socket_read, c);
@@ -844,10 +1209,152 @@ static inline void socket_write_request_random_chunked(aeEventLoop *loop, connec
 err_conn:
   c->status = 0;
   if (stats.fd) write_stats_line(stats.fd, c, "socket_write_request_random_chunked()");
-  stats.err_conn++;
+  COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
   socket_reconnect(c);
 }
 
+/* Add the part of [base, base + len) that is not to be skipped to iov; update skip and budget. */
+static inline void iov_add(struct iovec *iov, int *iovcnt, size_t *skip, size_t *budget, const char *base, size_t len) {
+  if (*skip >= len) {
+    *skip -= len;
+    return;
+  }
+  base += *skip;
+  len = MIN(len - *skip, *budget);
+  *skip = 0;
+  if (len == 0) return;
+
+  iov[*iovcnt].iov_base = (void *)base;
+  iov[*iovcnt].iov_len = len;
+  (*iovcnt)++;
+  *budget -= len;
+}
+
+/*
+ * Plain HTTP variant of socket_write_request_random_chunked().  The request is the virtual stream
+ *   <headers> [<len>\r\n<body>\r\n]... 0\r\n\r\n
+ * and c->written alone determines the position within it.  Headers, chunk framing and slices of the
+ * PRNG data (which is never modified here) are gathered into a single sendmsg() call of up to
+ * SNDBUF_IOV bytes, optionally with MSG_ZEROCOPY.
+ */
+static inline void socket_write_request_random_chunked_iov(aeEventLoop *loop, connection *c, char *request, size_t request_headers_len) {
+  static const char crlf_last[] = HTTP_CRLF "0" HTTP_CRLF HTTP_CRLF;
+  struct iovec iov[IOV_LEN];
+  struct msghdr msg = { .msg_iov = iov };
+  char (*chunk_hdr)[20] = c->def->chunk_hdr;		/* headers of the full-sized chunks and of the last chunk */
+  size_t random_bytes = MIN(c->def->req_body_size, MAX_REQ_LEN);
+  size_t chunk_len = MIN(c->def->req_body_size, CHUNK_IOV);
+  size_t chunks = c->def->req_body_size / chunk_len;		/* number of full-sized chunks */
+  size_t last_len = c->def->req_body_size % chunk_len;
+  size_t chunk_hdr_len[2], chunk_wire_len, request_len, skip, budget = SNDBUF_IOV, k, body_offset;
+  uint64_t now_writable;
+  int iovcnt = 0;
+  ssize_t n;
+
+  now_writable = time_us();
+  if (c->cstats.writeable == 0)
+    /* first request within an established connection */
+    c->cstats.writeable = now_writable;
+
+  chunk_hdr_len[0] = strlen(chunk_hdr[0]);
+  chunk_hdr_len[1] = strlen(chunk_hdr[1]);
+  chunk_wire_len = chunk_hdr_len[0] + chunk_len + 2;
+  request_len = request_headers_len + chunks * chunk_wire_len + (last_len? chunk_hdr_len[1] + last_len + 7: 5);
+
+  /* skip what we have already written */
+  skip = c->written;
+  iov_add(iov, &iovcnt, &skip, &budget, request, request_headers_len);
+  k = MIN(skip / chunk_wire_len, chunks);
+  skip -= k * chunk_wire_len;
+
+  for (; k < chunks && budget && iovcnt < IOV_LEN - 4; k++) {
+    body_offset = (k * chunk_len) % random_bytes;
+    iov_add(iov, &iovcnt, &skip, &budget, chunk_hdr[0], chunk_hdr_len[0]);
+    iov_add(iov, &iovcnt, &skip, &budget, c->req_body_random + body_offset, MIN(chunk_len, random_bytes - body_offset));
+    if (random_bytes - body_offset < chunk_len)
+      /* wrap around the PRNG data */
+      iov_add(iov, &iovcnt, &skip, &budget, c->req_body_random, chunk_len - (random_bytes - body_offset));
+    iov_add(iov, &iovcnt, &skip, &budget, HTTP_CRLF, 2);
+  }
+
+  if (k == chunks && budget && iovcnt < IOV_LEN - 4) {
+    /* the last chunk (if any) and the closing TE chunk */
+    if (last_len) {
+      body_offset = (chunks * chunk_len) % random_bytes;
+      iov_add(iov, &iovcnt, &skip, &budget, chunk_hdr[1], chunk_hdr_len[1]);
+      iov_add(iov, &iovcnt, &skip, &budget, c->req_body_random + body_offset, MIN(last_len, random_bytes - body_offset));
+      if (random_bytes - body_offset < last_len)
+        iov_add(iov, &iovcnt, &skip, &budget, c->req_body_random, last_len - (random_bytes - body_offset));
+      iov_add(iov, &iovcnt, &skip, &budget, crlf_last, 7);
+    } else {
+      iov_add(iov, &iovcnt, &skip, &budget, crlf_last + 2, 5);
+    }
+  }
+
+  msg.msg_iovlen = iovcnt;
+  n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | (c->def->tcp.zerocopy? MSG_ZEROCOPY: 0));
+  SELF_IO(c, writes, n);
+
+  if (n < 0) {
+    if (errno == EAGAIN || (errno == ENOBUFS && c->def->tcp.zerocopy)) {
+      /* ENOBUFS: out of the socket's optmem for zerocopy notifications, retry later */
+      return;
+    }
+
+    /* ECONNRESET (104) and simillar */
+    error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
+    goto err_conn;
+  } else {
+    if (c->cstats.handshake == 0)
+      /* first request within an established connection */
+      connection_handshake_done(c, now_writable);
+
+    if (c->cstats.established == 0)
+      /* a request within an established connection (keep-alive) */
+      c->cstats.established = now_writable;
+
+    c->written += n;
+    c->cstats.written_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->sent, n);
+
+    if (c->written == request_len) {
+      /* writing done */
+      c->cstats.reqs++;
+      c->cstats.reqs_total++;
+      COUNTER_ADD(CONN_COUNTERS(c)->reqs, 1);
+      c->message_complete = false;
+      aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
+      aeCreateFileEventOrDie(loop, c->fd, AE_READABLE, socket_read, c);
+    }
+  }
+
+  return;
+
+err_conn:
+  c->status = 0;
+  if (stats.fd) write_stats_line(stats.fd, c, "socket_write_request_random_chunked()");
+  COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
+  socket_reconnect(c);
+}
+
+/*
+ * Pipelining: remember the start of the request just written on c and carry on writing the next
+ * one while the pipeline has room and the connection is not to be closed after this request.
+ */
+static inline void pipeline_push(aeEventLoop *loop, connection *c) {
+  c->pipe.start[(c->pipe.head + c->pipe.n) % c->def->pipeline] = (c->cstats.reqs <= 1)? c->cstats.start: c->cstats.established;
+  c->pipe.n++;
+  c->written = 0;
+  c->cstats.established = 0;
+
+  if (c->cstats.reqs == 1)
+    /* first request on this connection */
+    aeCreateFileEventOrDie(loop, c->fd, AE_READABLE, socket_read, c);
+
+  if (c->pipe.n == c->def->pipeline || c->header_cclose || c->cclose)
+    aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
+}
+
 static inline void socket_write_request(aeEventLoop *loop, connection *c, char *request, size_t request_len) {
   uint64_t now_writable;
   size_t write_len;
@@ -861,6 +1368,7 @@ static inline void socket_write_request(aeEventLoop *loop, connection *c, char *
   write_len = (request_len - c->written) > SNDBUF? SNDBUF: request_len - c->written;
 
   n = CONN_WRITE(c, request + c->written, write_len);
+  SELF_IO(c, writes, n);
 
   if (n < 0) {
     if (errno == EAGAIN) {
@@ -868,12 +1376,12 @@ static inline void socket_write_request(aeEventLoop *loop, connection *c, char *
     }
 
     /* ECONNRESET (104) and simillar */
-    error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->host, c->port, strerror(errno), errno);
+    error("cannot write to [%d] (%s:%d): %s (%d) reconnecting...\n", c->fd, c->def->host, c->def->port, strerror(errno), errno);
     goto err_conn;
   } else {
     if (c->cstats.handshake == 0)
       /* first request within an established connection */
-      c->cstats.handshake = now_writable;
+      connection_handshake_done(c, now_writable);
 
     if (c->cstats.established == 0)
       /* a request within an established connection (keep-alive) */
@@ -881,13 +1389,18 @@ static inline void socket_write_request(aeEventLoop *loop, connection *c, char *
 
     c->written += n;
     c->cstats.written_total += n;
+    COUNTER_ADD(CONN_COUNTERS(c)->sent, n);
 
     if (c->written == request_len) {
       /* writing done */
-      free(c->cookies); c->cookies = NULL;
-      c->message_complete = false;
       c->cstats.reqs++;
       c->cstats.reqs_total++;
+      COUNTER_ADD(CONN_COUNTERS(c)->reqs, 1);
+      if (CONN_PIPELINED(c)) {
+        pipeline_push(loop, c);
+        return;
+      }
+      c->message_complete = false;
       aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
       aeCreateFileEventOrDie(loop, c->fd, AE_READABLE, socket_read, c);
     }
@@ -898,48 +1411,94 @@ static inline void socket_write_request(aeEventLoop *loop, connection *c, char *
 err_conn:
   c->status = 0;
   if (stats.fd) write_stats_line(stats.fd, c, "socket_write_request()");
-  stats.err_conn++;
+  COUNTER_ADD(CONN_COUNTERS(c)->err_conn, 1);
   socket_reconnect(c);
 }
 
+/* Render the current request of c with the cookies of its jar unless the jar's request is up to date */
+static inline void cookie_request_render(connection *c) {
+  cookie_jar *jar = c->cookies;
+  const request_def *d = c->def;
+  const char *req = c->header_cclose? d->request_cclose: d->request;
+  size_t len = c->header_cclose? d->request_cclose_length: d->request_length;
+  char *p = jar->req + d->cookie_off;
+
+  if (!jar->dirty && jar->cclose == c->header_cclose) return;
+
+  memcpy(p, HTTP_COOKIE ": ", sizeof(HTTP_COOKIE ": ") - 1);
+  p += sizeof(HTTP_COOKIE ": ") - 1;
+  memcpy(p, jar->kv, jar->len);
+  p += jar->len;
+  memcpy(p, HTTP_CRLF, 2);
+  p += 2;
+  memcpy(p, req + d->cookie_off, len - d->cookie_off);
+  p += len - d->cookie_off;
+
+  jar->req_len = p - jar->req;
+  jar->dirty = false;
+  jar->cclose = c->header_cclose;
+}
+
 void socket_write(aeEventLoop *loop, int fd, void *data, int flags) {
   connection *c = data;
   bool cclose = false;
   size_t request_len;
   char *request;
 
-  if (c->reqs_max && c->cstats.reqs_total >= c->reqs_max) {
+  if (c->def->tcp.zerocopy || c->def->timestamping) socket_errqueue_drain(c);
+
+  if (c->h2) {
+    h2_write(loop, c);
+    return;
+  }
+
+  if (CONN_REQS_DONE(c)) {
     /* we reached the maximum number of hits allowed */
     aeDeleteFileEvent(loop, c->fd, AE_WRITABLE);
-    if (requests_max_cb) requests_max_cb();
+    /* with pipelining, socket_read_pipelined() gets us here again once the pipeline drains */
+    if (c->pipe.n == 0 && requests_max_cb) requests_max_cb();
     return;
   }
-  cclose = c->keep_alive_reqs && !((c->cstats.reqs_total + 1) % c->keep_alive_reqs);
-  if (c->close_client) {
+  cclose = c->def->keep_alive_reqs && !((c->cstats.reqs_total + 1) % c->def->keep_alive_reqs);
+  if (c->def->close_client || c->replay.n) {
     /* always keep-alive connections, close from the client side (c->header_cclose == false) */
     c->cclose = cclose;
   } else {
     /* once we have the last request, ask the server to close the connection by "Connection: close" (c->header_cclose == true) */
     c->header_cclose = cclose;
   }
-  if (c->cookies && c->written == 0) {
-    /* we have cookies and didn't write any data => re-create HTTP requests */
-    if (c->header_cclose) {
-      http_request_create_cc(c);
-    } else {
-      http_request_create_ka(c);
-    }
+  if (c->replay.n) {
+    /* the next request of the replay stream, compiled with its body */
+    replay_entry *e = &c->replay.e[c->cstats.reqs_total];
+
+    socket_write_request(loop, data, e->req, e->len);
+    return;
   }
-  if (c->header_cclose) {
-    request = c->request_cclose;
-    request_len = c->request_cclose_length;
+  if (c->cookies && c->cookies->len) {
+    /* patch the cookies in once per request, a partially written request is carried on */
+    if (c->written == 0) cookie_request_render(c);
+    request = c->cookies->req;
+    request_len = c->cookies->req_len;
+  } else if (c->header_cclose) {
+    request = c->def->request_cclose;
+    request_len = c->def->request_cclose_length;
   } else {
-    request = c->request;
-    request_len = c->request_length;
+    request = c->def->request;
+    request_len = c->def->request_length;
+  }
+  if (c->def->tmpl[0]) {
+    /* fill in the template slots once per request, a partially written request is carried on */
+    if (c->written == 0) tmpl_render(c);
+    request = c->tmpl_buf;
+    request_len = c->tmpl_len;
   }
 
-  if (c->req_body_type == body_random) {
-    socket_write_request_random_chunked(loop, data, request, request_len);	/* request_len is only length of the headers */
+  if (c->def->req_body_type == body_random) {
+    /* request_len is only length of the headers */
+    if (!SCHEME_TLS(c->def->scheme) && !c->def->req_body_stream)
+      socket_write_request_random_chunked_iov(loop, data, request, request_len);
+    else
+      socket_write_request_random_chunked(loop, data, request, request_len);
   } else {
     socket_write_request(loop, data, request, request_len);			/* request_len is the complete request length including the body */
   }
@@ -948,9 +1507,8 @@ void socket_write(aeEventLoop *loop, int fd, void *data, int flags) {
 #if 0
 int headers_complete(http_parser *parser) {
   connection *c = parser->data;
-  int status = parser->status_code;
 
-  c->status = status;
+  c->status = parser->status_code;
 
   return 0;
 }
@@ -958,24 +1516,94 @@ int headers_complete(http_parser *parser) {
 
 int message_complete(http_parser *parser) {
   connection *c = parser->data;
-  int status = parser->status_code;
-
-  if (status > 399) stats.err_status++;
 
-  c->status = status;
+  if (!c->sizing) {
+    /* more responses may follow in the same data (pipelining): socket_read() counts the bytes of this one first */
+    c->sizing = true;
+    http_parser_pause(parser, 1);
+    return 0;
+  }
+  c->sizing = false;
+
+  c->status = parser->status_code;
+  response_record(c, time_us() - request_start(c));
+  if (c->def->timestamping) {
+    /* the request's last data was sent before its response arrived: no stale pairs */
+    if (c->ts.tx && c->ts.rx > c->ts.tx) hist_record(&c->t->kernel_latency, c->ts.rx - c->ts.tx);
+    c->ts.tx = c->ts.rx = 0;
+  }
+  if (c->def->check.enable && !check_response(c)) COUNTER_ADD(CONN_COUNTERS(c)->err_check, 1);
   if (stats.fd) write_stats_line(stats.fd, c, NULL);
-  c->delayed = c->delay_max;
+  if (c->pipe.n) {
+    /* pipelining: the response answers the oldest request in flight */
+    c->pipe.head = (c->pipe.head + 1) % c->def->pipeline;
+    c->pipe.n--;
+  }
+  if (CONN_PIPELINED(c)) c->read = 0;		/* the bytes of the next response from here */
+  c->delayed = CONN_DELAYED(c);
   c->message_complete = true;
 
   return 0;
 }
 
+/* Return the cookie jar of connection c, allocate it with the send buffer of its requests on first use */
+static cookie_jar *cookie_jar_get(connection *c) {
+  const request_def *d = c->def;
+  cookie_jar *jar;
+  size_t req_len = MAX(d->request_length, d->request_cclose_length) + sizeof(HTTP_COOKIE ": " HTTP_CRLF) + COOKIE_JAR_LEN;
+
+  if (c->cookies) return c->cookies;
+
+  if ((jar = malloc(sizeof(*jar) + req_len)) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for HTTP cookies\n");
+  jar->len = 0;
+  jar->dirty = true;
+  jar->cclose = false;
+  jar->req_len = 0;
+  jar->req = (char *)(jar + 1);
+  memcpy(jar->req, d->request, d->cookie_off);	/* shared by request and request_cclose */
+
+  return c->cookies = jar;
+}
+
+/* Set cookie kv (`key=value') of length len with a key of length key_len in jar, replacing the cookie of the same key */
+static void cookie_jar_set(cookie_jar *jar, const char *kv, size_t len, size_t key_len) {
+  char *p = jar->kv, *end = jar->kv + jar->len, *next;
+
+  while (p < end) {
+    /* the cookies are separated by "; " */
+    if ((next = memchr(p, ';', end - p)) == NULL) next = end;
+    if ((size_t)(next - p) > key_len && p[key_len] == '=' && !memcmp(p, kv, key_len)) {
+      /* drop the old value along with a separator */
+      if (next < end) next += 2;
+      else if (p > jar->kv) p -= 2;
+      memmove(p, next, end - next);
+      jar->len -= next - p;
+      break;
+    }
+    p = next + 2;
+  }
+
+  if (jar->len + 2 + len > COOKIE_JAR_LEN) {
+    warning("cookie jar full (COOKIE_JAR_LEN %d), dropping a cookie of %zu bytes\n", COOKIE_JAR_LEN, len);
+    jar->dirty = true;
+    return;
+  }
+  if (jar->len) {
+    memcpy(jar->kv + jar->len, "; ", 2);
+    jar->len += 2;
+  }
+  memcpy(jar->kv + jar->len, kv, len);
+  jar->len += len;
+  jar->dirty = true;
+}
+
 int header_field(http_parser *parser, const char *at, size_t len) {
   connection *c = parser->data;
   const char *p_at = at;	/* pointer to the current character of the new cookie */
   const char *p_end;		/* pointer right after the last character of the new cookie header line */
   const char *p_kvend;		/* pointer right after the last character of the new key=value cookie pair */
-  char *cookies;
+  const char *p_eq;		/* pointer to the equal sign of the new key=value cookie pair */
 
   /* a very trivial and naive implementation of session cookies */
   if (len == 10 && !strncmp(at, "Set-Cookie", 10)) {
@@ -995,66 +1623,12 @@ int header_field(http_parser *parser, const char *at, size_t len) {
       p_kvend++;
 
     /* the new cookie is between p_at and p_kvend as `var=value' */
-    if (c->cookies != NULL) {
-      const char *p_eq, *p_old_kvend, *oldcookie = c->cookies;
-      char *newcookie;
-      if ((newcookie = cookies = (char *) calloc(strlen(oldcookie) + p_kvend - p_at + 3, sizeof(char))) == NULL)
-        die(EXIT_FAILURE, "calloc(): cannot allocate memory for HTTP cookies\n"); /* 3: 1 ("\0") + 2 ("; ") */
-
-      p_eq = p_at;
-
-      /* find the equal sign of the key=value pair */
-      while (p_eq < p_kvend && *p_eq != '=')
-        p_eq++;
-
-      if (p_eq == p_kvend) {
-        warning("ignoring a malformed cookie (missing an equal sign): %s\n", p_at);
-        return 1;
-      }
-
-      /* the new cookie name (key) is between p_at and p_eq */
-      while (*oldcookie) {
-        p_old_kvend = oldcookie;
-
-        /* find the end of the old cookie key=value */
-        while (*p_old_kvend != ';' && *p_old_kvend != ' ' && *p_old_kvend)
-          p_old_kvend++;
-
-        /* copy old cookie key=value pairs */
-        if (strncmp(oldcookie, p_at, p_eq - p_at) != 0) {
-          /* key does not match the new key=value pair => copy */
-          if (oldcookie != c->cookies) {
-            /* an old cookie was copied, add "; " separator */
-            strcpy(newcookie, "; ");
-            newcookie += 2;
-          }
-          memcpy(newcookie, oldcookie, p_old_kvend - oldcookie);
-          newcookie += p_old_kvend - oldcookie;
-        }
-
-        /* find the next key=value pair */
-        oldcookie = p_old_kvend;
-        while (*oldcookie && (*oldcookie == ';' || *oldcookie == ' '))
-          oldcookie++;
-      }
-
-      if (oldcookie != c->cookies) {
-        /* an old cookie was copied, add "; " separator */
-        strcpy(newcookie, "; ");
-        newcookie += 2;
-      }
-      memcpy(newcookie, p_at, p_kvend - p_at);
-      newcookie += (p_kvend - p_at);
-      free(c->cookies);
-      c->cookies = cookies;
-    } else {
-      /* until now we haven't had any cookies */
-      if ((cookies = calloc(p_kvend - p_at + 1, sizeof(char))) == NULL)
-        die(EXIT_FAILURE, "calloc(): cannot allocate memory for HTTP cookies\n");
-
-      memcpy(cookies, p_at, p_kvend - p_at);
-      c->cookies = cookies;
+    if ((p_eq = memchr(p_at, '=', p_kvend - p_at)) == NULL) {
+      warning("ignoring a malformed cookie (missing an equal sign): %.*s\n", (int)(p_kvend - p_at), p_at);
+      return 1;
     }
+
+    cookie_jar_set(cookie_jar_get(c), p_at, p_kvend - p_at, p_eq - p_at);
   }
 
   return 0;
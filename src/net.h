@@ -5,20 +5,34 @@
 #include <wolfssl/options.h>		/* HAVE_SNI, HAVE_SECURE_RENEGOTIATION, ... */
 #include <wolfssl/ssl.h>		/* WOLFSSL_CTX */
 #endif
+#include <regex.h>			/* regex_t */
 #include <stdbool.h>			/* bool, true, false */
+#include <sys/socket.h>			/* struct sockaddr_storage */
 
 #include "../version.h"
 #include "../libae/ae.h"		/* aeEventLoop */
 #include "../nginx/http_parser.h"	/* http_parser */
+#include "hist.h"			/* hist */
 
 #define RECVBUF		(1UL<<15)	/* 32kB */
 #define SNDBUF		(1UL<<15)	/* 32kB (keep this ^2); must be >= 16B (chunked TE overhead); consider setting SO_SNDBUF if going above 32kB */
+#define SNDBUF_IOV	(1UL<<20)	/* 1MB: maximum number of bytes gathered into a single sendmsg() (plain HTTP random body) */
+#define CHUNK_IOV	(1UL<<20)	/* 1MB: TE chunk size of a random body sent by sendmsg() (plain HTTP) */
+#define IOV_LEN		64		/* maximum number of iovec entries of a single sendmsg() call, must be > 4 */
+#define BODY_RANDOM_SPREAD (1UL<<20)	/* 1MB: range of the offsets the clients read the shared PRNG data at */
+#define BODY_RANDOM_SEED	1		/* seeded MCG state the PRNG data of the "random" bodies is generated from */
+#define BODY_STREAM_SPREAD	40		/* log2 of the distance between the clients' offsets in the PRNG stream ("stream" bodies): 1TB */
+#define PIPELINE_MAX	1024		/* maximum number of pipelined requests in flight on a connection */
+#define CACHE_LINE	64		/* alignment of data written by one thread and read by others (false sharing) */
+#define COOKIE_JAR_LEN	4096		/* maximum length of the cookies of a connection sent in the "Cookie" header */
+#define SOURCE_PORT_TRIES	16		/* source ports of a port_from range to try binding to before moving on to the next address */
 #define MAX_REQ_LEN	(1UL<<26)	/* maximum number of characters to send to a server without chunked TE: 64M (must be >= than SNDBUF, keep divisible by SNDBUF) */
 
 #define HTTP_CRLF	"\r\n"
 #define HTTP_PROTO	"HTTP/1.1"
 #define HTTP_HOST	"Host"
-#define HTTP_USER_AGENT	"User-Agent: " PGNAME "/" MB_VERSION
+#define HTTP_UA		PGNAME "/" MB_VERSION
+#define HTTP_USER_AGENT	"User-Agent: " HTTP_UA
 #define HTTP_ACCEPT	"Accept: */*"
 #define HTTP_COOKIE	"Cookie"
 #define HTTP_CONN_CLOSE	"Connection: close"
@@ -30,16 +44,35 @@
 #define SOCK_WRITE(fd, buf, len)	send(fd, buf, len, MSG_NOSIGNAL)
 #define SOCK_READABLE(fd)		socket_readable(fd)
 
+/* whether scheme s runs over TLS */
+#define SCHEME_TLS(s)		((s) == https || (s) == h2)
+
 #ifdef HAVE_SSL
-#define CONN_READ(c, len)	((c->scheme == https)? ssl_read(c->ssl, c->t->buf, len): SOCK_READ(c->fd, c->t->buf, len))
-#define CONN_WRITE(c, buf, len)	((c->scheme == https)? ssl_write(c->ssl, buf, len): SOCK_WRITE(c->fd, buf, len))
-#define CONN_READABLE(c)	((c->scheme == https)? ssl_readable(c): SOCK_READABLE(c->fd))
+#define CONN_READ(c, len)	(SCHEME_TLS(c->def->scheme)? ssl_read(c->ssl, c->t->buf, len): SOCK_READ(c->fd, c->t->buf, len))
+#define CONN_WRITE(c, buf, len)	(SCHEME_TLS(c->def->scheme)? ssl_write(c->ssl, buf, len): SOCK_WRITE(c->fd, buf, len))
+#define CONN_READABLE(c)	(SCHEME_TLS(c->def->scheme)? ssl_readable(c): SOCK_READABLE(c->fd))
 #else
 #define CONN_READ(c, len)	SOCK_READ(c->fd, c->t->buf, len)
 #define CONN_WRITE(c, buf, len)	SOCK_WRITE(c->fd, buf, len)
 #define CONN_READABLE(c)	SOCK_READABLE(c->fd)
 #endif
 
+/* the latest addresses of the target host of d (published by the resolver thread) */
+#define def_addrs(d)		((const addr_list *)__atomic_load_n(&(d)->addrs, __ATOMIC_ACQUIRE))
+
+/* whether c sends pipelined requests (more than one request in flight) */
+#define CONN_PIPELINED(c)	((c)->def->pipeline > 1)
+
+/* whether the next request/connection on c needs to be delayed by a time event */
+#define CONN_DELAYED(c)		((c)->def->delay_max || (c)->def->rate.reqs || (c)->replay.n)
+
+/* whether c starts its requests on a fixed timeline (rate, replay), see connection_delay() */
+#define CONN_OPEN_LOOP(c)	((c)->def->rate.reqs || (c)->replay.n)
+
+/* whether c sent all the requests it may send: max-requests, or its share of the replay stream */
+#define CONN_REQS_DONE(c)	(((c)->def->reqs_max && (c)->cstats.reqs_total >= (c)->def->reqs_max) || \
+				 ((c)->replay.n && (c)->cstats.reqs_total >= (c)->replay.n))
+
 #define NUM2HEX_DIGITS(n) \
  (((n) < 1UL<< 4)?  1U: \
   ((n) < 1UL<< 8)?  2U: \
@@ -60,7 +93,9 @@
 
 typedef enum {
   http,
-  https
+  https,
+  h2,		/* HTTP/2 over TLS (ALPN "h2") */
+  h2c		/* HTTP/2 over cleartext TCP with prior knowledge */
 } scheme;
 
 typedef enum {
@@ -68,27 +103,132 @@ typedef enum {
   body_random
 } req_body_type;
 
+/* kernel timestamps of the requests leaving and the responses arriving (--timestamping) */
+typedef enum {
+  ts_none,
+  ts_software,		/* taken by the network stack (CLOCK_REALTIME) */
+  ts_hardware		/* taken by the NIC (its own clock) */
+} timestamping;
+
 typedef struct key_value {
   char* key;
   char* value;
 } key_value;
 
+/*
+ * Counters only ever written by their worker thread and read by the main thread while the test
+ * runs (--interval): a plain load and store each, no locked read-modify-write on the request path.
+ */
+#define COUNTER_ADD(c, n)	__atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED)
+#define COUNTER_GET(c)		__atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+/* upper bounds [us] of the coarse latency buckets exported as OpenMetrics histograms (--metrics) */
+#define LATENCY_BOUNDS		100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, \
+				250000, 500000, 1000000, 2500000, 5000000, 10000000
+#define LATENCY_BOUNDS_N	16
+
+/* counters of the requests of one request definition (target) handled by a worker thread */
+typedef struct thread_counters {
+  uint64_t reqs;		/* requests sent */
+  uint64_t sent;		/* bytes sent */
+  uint64_t recv;		/* bytes received */
+  uint64_t err_conn;		/* see statistics */
+  uint64_t err_status;
+  uint64_t err_parser;
+  uint64_t err_check;
+  uint64_t connects;		/* connection attempts */
+  uint64_t status[5];		/* responses by status class: 1xx - 5xx */
+  uint64_t latency_sum;		/* sum of the response times [us] */
+  uint64_t latency[LATENCY_BOUNDS_N + 1];	/* response times up to each of LATENCY_BOUNDS, the last one: any larger */
+} __attribute__((aligned(CACHE_LINE))) thread_counters;	/* cache lines of their own */
+
+/* thread_counters of connection c */
+#define CONN_COUNTERS(c)	(&(c)->t->counters[(c)->def->target])
+
+/* Overhead of a worker thread itself: is mb the bottleneck of the test? */
+typedef struct self_counters {
+  aeStats loop;			/* wakeups, events, waiting time and timers of the event loop */
+  uint64_t loop_start;		/* time [us] since the Epoch the event loop started, 0: not yet */
+  uint64_t loop_end;		/* time [us] since the Epoch the event loop stopped, 0: still running */
+  uint64_t reads;		/* read calls on the sockets */
+  uint64_t reads_eagain;	/* of them, those finding no data (EAGAIN) */
+  uint64_t writes;		/* write calls on the sockets */
+  uint64_t writes_eagain;	/* of them, those finding no room (EAGAIN) */
+  uint64_t lag_n;		/* delayed writes run */
+  uint64_t lag_sum;		/* the sum of their lags behind the time they were due [us] */
+  uint64_t lag_max;		/* the largest of the lags [us] */
+} self_counters;
+
+/* count a read or write call of connection c on its thread, and whether it returned EAGAIN */
+#define SELF_IO(c, op, n)	do { COUNTER_ADD((c)->t->self.op, 1); \
+				  if ((n) < 0 && errno == EAGAIN) COUNTER_ADD((c)->t->self.op##_eagain, 1); } while (0)
+
 typedef struct thread {
+  thread_counters *counters;	/* per-target counters, indexed by request_def.target */
   int id;			/* thread id */
+  int cpu;			/* CPU the thread is pinned to, -1 if not pinned to a single CPU */
   pthread_t thread;
   aeEventLoop *loop;
-  char buf[RECVBUF+1];		/* accommodate for the trailing '\0' */
+  struct connection *cs_start;	/* first connection handled by this thread */
+  struct connection *cs_end;	/* one past the last connection handled by this thread */
+  hist latency;			/* response times [us] of requests handled by this thread */
+  hist kernel_latency;		/* the same between the kernel timestamps of the requests and the responses (--timestamping) */
+  hist **target_latency;	/* the same per target, indexed by request_def.target, allocated on the first response; NULL: not kept */
+  struct {
+    uint64_t full;		/* full TLS handshakes */
+    uint64_t resumed;		/* abbreviated TLS handshakes resuming a session */
+    hist handshake;		/* TLS handshake times [us] */
+  } tls;
+  char *stats_buf;		/* buffered response stats lines not yet written to the response stats file */
+  size_t stats_buf_len;		/* length of the buffered response stats data */
+  char *buf;			/* receive buffer of RECVBUF+1 bytes (accommodate for the trailing '\0'), allocated by the thread */
+  char *sndbuf;			/* scratch buffer of SNDBUF+32 bytes to assemble TE chunks of random bodies in (TLS) */
+  struct {
+    double rate;		/* this thread's share of the connect rate [connections/us] */
+    double tokens;		/* connects allowed right now */
+    uint64_t last;		/* time [us] since the Epoch the tokens were last replenished */
+    struct connection *head;	/* connections waiting for a token, oldest first */
+    struct connection *tail;
+    long long timer_id;		/* ID of the time event releasing the waiting connections, 0: none */
+  } cps;
+  self_counters self;		/* overhead of this thread, read by the interval reports any time */
 } thread;
 
-typedef struct connection {
-  thread *t;			/* pointer to a thread that handles this connection */
-  int fd;			/* file descriptor */
-  char *host_from;		/* bind source IP address */
-  scheme scheme;		/* http/https */
+/* Addresses of a target host; replaced as a whole when the host is re-resolved (see dns.c) */
+typedef struct addr_list {
+  struct addr_list *retired;	/* the list this one replaced, freed with the request definition */
+  int n;			/* number of addresses */
+  struct {
+    socklen_t len;
+    struct sockaddr_storage sa;
+  } a[];
+} addr_list;
+
+/* Session cookies of a connection (--cookies), updated in place by header_field() */
+typedef struct cookie_jar {
+  size_t len;			/* length of kv */
+  bool dirty;			/* kv changed since req was rendered */
+  bool cclose;			/* req was rendered from request_cclose */
+  size_t req_len;		/* length of req */
+  char *req;			/* the request with the "Cookie" header; the part before the header never changes */
+  char kv[COOKIE_JAR_LEN];	/* "key1=value1; key2=value2; ..." */
+} cookie_jar;
+
+/* A request definition of the input request file; configuration shared by all the connections (clients) created from it */
+typedef struct request_def {
+  int target;			/* index of the request definition in the input request file */
+  int clients;			/* number of connections created from this request definition */
+  char *host_from;		/* bind source addresses: comma-separated hosts, IP addresses or CIDR blocks */
+  struct {
+    uint16_t lo;		/* first source port to bind to */
+    uint16_t hi;		/* last source port to bind to, 0: let the kernel choose */
+  } port_from;
+  scheme scheme;		/* http/https/h2/h2c */
   char *host;			/* target host */
   int port;			/* target port */
-  struct addrinfo *addr_from;	/* translated network address and service information for host_from */
+  addr_list *addr_from;		/* source addresses of host_from the connections are spread across, shared (see dns.c) */
   struct addrinfo *addr_to;	/* translated network address and service information for host/port */
+  addr_list *addrs;		/* addresses of host/port the connections are spread across, see def_addrs() */
   struct {
     struct {
       bool enable;		/* enable TCP keep-alive */
@@ -96,15 +236,109 @@ typedef struct connection {
       int intvl;		/* the number of seconds between TCP keep-alive probes */
       int cnt;			/* the maximum number of TCP keep-alive probes to send */
     } keep_alive;
+    bool zerocopy;		/* send random bodies with MSG_ZEROCOPY (plain HTTP only) */
   } tcp;
+  bool timestamping;		/* take kernel timestamps of the requests and the responses (plain HTTP/1.1 only) */
   char *method;			/* method: (GET, HEAD, POST, PUT, DELETE, ...) */
   char *path;			/* URL path */
   key_value *headers;		/* key/value header pairs */
   uint64_t delay_min;		/* minimum delay between requests on the connection [ms] */
   uint64_t delay_max;		/* maximum delay between requests on the connection [ms] */
+  uint64_t ramp_up;		/* JMeter-style ramp-up time (start slow) [ms] */
+  struct {
+    uint64_t reqs;		/* requests per second sent by all clients of the request definition (open-loop); 0: closed-loop */
+    uint64_t interval;		/* time [us] between intended request starts on a connection */
+  } rate;
+  uint64_t reqs_max;		/* maximum number of requests to send over a connection (including reconnects) */
+  uint64_t keep_alive_reqs;	/* maximum number of requests that can be sent over a connection before reconnecting */
+  int pipeline;			/* maximum number of requests in flight on a connection (HTTP/1.1 pipelining); 1: no pipelining */
+  int streams;			/* maximum number of concurrent streams on a connection (h2/h2c) */
+  bool tls_session_reuse;	/* enable session resumption to reestablish the connection without a new handshake */
+  double tls_session_reuse_ratio;	/* fraction of the (re-)connections that try to resume a session */
+  bool tls_session_shared;	/* resume the sessions of any connection of this definition, not just our own */
+#ifdef HAVE_SSL
+  WOLFSSL_SESSION *tls_session;	/* latest session shared by the connections (tls_session_shared) */
+#endif
+  char *req_body;		/* HTTP request body to send to a server (unless "random" body type defined) */
+  req_body_type req_body_type;	/* HTTP request body type to send to a server ("content" or "random") */
+  uint64_t req_body_size;	/* HTTP request body size to send to a server when using "random" req_body_type */
+  bool req_body_stream;		/* generate the "random" body on the fly instead of reading the shared PRNG buffer */
+  char chunk_hdr[2][20];	/* TE chunk headers of the full-sized and the last chunk of a random body sent by sendmsg() */
+  char *request;		/* HTTP request data without cookies (keep-alive), shared by the connections */
+  char *request_cclose;		/* HTTP request data without cookies ("Connection: close"), shared by the connections */
+  size_t request_length;	/* length of request */
+  size_t request_cclose_length;	/* length of request_cclose */
+  size_t cookie_off;		/* offset of the "Cookie" header in both request and request_cclose */
+  char *values_file;		/* file of the values the {{line}} template slots are filled with */
+  struct tmpl_values *values;	/* lines of values_file */
+  struct tmpl *tmpl[2];		/* request (keep-alive) and request_cclose compiled into templates, NULL: no template slots */
+  char *h2_hblock[3];		/* HPACK header blocks of the requests (h2/h2c), indexed by H2_HB_* */
+  size_t h2_hblock_len[3];	/* lengths of h2_hblock */
+  uint32_t h2_table_size;	/* size of the peer's dynamic table entries h2_hblock[H2_HB_INDEX] adds */
+  size_t h2_body_len;		/* length of req_body (h2/h2c) */
+  struct {
+    bool enable;		/* check the 2xx responses (see check.c) */
+    uint64_t sample;		/* check one in every sample responses of a connection */
+    int64_t length;		/* expected body length, -1: any */
+    char *contains;		/* substring expected in the first window bytes of the body, NULL: none */
+    char *regex_src;		/* extended regular expression expected to match the first window bytes, NULL: none */
+    regex_t regex;		/* compiled regex_src */
+    size_t window;		/* number of bytes at the start of the body contains/regex are searched in */
+    bool crc;			/* check the CRC-32C of the body */
+    uint32_t crc32c;		/* expected CRC-32C of the body */
+  } check;
+  bool close_client;		/* Should the client initiate connection close? */
+  bool close_linger;		/* Enable socket lingering? */
+  uint64_t close_linger_sec;	/* how many seconds to linger for */
+} request_def;
+
+/* Per-connection (client) state, kept compact as it is accessed on every event */
+typedef struct connection {
+  int fd;			/* file descriptor */
+  thread *t;			/* pointer to a thread that handles this connection */
+  request_def *def;		/* request definition this connection was created from */
+  int client;			/* index of the connection among the clients of its request definition */
+  uint64_t written;		/* how many bytes of request was already written/sent */
+  uint64_t written_overhead;	/* how many bytes of the written data were an encoding overhead, e.g. chunked encoding */
+  uint64_t read;		/* how many bytes of response was already read/received (including HTTP headers) */
+  int status;			/* HTTP response status */
+  bool message_complete;	/* Do we have a complete HTTP response on this connection? */
+  bool sizing;			/* a response ended, the parser paused for socket_read() to count its bytes */
+  bool cclose;			/* Should the client close connection upon receiving response? */
+  bool header_cclose;		/* Is the current request built as "Connection: close" request? */
   bool delayed;			/* whether we need to delay this connection by a time event */
   long long delayed_id;		/* ID of the delayed time event */
-  uint64_t ramp_up;		/* JMeter-style ramp-up time (start slow) [ms] */
+  uint64_t delayed_due;		/* time [us] since the Epoch the delayed time event is due */
+  struct connection *cps_next;	/* next connection waiting for a connect token (see cps.c) */
+  struct {
+    uint64_t tx;		/* kernel time [us] the latest request data left the host, 0: none */
+    uint64_t rx;		/* kernel time [us] the current response started arriving, 0: none */
+  } ts;
+  char *tmpl_buf;		/* the current request rendered from the request definition's template */
+  size_t tmpl_len;		/* length of tmpl_buf */
+  __uint128_t tmpl_rnd;		/* MCG state of the random template slots */
+  const char *req_body_random;	/* PRNG data of the "random" body type; this client's offset into the shared read-only buffer */
+  struct {
+    uint64_t unsent;		/* the number of bytes of the current TE chunk that were not written by the previous "send" attempt */
+    uint64_t offset;		/* the number of bytes of the current TE chunk already written */
+    uint64_t pos;		/* offset of the current TE chunk's data in req_body_random (or the PRNG stream, see "stream") */
+    uint64_t stream;		/* offset of this client's body data in the PRNG stream ("stream" random bodies) */
+    uint64_t len;		/* length of the current TE chunk's data */
+    bool last;			/* the current TE chunk is the last one (followed by the closing chunk) */
+  } body;
+  struct {
+    uint64_t next;		/* time [us] since the Epoch the next request on this connection is intended to start */
+    uint64_t intended;		/* time [us] since the Epoch the current request was intended to start */
+  } rate;
+  struct {
+    struct replay_entry *e;	/* this connection's share of the replay stream in time order (--replay), NULL: none */
+    uint64_t n;			/* number of requests in e */
+  } replay;
+  struct {
+    uint64_t *start;		/* ring of def->pipeline start times [us] of the requests in flight (pipelining only) */
+    int head;			/* ring index of the oldest request in flight */
+    int n;			/* number of requests in flight */
+  } pipe;
   struct {
     uint64_t start;		/* time [us] since the Epoch we *first tried* to establish this connection */
     uint64_t writeable;		/* time [us] since the Epoch the socket became *first* writable */
@@ -116,47 +350,42 @@ typedef struct connection {
     uint64_t written_total;	/* total number of bytes written/sent over this connection */
     uint64_t read_total;	/* total number of bytes received over this connection */
   } cstats;
-  uint64_t reqs_max;		/* maximum number of requests to send over this connection (including reconnects) */
-  uint64_t keep_alive_reqs;	/* maximum number of requests that can be sent over this connection before reconnecting */
-  bool tls_session_reuse;	/* enable session resumption to reestablish the connection without a new handshake */
-  char *req_body;		/* HTTP request body to send to a server (unless "random" body type defined) */
-  char *req_body_random;	/* HTTP request body to send to a server (when "random" body type defined); buffer filled with chunk TE PRNG data */
-  req_body_type req_body_type;	/* HTTP request body type to send to a server ("content" or "random") */
-  uint64_t req_body_size;	/* HTTP request body size to send to a server when using "random" req_body_type */
-  char *request;		/* HTTP request data (headers & body [when *not* using chunked encoding]) to send to a server (keep-alive) */
-  char *request_cclose;		/* HTTP request data (headers & body [when *not* using chunked encoding]) to send to a server ("Connection: close") */
-  bool close_client;		/* Should the client initiate connection close? */
-  bool close_linger;		/* Enable socket lingering? */
-  uint64_t close_linger_sec;	/* how many seconds to linger for */
-  bool cclose;			/* Should the client close connection upon receiving response? */
-  bool header_cclose;		/* Is the current request built as "Connection: close" request? */
-  size_t request_length;	/* HTTP request data (headers & body combined) to send to a server length (keep-alive) */
-  size_t request_cclose_length;	/* HTTP request data (headers & body combined) to send to a server length ("Connection: close") */
-  bool message_complete;	/* Do we have a complete HTTP response on this connection? */
   struct {
-    uint64_t unsent;		/* the number of bytes that were not written by the previous "send" attempt and need to be resent */
-    uint64_t offset;		/* body offset from the beginning of chunk TE PRNG data of size "body_unsent" that needs to be resent */
-  } body;
-  uint64_t written;		/* how many bytes of request was already written/sent */
-  uint64_t written_overhead;	/* how many bytes of the written data were an encoding overhead, e.g. chunked encoding */
-  uint64_t read;		/* how many bytes of response was already read/received (including HTTP headers) */
+    bool on;			/* the current response is checked */
+    uint64_t n;			/* number of responses seen, for sampling */
+    uint64_t len;		/* body bytes of the current response */
+    uint32_t crc;		/* CRC-32C of the body so far */
+    size_t head_len;		/* number of bytes in head */
+    char *head;			/* the first def->check.window bytes of the body, NULL: not needed */
+  } check;
   http_parser parser;		/* nginx parser */
-  int status;			/* HTTP response status */
-  char *cookies;		/* cookies received from and to be sent back to a server */
+  cookie_jar *cookies;		/* cookies received from and to be sent back to a server, allocated on the first one */
+  struct h2_state *h2;		/* HTTP/2 connection state (h2/h2c), NULL otherwise */
 #ifdef HAVE_SSL
   WOLFSSL *ssl;			/* SSL object */
   WOLFSSL_SESSION *ssl_session;	/* SSL session cache */
 #endif
-  bool duplicate;		/* duplicate of a previous connection */
 } connection;
 
 /* Module functions */
-extern void http_requests_create(connection *);
-extern void connection_init(connection *);
+extern void aeCreateFileEventOrDie(aeEventLoop *, int, int, aeFileProc *, void *);
+extern void request_def_init(request_def *);
+extern void http_request_create(const request_def *, const char *, char **, size_t *);
+extern void request_def_requests_create(request_def *);
+extern void request_defs_free(request_def *, int);
+extern void connection_init(connection *, request_def *);
 extern void connections_free(connection *);
-extern void override_ns();
+extern void override_ns(bool);
+extern void addr_parse(const char *, char **, char **);
+extern int socket_listen(const char *, bool);
 extern int host_resolve(char *host, int port, struct addrinfo **addr);
+extern int socket_readable(int);
 extern void socket_connect(aeEventLoop *, int, void *, int);
+extern void socket_connect_now(connection *);
+extern void socket_reconnect(connection *);
+extern void connection_handshake_done(connection *, uint64_t);
+extern void socket_read(aeEventLoop *, int, void *, int);
+extern void socket_write(aeEventLoop *, int, void *, int);
 #if 0
 extern int headers_complete(http_parser *);
 #endif
@@ -0,0 +1,350 @@
+/*
+ * Replay of recorded traffic (--replay).  A log of requests, one per line with the time it was
+ * received, is compiled into complete HTTP/1.1 requests before the test starts.  Every request
+ * goes to the request definition of its host and is dealt to the clients of the definition
+ * round-robin, so that every connection gets its own time-ordered share of the stream; as the
+ * connections of a worker thread are contiguous, so are the shares the thread reads, and no
+ * locking is needed.  The connections send their requests open-loop at the original times since
+ * the first request of the log, divided by the speed (--replay-speed).
+ */
+#include <ctype.h>		/* isspace() */
+#include <errno.h>		/* errno */
+#include <fcntl.h>		/* open() */
+#include <inttypes.h>		/* PRIu64 */
+#include <math.h>		/* llround() */
+#include <stdlib.h>		/* malloc(), free(), qsort(), strtod() */
+#include <string.h>		/* memcpy(), memchr(), strerror() */
+#include <strings.h>		/* strncasecmp() */
+#include <sys/mman.h>		/* mmap(), munmap() */
+#include <sys/stat.h>		/* fstat() */
+#include <unistd.h>		/* close() */
+
+#include "mb.h"			/* cfg */
+#include "mcg.h"		/* mcg64cpy() */
+#include "merr.h"
+#include "replay.h"
+
+/* a request of the log while the stream is being built */
+typedef struct replay_raw {
+  uint64_t at;			/* log time [us] */
+  uint64_t line;		/* line number of the request, keeps the order of requests logged at the same time */
+  size_t off;			/* offset of the compiled request in the arena */
+  size_t len;			/* length of the compiled request */
+  int def;			/* index of the request definition */
+} replay_raw;
+
+/* the replay stream */
+static struct {
+  char *arena;			/* the compiled requests */
+  size_t arena_len;		/* bytes used of arena */
+  size_t arena_size;		/* size of arena */
+  replay_entry *e;		/* the requests grouped by connection, every connection's in time order */
+  uint64_t n;			/* number of requests */
+  uint64_t *conn_n;		/* number of requests of every connection, until replay_conns_init() */
+  uint64_t span;		/* time [us] between the first and the last request (scaled) */
+  uint64_t skipped;		/* requests of hosts no request definition is for */
+  double speed;			/* replay speed: 2 is twice as fast as recorded */
+} replay;
+
+uint64_t replay_origin;		/* time [us] since the Epoch the replay started */
+
+/* Whether the field f of length len is a header called name (case insensitive). */
+static inline bool header_is(const char *f, size_t len, const char *name) {
+  size_t n = strlen(name);
+
+  return len > n && f[n] == ':' && !strncasecmp(f, name, n);
+}
+
+/* Make room for len more bytes in the arena. */
+static void arena_reserve(size_t len) {
+  if (replay.arena_len + len <= replay.arena_size) return;
+
+  while (replay.arena_len + len > replay.arena_size)
+    replay.arena_size = replay.arena_size? replay.arena_size * 2: REPLAY_ARENA_LEN;
+  if ((replay.arena = realloc(replay.arena, replay.arena_size)) == NULL)
+    die(EXIT_FAILURE, "realloc(): cannot allocate memory for the replayed requests\n");
+}
+
+/*
+ * Parse the host and the port (0: none) of the authority at a, e.g. "[::1]:8080", the end of a
+ * "Host" header value or of the host of a URL; return the rest after them.
+ */
+static const char *authority_parse(const char *a, const char **host, size_t *host_len, int *port, int line) {
+  const char *p;
+  char *end;
+  long v;
+
+  if (*a == '[') {
+    /* IPv6 address */
+    if ((p = strchr(++a, ']')) == NULL)
+      die(EXIT_FAILURE, "invalid replay file, line %d: unterminated IPv6 address\n", line);
+    *host_len = p++ - a;
+  } else {
+    p = a + strcspn(a, ":/? \t\r\n");
+    *host_len = p - a;
+  }
+  *host = a;
+  *port = 0;
+  if (*p == ':') {
+    v = strtol(p + 1, &end, 10);
+    if (end == p + 1 || v < 1 || v > 65535)
+      die(EXIT_FAILURE, "invalid replay file, line %d: invalid port\n", line);
+    *port = v;
+    p = end;
+  }
+
+  return p;
+}
+
+/*
+ * Find the request definition of the URL url (absolute or a path) of a request with the "Host"
+ * header host (NULL: none); set *path to the path of the URL.  Return -1 if there is none.
+ * A host without a port is on the default port of the scheme.
+ */
+static int def_find(request_def *defs, int defs_n, const char *url, const char *host, const char **path, int line) {
+  const char *h, *p;
+  int port, i, scheme_tls = -1;
+  size_t host_len;
+
+  if (*url == '/') {
+    /* the definition of the "Host" header, the first one without the header */
+    *path = url;
+    if (!host) return 0;
+    authority_parse(host, &h, &host_len, &port, line);
+  } else {
+    if (!strncmp(url, "http://", 7)) h = url + 7, scheme_tls = 0;
+    else if (!strncmp(url, "https://", 8)) h = url + 8, scheme_tls = 1;
+    else die(EXIT_FAILURE, "invalid replay file, line %d: http(s) URL or path expected\n", line);
+
+    p = authority_parse(h, &h, &host_len, &port, line);
+    *path = *p == '/'? p: "/";
+  }
+
+  /* a path goes to a definition of either scheme, on the port of the "Host" header */
+  for (i = 0; i < defs_n; i++)
+    if ((scheme_tls < 0 || SCHEME_TLS(defs[i].scheme) == scheme_tls) &&
+        defs[i].port == (port? port: SCHEME_TLS(defs[i].scheme)? 443: 80) &&
+        strlen(defs[i].host) == host_len && !strncasecmp(defs[i].host, h, host_len)) return i;
+
+  return -1;
+}
+
+/* Parse the request line l of length len (line number line) and compile it into the arena as r. */
+static bool request_compile(replay_raw *r, request_def *defs, int defs_n, char *l, size_t len, int line) {
+  char *f[REPLAY_FIELDS_MIN], *host = NULL, *end, *p, *hdr;
+  const char *path;
+  size_t hdr_len = 0, hl;
+  uint64_t body;
+  double at;
+  int n, hdr_n = 0;
+
+  /* split the fields at the tabs; the headers are left in place */
+  l[len] = '\0';
+  for (n = 0, p = l; n < REPLAY_FIELDS_MIN && p; n++) {
+    f[n] = p;
+    if ((p = strchr(p, '\t'))) *p++ = '\0';
+  }
+  if (n < REPLAY_FIELDS_MIN)
+    die(EXIT_FAILURE, "invalid replay file, line %d: timestamp, method, URL and body size expected\n", line);
+  hdr = p;
+
+  errno = 0;
+  at = strtod(f[0], &end);
+  if (errno || end == f[0] || *end || at < 0)
+    die(EXIT_FAILURE, "invalid replay file, line %d: invalid timestamp `%s'\n", line, f[0]);
+  body = strtoull(f[3], &end, 10);
+  if (!strcmp(f[3], "-")) body = 0;		/* no body, as access logs put it */
+  else if (end == f[3] || *end || *f[3] == '-')
+    die(EXIT_FAILURE, "invalid replay file, line %d: invalid body size `%s'\n", line, f[3]);
+  if (!*f[1]) die(EXIT_FAILURE, "invalid replay file, line %d: method expected\n", line);
+
+  for (p = hdr; p && *p; p = end) {
+    if ((end = strchr(p, '\t'))) *end++ = '\0';
+    if (header_is(p, strlen(p), HTTP_HOST)) for (host = p + sizeof(HTTP_HOST); isspace(*host); host++);
+    hdr_len += strlen(p) + 2;
+    hdr_n++;
+  }
+  if ((r->def = def_find(defs, defs_n, f[2], host, &path, line)) < 0) return false;
+  if (body + hdr_len > MAX_REQ_LEN)
+    die(EXIT_FAILURE, "invalid replay file, line %d: request longer than %lu bytes\n", line, MAX_REQ_LEN);
+
+  /* request line, headers (but those about the message framing), the Host header if missing, and the body */
+  arena_reserve(strlen(f[1]) + strlen(path) + hdr_len + strlen(defs[r->def].host) + 64 + HTTP_CONT_MAX + body);
+  p = replay.arena + replay.arena_len;
+  p += sprintf(p, "%s %s " HTTP_PROTO HTTP_CRLF, f[1], path);
+  if (!host) p += sprintf(p, HTTP_HOST ": %s" HTTP_CRLF, defs[r->def].host);
+  for (n = 0; n < hdr_n; n++, hdr += hl + 1) {
+    hl = strlen(hdr);
+    if (!hl || header_is(hdr, hl, HTTP_CONT_LEN) || header_is(hdr, hl, "Transfer-Encoding") ||
+        header_is(hdr, hl, "Connection")) continue;
+    memcpy(p, hdr, hl);
+    p += hl;
+    memcpy(p, HTTP_CRLF, 2);
+    p += 2;
+  }
+  if (body) p += sprintf(p, HTTP_CONT_LEN ": %"PRIu64 HTTP_CRLF, body);
+  memcpy(p, HTTP_CRLF, 2);
+  p += 2;
+  if (body) {
+    __uint128_t rnd = BODY_RANDOM_SEED;
+
+    mcg64cpy(&rnd, p, body);
+    p += body;
+  }
+
+  r->at = llround(at * 1000000);
+  r->line = line;
+  r->off = replay.arena_len;
+  r->len = p - (replay.arena + replay.arena_len);
+  replay.arena_len += r->len;
+
+  return true;
+}
+
+static int raw_cmp(const void *a, const void *b) {
+  const replay_raw *x = a, *y = b;
+
+  if (x->at != y->at) return x->at < y->at? -1: 1;
+  return x->line < y->line? -1: x->line > y->line;
+}
+
+/*
+ * Load the replay file file and build the stream replayed at speed through the request
+ * definitions defs; lower their clients to the number of their requests.  Return the number of
+ * connections.
+ */
+int replay_load(const char *file, double speed, request_def *defs, int defs_n) {
+  replay_raw *raw = NULL;
+  uint64_t raw_n = 0, raw_size = 0, i, *def_n, *def_k, *conn_off;
+  int *def_base, connections = 0, fd, line = 0, d;
+  char *map, *l, *eol, *buf = NULL;
+  struct stat st;
+
+  if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    die(EXIT_FAILURE, "cannot open replay file %s: %s (%d)\n", file, strerror(errno), errno);
+  if (st.st_size == 0)
+    die(EXIT_FAILURE, "replay file %s is empty\n", file);
+  if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    die(EXIT_FAILURE, "cannot map replay file %s: %s (%d)\n", file, strerror(errno), errno);
+  close(fd);
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  replay.speed = speed;
+  for (l = map; l < map + st.st_size; l = eol + 1) {
+    size_t len;
+
+    if ((eol = memchr(l, '\n', map + st.st_size - l)) == NULL) eol = map + st.st_size;
+    line++;
+    for (len = eol - l; len && isspace(l[len - 1]); len--);
+    if (!len || *l == '#') continue;
+
+    if (raw_n == raw_size) {
+      raw_size = raw_size? raw_size * 2: 1024;
+      if ((raw = realloc(raw, raw_size * sizeof(*raw))) == NULL)
+        die(EXIT_FAILURE, "realloc(): cannot allocate memory for the replayed requests\n");
+    }
+    if ((buf = realloc(buf, len + 1)) == NULL)
+      die(EXIT_FAILURE, "realloc(): cannot allocate memory for a replay line\n");
+    memcpy(buf, l, len);
+    if (request_compile(&raw[raw_n], defs, defs_n, buf, len, line)) raw_n++;
+    else replay.skipped++;
+  }
+  free(buf);
+  munmap(map, st.st_size);
+
+  if (replay.skipped)
+    warning("skipped %"PRIu64" requests of the replay file for hosts not in the request file\n", replay.skipped);
+  if (!raw_n) die(EXIT_FAILURE, "no requests to replay in %s\n", file);
+  qsort(raw, raw_n, sizeof(*raw), raw_cmp);
+
+  /* the clients of a definition, its first connection, and the connections' shares of the stream */
+  if ((def_n = calloc(defs_n, sizeof(*def_n))) == NULL || (def_k = calloc(defs_n, sizeof(*def_k))) == NULL ||
+      (def_base = calloc(defs_n, sizeof(*def_base))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for the replay stream\n");
+  for (i = 0; i < raw_n; i++) def_n[raw[i].def]++;
+  for (d = 0; d < defs_n; d++) {
+    request_def *def = &defs[d];
+
+    if (!def_n[d]) {
+      warning("no requests to replay for %s:%d\n", def->host, def->port);
+      def->clients = 0;
+    } else if (def->scheme == h2 || def->scheme == h2c || def->pipeline > 1) {
+      die(EXIT_FAILURE, "replay needs HTTP/1.1 without pipelining: %s:%d\n", def->host, def->port);
+    } else if (def->tmpl[0]) {
+      /* the recorded requests are sent as they are */
+      die(EXIT_FAILURE, "replay sends the recorded requests, no templates: %s:%d\n", def->host, def->port);
+    } else if (def->clients > def_n[d]) {
+      def->clients = def_n[d];
+    }
+    if (def->rate.reqs || def->delay_max) {
+      warning("replaying; ignoring the rate and delay of %s:%d\n", def->host, def->port);
+      def->rate.reqs = def->delay_min = def->delay_max = 0;
+    }
+    def_base[d] = connections;
+    connections += def->clients;
+  }
+
+  if ((replay.e = malloc(raw_n * sizeof(*replay.e))) == NULL ||
+      (replay.conn_n = calloc(connections, sizeof(*replay.conn_n))) == NULL ||
+      (conn_off = calloc(connections + 1, sizeof(*conn_off))) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for the replay stream\n");
+  /* deal the requests of every definition to its clients round-robin, keeping the time order */
+  for (i = 0; i < raw_n; i++) {
+    d = raw[i].def;
+    raw[i].def = def_base[d] + def_k[d]++ % defs[d].clients;	/* now the connection */
+    replay.conn_n[raw[i].def]++;
+  }
+  for (d = 0; d < connections; d++) conn_off[d + 1] = conn_off[d] + replay.conn_n[d];
+  for (i = 0; i < raw_n; i++) {
+    replay_entry *e = &replay.e[conn_off[raw[i].def]++];
+
+    e->at = (raw[i].at - raw[0].at) / speed;
+    e->req = replay.arena + raw[i].off;
+    e->len = raw[i].len;
+  }
+  replay.n = raw_n;
+  replay.span = (raw[raw_n - 1].at - raw[0].at) / speed;
+  if (replay.span / 1000000 > cfg.duration)
+    warning("the replay takes %0.2fs at %gx, longer than the test duration of %"PRIu64"s\n",
+      (double)replay.span / 1000000, speed, cfg.duration);
+
+  free(raw);
+  free(def_n);
+  free(def_k);
+  free(def_base);
+  free(conn_off);
+
+  return connections;
+}
+
+/* Point the connections cs (n of them) to their shares of the replay stream. */
+void replay_conns_init(connection *cs, int n) {
+  replay_entry *e = replay.e;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    cs[i].replay.e = e;
+    cs[i].replay.n = replay.conn_n[i];
+    e += replay.conn_n[i];
+  }
+  free(replay.conn_n);
+  replay.conn_n = NULL;
+}
+
+/* Print how much of the replay stream its sent requests reqs are. */
+void replay_print(uint64_t reqs) {
+  if (!replay.n) return;
+
+  fprintf(stdout, "Replay: %"PRIu64" requests over %0.2fs at %gx, sent: %0.1f%%\n",
+    replay.n, (double)replay.span / 1000000, replay.speed, 100.0 * reqs / replay.n);
+}
+
+void replay_free() {
+  free(replay.e);
+  free(replay.conn_n);
+  free(replay.arena);
+  replay.e = NULL;
+  replay.conn_n = NULL;
+  replay.arena = NULL;
+  replay.n = 0;
+}
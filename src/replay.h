@@ -0,0 +1,28 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>			/* size_t */
+#include <stdint.h>			/* uint64_t */
+
+#include "net.h"			/* request_def, connection */
+
+#define REPLAY_FIELDS_MIN	4		/* timestamp, method, URL and body size; the headers follow */
+#define REPLAY_ARENA_LEN	(1UL<<20)	/* initial size of the arena the requests are compiled into: 1MB */
+
+/* A request of the replay stream, compiled once before the test starts */
+typedef struct replay_entry {
+  uint64_t at;			/* time [us] the request is due after the start of the replay, scaled by the speed */
+  char *req;			/* HTTP request data, headers and body */
+  size_t len;			/* length of req */
+} replay_entry;
+
+/* Module variables */
+extern uint64_t replay_origin;
+
+/* Module functions */
+extern int replay_load(const char *, double, request_def *, int);
+extern void replay_conns_init(connection *, int);
+extern void replay_print(uint64_t);
+extern void replay_free();
+
+#endif /* REPLAY_H */
@@ -1,14 +1,19 @@
 #ifdef HAVE_SSL
 
+#include <pthread.h>		/* pthread_mutex_lock() */
 #include <string.h>		/* strlen() */
 #include <sys/socket.h>		/* MSG_NOSIGNAL */
 
+#include "hist.h"		/* hist_record() */
 #include "merr.h"
 #include "ssl.h"
 
 /* Global variables */
 WOLFSSL_CTX *ctx = NULL;
 
+/* guards the sessions shared by the connections of a request definition (tls-session-shared) */
+static pthread_mutex_t ssl_session_lock = PTHREAD_MUTEX_INITIALIZER;
+
 WOLFSSL_CTX *ssl_init(int ssl_version) {
   WOLFSSL_METHOD *method = NULL;
 
@@ -80,6 +85,19 @@ WOLFSSL_CTX *ssl_init(int ssl_version) {
   return ctx;
 }
 
+/*
+ * Whether the current connection of c should try to resume a session: tls-session-reuse-ratio of
+ * the (re-)connections do, spread evenly over them rather than at random.
+ */
+static inline bool ssl_session_resume(const connection *c) {
+  double r = c->def->tls_session_reuse_ratio;
+  uint64_t n = c->cstats.connections;
+
+  if (!c->def->tls_session_reuse) return false;
+
+  return (uint64_t)(n * r) != (uint64_t)((n - 1) * r);
+}
+
 WOLFSSL *ssl_new(connection *c) {
   int n;
 
@@ -93,29 +111,74 @@ WOLFSSL *ssl_new(connection *c) {
   wolfSSL_SetIOReadFlags(c->ssl, MSG_NOSIGNAL);		/* no SIGPIPE */
   wolfSSL_SetIOWriteFlags(c->ssl, MSG_NOSIGNAL);	/* no SIGPIPE */
 
-  if (c->ssl_session) {
-    /* set the session ID to connect to the server */
-    if ((n = wolfSSL_set_session(c->ssl, c->ssl_session)) != SSL_SUCCESS) {
-      warning("failed to set SSL session: [%d]\n", c->fd);
+  if (ssl_session_resume(c)) {
+    if (c->def->tls_session_shared) {
+      /* the latest session of any connection of this request definition, possibly on another thread */
+      pthread_mutex_lock(&ssl_session_lock);
+      if (c->def->tls_session && (n = wolfSSL_set_session(c->ssl, c->def->tls_session)) != SSL_SUCCESS)
+        warning("failed to set SSL session: [%d]\n", c->fd);
+      pthread_mutex_unlock(&ssl_session_lock);
+    } else if (c->ssl_session) {
+      /* set the session ID to connect to the server */
+      if ((n = wolfSSL_set_session(c->ssl, c->ssl_session)) != SSL_SUCCESS) {
+        warning("failed to set SSL session: [%d]\n", c->fd);
+      }
     }
   }
 
 #ifdef HAVE_SNI
-  if ((n = wolfSSL_UseSNI(c->ssl, WOLFSSL_SNI_HOST_NAME, c->host, strlen(c->host))) != SSL_SUCCESS) {
+  if ((n = wolfSSL_UseSNI(c->ssl, WOLFSSL_SNI_HOST_NAME, c->def->host, strlen(c->def->host))) != SSL_SUCCESS) {
     warning("failed to set using SNI: [%d]\n", c->fd);
   }
   wolfSSL_SNI_SetOptions(c->ssl, WOLFSSL_SNI_HOST_NAME, WOLFSSL_SNI_CONTINUE_ON_MISMATCH);
 #endif
 
+#ifdef HAVE_ALPN
+  if (c->def->scheme == h2) {
+    /* HTTP/2 over TLS is negotiated by ALPN (RFC 7540, 3.3) */
+    if ((n = wolfSSL_UseALPN(c->ssl, "h2", 2, WOLFSSL_ALPN_FAILED_ON_MISMATCH)) != SSL_SUCCESS) {
+      warning("failed to set using ALPN: [%d]\n", c->fd);
+    }
+  }
+#endif
+
   /* do not call ssl_connect()/wolfSSL_connect(), leave that up to wolfSSL_write() when needed */
 
   return c->ssl;
 }
 
+/* Account for the TLS handshake of c just completed; a full handshake provides a new session to share. */
+void ssl_handshake_done(connection *c) {
+  WOLFSSL_SESSION *session;
+
+  hist_record(&c->t->tls.handshake, c->cstats.handshake - c->cstats.writeable);
+
+  if (wolfSSL_session_reused(c->ssl)) {
+    c->t->tls.resumed++;
+    return;
+  }
+  c->t->tls.full++;
+
+  /* an owned copy: the session wolfSSL_get_session() returns lives in the session cache and may be
+   * evicted while the other connections still resume it */
+  if (c->def->tls_session_reuse && c->def->tls_session_shared &&
+      (session = wolfSSL_get_session(c->ssl)) && (session = wolfSSL_SESSION_dup(session))) {
+    WOLFSSL_SESSION *replaced;
+
+    pthread_mutex_lock(&ssl_session_lock);
+    replaced = c->def->tls_session;
+    c->def->tls_session = session;
+    pthread_mutex_unlock(&ssl_session_lock);
+
+    /* wolfSSL_set_session() copies the session under the lock, nobody refers to the replaced one */
+    if (replaced) wolfSSL_SESSION_free(replaced);
+  }
+}
+
 int ssl_free(connection *c) {
   if (!c || !c->ssl) return 0;
 
-  if (c->tls_session_reuse && !wolfSSL_session_reused(c->ssl)) {
+  if (c->def->tls_session_reuse && !wolfSSL_session_reused(c->ssl)) {
     /* set up TLS session reuse */
     c->ssl_session = wolfSSL_get_session(c->ssl);
     /* note that it is possible for c->ssl_session == NULL */
@@ -13,6 +13,7 @@ extern WOLFSSL_CTX *ctx;
 extern WOLFSSL_CTX *ssl_init(int);
 extern WOLFSSL *ssl_new(connection *);
 extern int ssl_free(connection *c);
+extern void ssl_handshake_done(connection *);
 extern void ssl_shutdown();
 extern int ssl_connect(connection *);
 extern ssize_t ssl_read(WOLFSSL *, void *, int);
@@ -1,32 +1,205 @@
 #include <inttypes.h>	/* PRIu64 */
 #include <pthread.h>	/* pthread_mutex_lock() */
+#include <stdlib.h>	/* calloc(), malloc() */
+#include <string.h>	/* memcpy() */
+#include <sys/stat.h>	/* fstat() */
 
 #ifdef HAVE_SSL
 #include <wolfssl/options.h>	/* HAVE_SNI, HAVE_SECURE_RENEGOTIATION, ... */
 #include <wolfssl/ssl.h>	/* wolfSSL_session_reused() */
 #endif
 
+#include "h2.h"		/* h2_state */
 #include "mb.h"		/* time_us() */
+#include "merr.h"	/* error() */
 #include "net.h"	/* connection struct */
 #include "stats.h"
 
 pthread_mutex_t stats_file_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Error messages of the binary response stats format, referred to by their index */
+static const char *stats_errs[] = {
+  "",
+  "socket_read(): parser",
+  "socket_read(): connection",
+  "socket_write_request_random_chunked()",
+  "socket_write_request()",
+  "h2: protocol error",
+  "h2: stream reset",
+  "h2_write()",
+  NULL
+};
+
+/*
+ * Return the time [us] since the Epoch the current request started; see start_request in README.md.
+ * In the open-loop (rate) mode a request that started late is measured from its intended start
+ * so that server stalls are not hidden by the lower send rate (coordinated omission).
+ */
+uint64_t request_start(connection *c) {
+  uint64_t start;
+
+  if (c->h2 && c->h2->done) {
+    /* HTTP/2: the stream being recorded */
+    start = c->h2->done->start;
+  } else if (c->pipe.n) {
+    /* pipelining: the oldest request in flight */
+    start = c->pipe.start[c->pipe.head];
+  } else if (c->cstats.reqs <= 1) {
+    /* first request within an established connection or a connection error (c->cstats.reqs == 0) */
+    start = c->cstats.start;		/* time [us] since the Epoch we *first tried* to establish this connection */
+  } else {
+    /* keep-alive request, connection was established */
+    start = c->cstats.established;	/* time [us] since the Epoch the socket became writeable *and* just before we successfully issued a new request */
+  }
+
+  if (CONN_OPEN_LOOP(c) && c->rate.intended && c->rate.intended < start)
+    return c->rate.intended;
+
+  return start;
+}
+
+/* Record the response (c->status) to the request just completed on c, which took us [us]. */
+void response_record(connection *c, uint64_t us) {
+  static const uint64_t bounds[LATENCY_BOUNDS_N] = { LATENCY_BOUNDS };
+  thread_counters *tc = CONN_COUNTERS(c);
+  int i;
+
+  if (c->status > 399) COUNTER_ADD(tc->err_status, 1);
+  if (c->status >= 100 && c->status < 600) COUNTER_ADD(tc->status[c->status / 100 - 1], 1);
+
+  hist_record(&c->t->latency, us);
+  if (c->t->target_latency) {
+    hist **h = &c->t->target_latency[c->def->target];
+
+    /* a thread may only ever see a few of the targets */
+    if (*h == NULL) {
+      if ((*h = malloc(sizeof(hist))) == NULL) die(EXIT_FAILURE, "malloc(): cannot allocate memory for a per-target histogram\n");
+      hist_init(*h);
+    }
+    hist_record(*h, us);
+  }
+
+  for (i = 0; i < LATENCY_BOUNDS_N && us > bounds[i]; i++);
+  COUNTER_ADD(tc->latency[i], 1);
+  COUNTER_ADD(tc->latency_sum, us);
+}
+
+/*
+ * Write the buffered response stats of thread t to fd.  The lock is only taken once per
+ * STATS_BUF_LEN worth of data, not for every response.
+ */
+void stats_buf_flush(FILE *fd, thread *t) {
+  if (!t->stats_buf || !t->stats_buf_len) return;
+
+  pthread_mutex_lock(&stats_file_lock);
+  fwrite(t->stats_buf, t->stats_buf_len, 1, fd);
+  pthread_mutex_unlock(&stats_file_lock);
+
+  t->stats_buf_len = 0;
+}
+
+static uint8_t stats_err_code(const char *err) {
+  uint8_t i;
+
+  if (!err) return 0;
+
+  for (i = 1; stats_errs[i]; i++)
+    if (!strcmp(err, stats_errs[i])) return i;
+
+  return STATS_ERR_UNKNOWN;
+}
+
+static inline int fwrite_str(FILE *fd, const char *s) {
+  char len[4];
+
+  put_le32(len, strlen(s));
+  return fwrite(len, 4, 1, fd) == 1 && fwrite(s, strlen(s), 1, fd) == (*s? 1: 0);
+}
+
+/* Format the method and URL of d into dst of size len. */
+char *request_def_name(char *dst, size_t len, const request_def *d) {
+  snprintf(dst, len, "%s %s://%s:%d%s",
+    d->method? d->method: "GET",
+    SCHEME_TLS(d->scheme)? "https": "http",
+    d->host,
+    d->port,
+    d->path? d->path: "/");
+
+  return dst;
+}
+
+/*
+ * Write the response stats file header.  Only the binary format has one, it holds the table of
+ * targets and error messages the binary records refer to by their index.
+ */
+int stats_header_write(FILE *fd, const request_def *defs, int n) {
+  char buf[16], target[BUFSIZ], *p;
+  const request_def *d;
+  uint32_t errs = 0;
+
+  if (cfg.output_format != output_binary) return 0;
+
+  while (stats_errs[errs]) errs++;
+
+  p = put_le32(buf, STATS_VERSION);
+  p = put_le32(p, STATS_RECORD_LEN);
+  p = put_le32(p, n);
+  if (fwrite(STATS_MAGIC, STATS_MAGIC_LEN, 1, fd) != 1 || fwrite(buf, p - buf, 1, fd) != 1) return -1;
+
+  /* the request definitions are indexed by their target */
+  for (d = defs; d < defs + n; d++) {
+    request_def_name(target, sizeof(target), d);
+    if (!fwrite_str(fd, target)) return -1;
+  }
+
+  put_le32(buf, errs);
+  if (fwrite(buf, 4, 1, fd) != 1) return -1;
+  for (errs = 0; stats_errs[errs]; errs++)
+    if (!fwrite_str(fd, stats_errs[errs])) return -1;
+
+  return 0;
+}
+
 int write_stats_line(FILE *fd, connection *c, char *err) {
-  char s[BUFSIZ];
+  thread *t = c->t;
+  char *s;
   uint64_t now = time_us();
   uint64_t socket_writeable = c->cstats.writeable? c->cstats.writeable - c->cstats.start: 0;
   uint64_t connection_establishment = c->cstats.handshake? c->cstats.handshake - c->cstats.start: 0;
-  uint64_t start_request, delay;
+  uint64_t start_request = request_start(c);
+  uint64_t delay = now - start_request;
+#ifdef HAVE_SSL
+  int tls_reuse = c->ssl? wolfSSL_session_reused(c->ssl): 0;	/* TLS session: 1 -- reused, 0 -- not reused */
+#else
+  int tls_reuse = 0;
+#endif
 
-  if (c->cstats.reqs <= 1) {
-    /* first request within an established connection or a connection error (c->cstats.reqs == 0) */
-    start_request = c->cstats.start;		/* time [us] since the Epoch we *first tried* to establish this connection */
-    delay = now - c->cstats.start;
-  } else {
-    /* keep-alive request, connection was established */
-    start_request = c->cstats.established;	/* time [us] since the Epoch the socket became writeable *and* just before we successfully issued a new request */
-    delay = now - c->cstats.established;
+  if (STATS_BUF_LEN - t->stats_buf_len < BUFSIZ) {
+    /* not enough room for another line */
+    stats_buf_flush(fd, t);
+  }
+  s = t->stats_buf + t->stats_buf_len;
+
+  if (cfg.output_format == output_binary) {
+    /* fixed-size little-endian record, see stats_dump() */
+    s = put_le64(s, start_request);
+    s = put_le64(s, c->cstats.start);
+    s = put_le64(s, c->written);
+    s = put_le64(s, c->read);
+    s = put_le32(s, MIN(delay, UINT32_MAX));
+    s = put_le32(s, MIN(socket_writeable, UINT32_MAX));
+    s = put_le32(s, MIN(connection_establishment, UINT32_MAX));
+    s = put_le32(s, c->cstats.connections);
+    s = put_le32(s, c->cstats.reqs);
+    s = put_le32(s, c->def->target);
+    s = put_le32(s, c->fd);
+    s = put_le16(s, c->status);
+    s = put_le16(s, c->t->id);
+    *s++ = tls_reuse;
+    *s++ = stats_err_code(err);
+    t->stats_buf_len += STATS_RECORD_LEN;
+
+    return 0;
   }
 
   int len = snprintf(s, BUFSIZ, "%"PRIu64",%"PRIu64",%d,%"PRIu64",%"PRIu64",%s %s://%s:%d%s,%d,%d,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%d,%s\n",
@@ -35,11 +208,11 @@ int write_stats_line(FILE *fd, connection *c, char *err) {
     c->status,					/* HTTP response status */
     c->written,					/* request length (including headers) */
     c->read,					/* response length (including headers) */
-    c->method,					/* http|https */
-    (c->scheme == http)? "http": "https",
-    c->host,
-    c->port,
-    c->path,
+    c->def->method? c->def->method: "GET",		/* GET|HEAD|POST|... */
+    SCHEME_TLS(c->def->scheme)? "https": "http",
+    c->def->host,
+    c->def->port,
+    c->def->path? c->def->path: "/",
     c->t->id,					/* thread id */
     c->fd,					/* connection id (file descriptor) */
     c->cstats.connections,			/* how many times we connected (initial connection + reconnections) */
@@ -47,17 +220,120 @@ int write_stats_line(FILE *fd, connection *c, char *err) {
     c->cstats.start,				/* time [us] since the Epoch we *first tried* to establish this connection */
     socket_writeable,				/* time [us] it took for the socket to become writeable */
     connection_establishment,			/* time [us] it took to establish this connection (connection establishment delay) */
-#ifdef HAVE_SSL
-    c->ssl? wolfSSL_session_reused(c->ssl): 0,	/* TLS session: 1 -- reused, 0 -- not reused */
-#else
-    0,
-#endif
+    tls_reuse,
     err? err: ""
     );
 
-  pthread_mutex_lock(&stats_file_lock);
-  fwrite(s, len, 1, fd);
-  pthread_mutex_unlock(&stats_file_lock);
+  t->stats_buf_len += MIN(len, BUFSIZ - 1);	/* snprintf() returns the untruncated length */
+
+  return 0;
+}
+
+static void strs_free(char **strs, uint32_t n) {
+  uint32_t i;
+
+  if (strs == NULL) return;
+  for (i = 0; i < n; i++) free(strs[i]);
+  free(strs);
+}
+
+/* Return the number of bytes of fd left to read; UINT32_MAX - 1 if unknown (not a regular file) */
+static uint64_t fread_left(FILE *fd) {
+  struct stat st;
+  off_t pos;
+
+  if (fstat(fileno(fd), &st) || !S_ISREG(st.st_mode) || (pos = ftello(fd)) < 0) return UINT32_MAX - 1;
+  if (st.st_size < pos) return 0;
 
+  return st.st_size - pos;
+}
+
+/* Read a string table: a count and as many length-prefixed strings; the counts are checked against the file size */
+static char **fread_strs(FILE *fd, uint32_t *n) {
+  char buf[4], **strs;
+  uint32_t i, len;
+
+  if (fread(buf, 4, 1, fd) != 1) return NULL;
+  *n = get_le32(buf);
+  if (*n > fread_left(fd) / 4) {
+    /* every string takes 4 bytes of length at least */
+    *n = 0;
+    return NULL;
+  }
+  if ((strs = calloc((size_t)*n + 1, sizeof(char *))) == NULL) return NULL;
+
+  for (i = 0; i < *n; i++) {
+    if (fread(buf, 4, 1, fd) != 1) goto err;
+    len = get_le32(buf);
+    if (len > fread_left(fd) || (strs[i] = calloc((size_t)len + 1, 1)) == NULL) goto err;
+    if (len && fread(strs[i], len, 1, fd) != 1) goto err;
+  }
+
+  return strs;
+
+err:
+  strs_free(strs, *n);				/* calloc()ed, so the unread entries are NULL */
+  return NULL;
+}
+
+/* Convert a binary response stats file to the CSV format on stdout. */
+int stats_dump(const char *file) {
+  FILE *fd;
+  char buf[STATS_RECORD_LEN], **targets = NULL, **errs = NULL;
+  uint32_t targets_n = 0, errs_n = 0, record_len;
+
+  if ((fd = fopen(file, "r")) == NULL) {
+    error("cannot open file `%s' for reading\n", file);
+    return -1;
+  }
+
+  if (fread(buf, STATS_MAGIC_LEN + 8, 1, fd) != 1 || memcmp(buf, STATS_MAGIC, STATS_MAGIC_LEN)) {
+    error("`%s' is not a binary response stats file\n", file);
+    goto err;
+  }
+  if (get_le32(buf + STATS_MAGIC_LEN) != STATS_VERSION) {
+    error("unsupported binary response stats file version %u\n", get_le32(buf + STATS_MAGIC_LEN));
+    goto err;
+  }
+  record_len = get_le32(buf + STATS_MAGIC_LEN + 4);
+  if (record_len != STATS_RECORD_LEN) {
+    error("unsupported binary response stats record length %u\n", record_len);
+    goto err;
+  }
+  if ((targets = fread_strs(fd, &targets_n)) == NULL || (errs = fread_strs(fd, &errs_n)) == NULL) {
+    error("truncated binary response stats file header\n");
+    goto err;
+  }
+
+  while (fread(buf, STATS_RECORD_LEN, 1, fd) == 1) {
+    uint32_t target = get_le32(buf + 52);
+    uint8_t err = buf[65];
+
+    fprintf(stdout, "%"PRIu64",%u,%u,%"PRIu64",%"PRIu64",%s,%u,%d,%u,%u,%"PRIu64",%u,%u,%u,%s\n",
+      get_le64(buf),				/* start_request */
+      get_le32(buf + 32),			/* delay */
+      get_le16(buf + 60),			/* status */
+      get_le64(buf + 16),			/* written */
+      get_le64(buf + 24),			/* read */
+      target < targets_n? targets[target]: "?",	/* method_and_url */
+      get_le16(buf + 62),			/* thread_id */
+      (int32_t)get_le32(buf + 56),		/* conn_id */
+      get_le32(buf + 44),			/* conns */
+      get_le32(buf + 48),			/* reqs */
+      get_le64(buf + 8),			/* start */
+      get_le32(buf + 36),			/* socket_writable */
+      get_le32(buf + 40),			/* conn_est */
+      (unsigned char)buf[64],			/* tls_reuse */
+      err < errs_n? errs[err]: "unknown error");
+  }
+
+  strs_free(targets, targets_n);
+  strs_free(errs, errs_n);
+  fclose(fd);
   return 0;
+
+err:
+  strs_free(targets, targets_n);
+  fclose(fd);
+  return -1;
 }
@@ -1,9 +1,20 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <endian.h>	/* htole64() */
 #include <stdio.h>	/* FILE, stdout, stderr, fopen(), fclose() */
+#include <string.h>	/* memcpy() */
 #include "net.h"	/* connection struct */
 
+#define STATS_BUF_LEN	(1UL<<20)	/* per-thread response stats buffer size: 1MB (must be > BUFSIZ) */
+
+/* Binary response stats format */
+#define STATS_MAGIC		"MBSTATS\n"
+#define STATS_MAGIC_LEN		8
+#define STATS_VERSION		1
+#define STATS_RECORD_LEN	66	/* must be < BUFSIZ */
+#define STATS_ERR_UNKNOWN	0xff
+
 #ifndef MAX
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 #endif
@@ -11,7 +22,21 @@
 #define MIN(x, y) ((x) < (y)? (x) : (y))
 #endif
 
+/* little-endian encoding of the binary formats (response stats, distributed mode) */
+static inline char *put_le16(char *p, uint16_t v) { v = htole16(v); memcpy(p, &v, 2); return p + 2; }
+static inline char *put_le32(char *p, uint32_t v) { v = htole32(v); memcpy(p, &v, 4); return p + 4; }
+static inline char *put_le64(char *p, uint64_t v) { v = htole64(v); memcpy(p, &v, 8); return p + 8; }
+static inline uint16_t get_le16(const char *p) { uint16_t v; memcpy(&v, p, 2); return le16toh(v); }
+static inline uint32_t get_le32(const char *p) { uint32_t v; memcpy(&v, p, 4); return le32toh(v); }
+static inline uint64_t get_le64(const char *p) { uint64_t v; memcpy(&v, p, 8); return le64toh(v); }
+
 /* Module functions */
+extern uint64_t request_start(connection *);
+extern void response_record(connection *, uint64_t);
+extern char *request_def_name(char *, size_t, const request_def *);
+extern int stats_header_write(FILE *, const request_def *, int);
 extern int write_stats_line(FILE *, connection *, char *);
+extern int stats_dump(const char *);
+extern void stats_buf_flush(FILE *, thread *);
 
 #endif /* STATS_H */
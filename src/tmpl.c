@@ -0,0 +1,235 @@
+/*
+ * Request templates.  The HTTP/1.1 request headers of a request definition may contain slots,
+ * e.g. "path": "/item/{{rand:1-1000000}}?s={{seq}}", filled in anew for every request sent.  The
+ * requests built by request_def_requests_create() are compiled once into a list of literal
+ * segments, each followed by a slot, and rendered straight into a per-connection buffer sized
+ * for the longest possible request, so that sending a request does not allocate.
+ */
+#include <errno.h>		/* errno */
+#include <fcntl.h>		/* open() */
+#include <stdlib.h>		/* malloc(), free(), strtoull() */
+#include <string.h>		/* memcpy(), strstr(), strerror() */
+#include <sys/mman.h>		/* mmap(), munmap() */
+#include <sys/stat.h>		/* fstat() */
+#include <unistd.h>		/* close() */
+
+#include "mb.h"			/* cfg */
+#include "mcg.h"		/* mcg64_rand(), mcg64_jump() */
+#include "merr.h"
+#include "stats.h"		/* MAX() */
+#include "tmpl.h"
+
+/* Return a number in [0, range) from the random number r (Lemire's nearly divisionless reduction). */
+static inline uint64_t rand_range(uint64_t r, uint64_t range) {
+  return range? (uint64_t)(((__uint128_t)r * range) >> 64): r;
+}
+
+/* Write the decimal representation of n to out and return its length. */
+static inline size_t u64_print(char *out, uint64_t n) {
+  char buf[TMPL_NUM_MAX];
+  char *p = buf + sizeof(buf);
+
+  do {
+    *--p = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  memcpy(out, p, buf + sizeof(buf) - p);
+
+  return buf + sizeof(buf) - p;
+}
+
+/* Map the "values" file of d and index its non-empty lines. */
+static tmpl_values *values_load(const request_def *d) {
+  tmpl_values *v;
+  struct stat st;
+  char *p, *end, *eol;
+  uint64_t n = 0;
+  int fd;
+
+  if ((fd = open(d->values_file, O_RDONLY)) < 0)
+    die(EXIT_FAILURE, "cannot open values file %s: %s (%d)\n", d->values_file, strerror(errno), errno);
+  if (fstat(fd, &st) < 0)
+    die(EXIT_FAILURE, "cannot stat values file %s: %s (%d)\n", d->values_file, strerror(errno), errno);
+  if (st.st_size == 0)
+    die(EXIT_FAILURE, "values file %s is empty\n", d->values_file);
+  if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    die(EXIT_FAILURE, "cannot map values file %s: %s (%d)\n", d->values_file, strerror(errno), errno);
+  close(fd);
+
+  end = p + st.st_size;
+  for (char *l = p; l < end; l = eol + 1) {
+    if ((eol = memchr(l, '\n', end - l)) == NULL) eol = end;
+    if (eol > l && !(eol == l + 1 && *l == '\r')) n++;
+  }
+  if (!n)
+    die(EXIT_FAILURE, "values file %s has no values\n", d->values_file);
+
+  if ((v = malloc(sizeof(*v) + n * sizeof(v->line[0]))) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for values\n");
+  v->map = p;
+  v->map_len = st.st_size;
+  v->n = 0;
+  v->max_len = 0;
+  for (char *l = p; l < end; l = eol + 1) {
+    size_t len;
+
+    if ((eol = memchr(l, '\n', end - l)) == NULL) eol = end;
+    len = eol - l;
+    if (len && l[len - 1] == '\r') len--;
+    if (!len) continue;
+    v->line[v->n].p = l;
+    v->line[v->n++].len = len;
+    if (len > v->max_len) v->max_len = len;
+  }
+
+  return v;
+}
+
+/* Return the number of slots in the headers of request req. */
+static int slots_count(const char *req) {
+  const char *hdr_end = strstr(req, HTTP_CRLF HTTP_CRLF), *p;
+  int n = 0;
+
+  for (p = req; (p = strstr(p, TMPL_OPEN)) && p < hdr_end; p += sizeof(TMPL_OPEN) - 1) n++;
+
+  return n;
+}
+
+/* Parse slot name of length len into seg. */
+static void slot_parse(request_def *d, tmpl_seg *seg, const char *name, size_t len) {
+  char *end;
+
+  if (len == 3 && !strncmp(name, "seq", 3)) {
+    seg->slot = tmpl_seq;
+  } else if (len == 4 && !strncmp(name, "line", 4)) {
+    seg->slot = tmpl_line;
+  } else if (len == 9 && !strncmp(name, "line:rand", 9)) {
+    seg->slot = tmpl_line_rand;
+  } else if (len > 5 && !strncmp(name, "rand:", 5)) {
+    uint64_t hi;
+
+    seg->slot = tmpl_rand;
+    errno = 0;
+    seg->lo = strtoull(name + 5, &end, 10);
+    if (errno || end == name + 5 || *end != '-') goto err;
+    hi = strtoull(end + 1, &end, 10);
+    if (errno || end != name + len || hi < seg->lo) goto err;
+    seg->range = hi - seg->lo + 1;		/* 0: the whole uint64_t range */
+  } else {
+    goto err;
+  }
+
+  if ((seg->slot == tmpl_line || seg->slot == tmpl_line_rand) && !d->values_file)
+    die(EXIT_FAILURE, "request template slot " TMPL_OPEN "%.*s" TMPL_CLOSE " requires a values file\n", (int)len, name);
+
+  return;
+
+err:
+  die(EXIT_FAILURE, "invalid request template slot " TMPL_OPEN "%.*s" TMPL_CLOSE "\n", (int)len, name);
+}
+
+/* Compile request req of request definition d; the segments point into req. */
+static tmpl *tmpl_compile(request_def *d, const char *req, size_t req_len) {
+  const char *hdr_end = strstr(req, HTTP_CRLF HTTP_CRLF), *p = req, *open, *close;
+  tmpl *t;
+  tmpl_seg *seg;
+  int n = slots_count(req);
+
+  if ((t = calloc(1, sizeof(*t) + (n + 1) * sizeof(t->seg[0]))) == NULL)
+    die(EXIT_FAILURE, "calloc(): cannot allocate memory for a request template\n");
+
+  for (seg = t->seg; (open = strstr(p, TMPL_OPEN)) && open < hdr_end; seg++) {
+    if ((close = strstr(open, TMPL_CLOSE)) == NULL || close > hdr_end)
+      die(EXIT_FAILURE, "unterminated request template slot: %.*s\n", (int)(strcspn(open, HTTP_CRLF)), open);
+    seg->lit = p;
+    seg->lit_len = open - p;
+    open += sizeof(TMPL_OPEN) - 1;
+    slot_parse(d, seg, open, close - open);
+    t->max_len += seg->lit_len + ((seg->slot == tmpl_line || seg->slot == tmpl_line_rand)? d->values->max_len: TMPL_NUM_MAX);
+    p = close + sizeof(TMPL_CLOSE) - 1;
+  }
+
+  /* the rest of the headers and the body */
+  seg->lit = p;
+  seg->lit_len = req + req_len - p;
+  seg->slot = tmpl_end;
+  t->max_len += seg->lit_len;
+  t->n = seg - t->seg + 1;
+
+  return t;
+}
+
+/* Compile the requests of request definition d into templates if they have any slots. */
+void tmpl_def_init(request_def *d) {
+  if (!slots_count(d->request)) {
+    if (d->values_file) warning("values file %s given, but the request has no template slots\n", d->values_file);
+    return;
+  }
+
+  if (d->values_file) d->values = values_load(d);
+  d->tmpl[0] = tmpl_compile(d, d->request, d->request_length);
+  d->tmpl[1] = tmpl_compile(d, d->request_cclose, d->request_cclose_length);
+}
+
+void tmpl_def_free(request_def *d) {
+  free(d->tmpl[0]);
+  free(d->tmpl[1]);
+  d->tmpl[0] = d->tmpl[1] = NULL;
+  if (d->values) {
+    munmap(d->values->map, d->values->map_len);
+    free(d->values);
+    d->values = NULL;
+  }
+  free(d->values_file);
+  d->values_file = NULL;
+}
+
+/* Allocate the render buffer of connection c and give it its own part of the PRNG stream. */
+void tmpl_conn_init(connection *c) {
+  const request_def *d = c->def;
+
+  if (!d->tmpl[0]) return;
+
+  if ((c->tmpl_buf = malloc(MAX(d->tmpl[0]->max_len, d->tmpl[1]->max_len))) == NULL)
+    die(EXIT_FAILURE, "malloc(): cannot allocate memory for a request template\n");
+  /* agents of a distributed test draw different numbers for the same client */
+  c->tmpl_rnd = TMPL_RANDOM_SEED + 2 * ((__uint128_t)cfg.shard_id << 32 | d->target);	/* keep it odd */
+  mcg64_jump(&c->tmpl_rnd, (uint64_t)c->client << TMPL_RANDOM_SPREAD);
+}
+
+/* Render the template of the current request of connection c into c->tmpl_buf and return its length. */
+size_t tmpl_render(connection *c) {
+  const request_def *d = c->def;
+  const tmpl *t = d->tmpl[c->header_cclose];
+  const tmpl_seg *seg;
+  uint64_t seq = c->client + c->cstats.reqs_total * d->clients, i;
+  char *p = c->tmpl_buf;
+
+  if (cfg.shards > 1)
+    /* distributed mode: the agents interleave their sequences to share one without collisions */
+    seq = seq * cfg.shards + cfg.shard_id;
+
+  for (seg = t->seg; seg < t->seg + t->n; seg++) {
+    memcpy(p, seg->lit, seg->lit_len);
+    p += seg->lit_len;
+
+    switch (seg->slot) {
+      case tmpl_seq:
+        p += u64_print(p, seq);
+        break;
+      case tmpl_rand:
+        p += u64_print(p, seg->lo + rand_range(mcg64_rand(&c->tmpl_rnd), seg->range));
+        break;
+      case tmpl_line:
+      case tmpl_line_rand:
+        i = (seg->slot == tmpl_line)? seq % d->values->n: rand_range(mcg64_rand(&c->tmpl_rnd), d->values->n);
+        memcpy(p, d->values->line[i].p, d->values->line[i].len);
+        p += d->values->line[i].len;
+        break;
+      case tmpl_end:
+        break;
+    }
+  }
+
+  return c->tmpl_len = p - c->tmpl_buf;
+}
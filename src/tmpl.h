@@ -0,0 +1,58 @@
+#ifndef TMPL_H
+#define TMPL_H
+
+#include <stddef.h>			/* size_t */
+#include <stdint.h>			/* uint64_t */
+
+#include "net.h"			/* request_def, connection */
+
+#define TMPL_OPEN		"{{"		/* start of a template slot */
+#define TMPL_CLOSE		"}}"		/* end of a template slot */
+#define TMPL_NUM_MAX		20		/* maximum width of a slot's decimal number (UINT64_MAX) */
+#define TMPL_RANDOM_SEED	1		/* seeded MCG state the random slots are drawn from */
+#define TMPL_RANDOM_SPREAD	32		/* log2 of the distance between the clients' parts of the PRNG stream */
+
+/* slot types of a request template */
+typedef enum {
+  tmpl_seq,			/* {{seq}}: sequence number of the request among all the requests of the definition */
+  tmpl_rand,			/* {{rand:A-B}}: uniformly distributed number between A and B (inclusive) */
+  tmpl_line,			/* {{line}}: the next line of the "values" file, round-robin */
+  tmpl_line_rand,		/* {{line:rand}}: a random line of the "values" file */
+  tmpl_end			/* no slot; the last segment */
+} tmpl_slot;
+
+/* a literal part of the request followed by a slot */
+typedef struct tmpl_seg {
+  const char *lit;		/* literal data preceding the slot */
+  size_t lit_len;		/* length of lit */
+  tmpl_slot slot;		/* slot filled in after lit */
+  uint64_t lo;			/* tmpl_rand: lower bound */
+  uint64_t range;		/* tmpl_rand: number of values from lo on */
+} tmpl_seg;
+
+/* a request compiled into literal segments and slots, see tmpl_def_init() */
+typedef struct tmpl {
+  size_t max_len;		/* maximum length of the rendered request */
+  int n;			/* number of segments */
+  tmpl_seg seg[];
+} tmpl;
+
+/* lines of a memory-mapped "values" file */
+typedef struct tmpl_values {
+  char *map;			/* file mapping */
+  size_t map_len;		/* length of map */
+  uint64_t n;			/* number of non-empty lines */
+  size_t max_len;		/* length of the longest line */
+  struct {
+    const char *p;
+    size_t len;
+  } line[];
+} tmpl_values;
+
+/* Module functions */
+extern void tmpl_def_init(request_def *);
+extern void tmpl_def_free(request_def *);
+extern void tmpl_conn_init(connection *);
+extern size_t tmpl_render(connection *);
+
+#endif /* TMPL_H */